@@ -6,10 +6,18 @@
 extern "C" {
 #endif
 
+// Commutative update operators, must match ZSIM_MAGIC_OP_COUP_* in zsim.cpp
 #define ACC_ADD 1029
 #define ACC_AND 1030
 #define ACC_OR  1031
 #define ACC_XOR 1032
+#define ACC_FLUSH 1033 // not an operator, see coup_flush
+// Operators x86 has no atomic instruction for; zsim performs the update itself (see coup_update_emulated32/64)
+#define ACC_FADD32 1034
+#define ACC_FADD64 1035
+#define ACC_MIN 1036 // signed
+#define ACC_MAX 1037 // signed
+#define ACC_VUPDATE 1038 // not an operator, see coup_vupdate
 
 void coup_add(int *addr, int val, unsigned coup_op) {
     // just an atomic add in assembly
@@ -37,6 +45,127 @@ static inline int coup_load(int* var, unsigned coup_op) {
     return output;
 }
 
+// Native versions of the COUP operators, on values of 4 or 8 bytes
+static inline unsigned long coup_apply(unsigned coup_op, unsigned long a, unsigned long b, unsigned width) {
+    union { unsigned u; float f; } fa32, fb32;
+    union { unsigned long u; double d; } fa64, fb64;
+    switch (coup_op) {
+        case ACC_ADD: return a + b;
+        case ACC_AND: return a & b;
+        case ACC_OR:  return a | b;
+        case ACC_XOR: return a ^ b;
+        case ACC_FADD32:
+            fa32.u = (unsigned)a; fb32.u = (unsigned)b;
+            fa32.f += fb32.f;
+            return fa32.u;
+        case ACC_FADD64:
+            fa64.u = a; fb64.u = b;
+            fa64.d += fb64.d;
+            return fa64.u;
+        case ACC_MIN:
+            if (width == 4) return ((int)a < (int)b)? a : b;
+            return ((long)a < (long)b)? a : b;
+        case ACC_MAX:
+            if (width == 4) return ((int)a > (int)b)? a : b;
+            return ((long)a > (long)b)? a : b;
+        default:
+            __builtin_trap(); // unknown operator
+    }
+}
+
+static inline void coup_native_update(void* addr, unsigned long bits, unsigned coup_op, unsigned width) {
+    if (width == 4) {
+        unsigned* p = (unsigned*)addr;
+        unsigned old = __atomic_load_n(p, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(p, &old, (unsigned)coup_apply(coup_op, old, bits, 4), 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {}
+    } else {
+        unsigned long* p = (unsigned long*)addr;
+        unsigned long old = __atomic_load_n(p, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(p, &old, coup_apply(coup_op, old, bits, 8), 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {}
+    }
+}
+
+// The tagged instruction is a lock add of 0, which zsim simulates as the update, and the value goes in RSI.
+// zsim performs the update on memory right before it and sets RAX to 1; natively, RAX stays 0 and we perform
+// the update with a CAS loop (under zsim, simulating that loop would add the very traffic COUP avoids).
+static inline void coup_update_emulated32(void* addr, unsigned long bits, unsigned coup_op) {
+    unsigned long done = 0;
+    __asm__ __volatile__(
+         " xchg %%rcx, %%rcx ;\n"
+         " lock addl $0, %0  ;\n"
+        : "+m"(*(int*)addr), "+a"(done)
+        : "c"(coup_op), "S"(bits)
+        : "memory"
+    );
+    if (!done) coup_native_update(addr, bits, coup_op, 4);
+}
+
+static inline void coup_update_emulated64(void* addr, unsigned long bits, unsigned coup_op) {
+    unsigned long done = 0;
+    __asm__ __volatile__(
+         " xchg %%rcx, %%rcx ;\n"
+         " lock addq $0, %0  ;\n"
+        : "+m"(*(long*)addr), "+a"(done)
+        : "c"(coup_op), "S"(bits)
+        : "memory"
+    );
+    if (!done) coup_native_update(addr, bits, coup_op, 8);
+}
+
+static inline void coup_fadd_f32(float* addr, float val) {
+    union { float f; unsigned u; } v;
+    v.f = val;
+    coup_update_emulated32(addr, v.u, ACC_FADD32);
+}
+
+static inline void coup_fadd_f64(double* addr, double val) {
+    union { double d; unsigned long u; } v;
+    v.d = val;
+    coup_update_emulated64(addr, v.u, ACC_FADD64);
+}
+
+static inline void coup_min(int* addr, int val) { coup_update_emulated32(addr, (unsigned)val, ACC_MIN); }
+static inline void coup_max(int* addr, int val) { coup_update_emulated32(addr, (unsigned)val, ACC_MAX); }
+static inline void coup_min64(long* addr, long val) { coup_update_emulated64(addr, (unsigned long)val, ACC_MIN); }
+static inline void coup_max64(long* addr, long val) { coup_update_emulated64(addr, (unsigned long)val, ACC_MAX); }
+
+// Reduces all U lines in [addr, addr+bytes) now, e.g., right before the barrier that ends an update phase,
+// so the reads after it find them reduced
+static inline void coup_flush(void* addr, unsigned long bytes) {
+    COMPILER_BARRIER();
+    __asm__ __volatile__(
+        " xchg %%rcx, %%rcx ;\n"
+        :
+        : "c"(ACC_FLUSH), "D"(addr), "S"(bytes)
+        : "memory"
+    );
+    COMPILER_BARRIER();
+}
+
+// Vector update: for each bit i set in lane_mask, updates the width-byte (4 or 8) lane at base + i*width with
+// the one at vals + i*width, using operator coup_op (any ACC_ operator). zsim groups the lanes by line,
+// simulates one update per line, and performs the lanes' updates (setting RAX to 1, like the emulated
+// operators); natively, we update each lane with a CAS loop.
+static inline void coup_vupdate(void* base, const void* vals, unsigned long lane_mask, unsigned width, unsigned coup_op) {
+    register unsigned long r8 __asm__("r8") = width;
+    register unsigned long r9 __asm__("r9") = coup_op;
+    unsigned long done = 0;
+    COMPILER_BARRIER();
+    __asm__ __volatile__(
+        " xchg %%rcx, %%rcx ;\n"
+        : "+a"(done)
+        : "c"(ACC_VUPDATE), "D"(base), "S"(lane_mask), "d"(vals), "r"(r8), "r"(r9)
+        : "memory"
+    );
+    COMPILER_BARRIER();
+    if (done) return;
+    for (unsigned long m = lane_mask; m; m &= m - 1) {
+        unsigned lane = __builtin_ctzl(m);
+        unsigned long bits = (width == 4)? *(const unsigned*)((const char*)vals + lane*width) : *(const unsigned long*)((const char*)vals + lane*width);
+        coup_native_update((char*)base + lane*width, bits, coup_op, width);
+    }
+}
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,102 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "coup_hooks.h"
+
+using namespace std;
+
+/* Same decomposition as matrix.cpp, but in native floating point: each thread
+   emulates a DSA that multiplies one 16x16 chunk of A by the matching rows of
+   B, and accumulates its partial sums into the result with COUP FADD32. */
+
+static const unsigned sz = 16;
+
+struct FMatrix {
+    float* elements;
+    unsigned row, col;
+
+    FMatrix(unsigned r, unsigned c) : row(r), col(c) {
+        elements = (float*)calloc(row * col, sizeof(float));
+    }
+
+    ~FMatrix() { free(elements); }
+
+    float& at(unsigned r, unsigned c) { return elements[r * col + c]; }
+};
+
+static inline unsigned pieces(unsigned n) { return (n + sz - 1) / sz; }
+
+void mult(FMatrix* A, FMatrix* B, FMatrix* Res, unsigned ptA) {
+    unsigned col_pt = ptA % pieces(A->col);
+    unsigned row_pt = ptA / pieces(A->col);
+
+    // chunk of A and its rows of B, zero-padded
+    float CalA[sz][sz];
+    memset(CalA, 0, sizeof(CalA));
+    vector<float> CalB(sz * B->col, 0.0f);
+    for (unsigned r = 0; r < sz; r++) {
+        for (unsigned c = 0; c < sz; c++) {
+            if (row_pt * sz + r < A->row && col_pt * sz + c < A->col) CalA[r][c] = A->at(row_pt * sz + r, col_pt * sz + c);
+        }
+        if (col_pt * sz + r < B->row) memcpy(&CalB[r * B->col], &B->at(col_pt * sz + r, 0), B->col * sizeof(float));
+    }
+
+    for (unsigned k = 0; k < B->col; k++) {
+        for (unsigned i = 0; i < sz; i++) {
+            unsigned i_offs = row_pt * sz + i;
+            if (i_offs >= Res->row) break;
+            float tmp = 0.0f;
+            for (unsigned j = 0; j < sz; j++) tmp += CalA[i][j] * CalB[j * B->col + k];
+            coup_fadd_f32(&Res->at(i_offs, k), tmp);    // finally where the magic happens
+        }
+    }
+}
+
+int main() {
+    FMatrix A(100, 256);
+    FMatrix B(256, 100);
+
+    float v = 0.01;
+    for (unsigned i = 0; i < A.row * A.col; i++) { A.elements[i] = v; v += 0.01; }
+    v = 0.01;
+    for (unsigned i = 0; i < B.row * B.col; i++) { B.elements[i] = v; v += 0.01; }
+
+    // reference result, to verify that the algorithm is working
+    FMatrix C(A.row, B.col);
+    for (unsigned r = 0; r < A.row; r++)
+        for (unsigned k = 0; k < B.col; k++) {
+            double acc = 0.0;
+            for (unsigned c = 0; c < A.col; c++) acc += (double)A.at(r, c) * B.at(c, k);
+            C.at(r, k) = acc;
+        }
+
+    zsim_roi_begin();
+
+    FMatrix CC(A.row, B.col);    // result matrix
+    unsigned chunks = pieces(A.row) * pieces(A.col);
+    printf("%d threads will be created\n", chunks);
+
+    // one thread per chunk, each emulating a DSA
+    vector<thread> jobs;
+    for (unsigned ptA = 0; ptA < chunks; ptA++) jobs.emplace_back(mult, &A, &B, &CC, ptA);
+    for (auto& j : jobs) j.join();
+
+    zsim_roi_end();
+
+    // partial sums are added in any order, so compare with a relative tolerance
+    unsigned fails = 0;
+    for (unsigned r = 0; r < C.row; r++)
+        for (unsigned c = 0; c < C.col; c++) {
+            float ref = C.at(r, c), res = CC.at(r, c);
+            if (fabs(ref - res) > 1e-4 * fabs(ref)) {
+                if (fails++ < 10) printf("FAIL - [%d, %d] %f\t %f\n", r, c, ref, res);
+            }
+        }
+
+    printf("end (%d mismatches)\n", fails);
+    return 0;
+}
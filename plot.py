@@ -4,6 +4,16 @@ import h5py
 import argparse
 import os
 
+# Columns of the trans/transLat stats (caches with transitionStats, see coherence_events.h)
+TRANS_COLS = ["GETS", "GETX", "PUTS", "PUTX", "GETU", "PUTU", "RATOM", "RFLUSH", "INV", "INVX", "FWD", "UPD", "EVICT"]
+
+def get_stat(cache, string):
+    # Plain stats (e.g., hGETS) or transition matrix cells (e.g., trans/U/GETS)
+    if '/' not in string:
+        return np.sum(cache[string])
+    matrix, state, col = string.split('/')
+    return np.sum(cache[matrix][state][..., TRANS_COLS.index(col)])
+
 def get_data(path, l2, l1, cycles):
     files = os.listdir(path)
     print(files)
@@ -27,14 +37,14 @@ def get_data(path, l2, l1, cycles):
         current_data = []
         for string in l2:
             try:
-                current_data.append(np.sum(dset[-1]['l2_wimpy'][string]))
+                current_data.append(get_stat(dset[-1]['l2_wimpy'], string))
             except:
                  current_data.append(0)
         
         for string in l1:
             try:
                 print(f"caught {string}")
-                current_data.append(np.sum(dset[-1]['l1d_wimpy'][string]))
+                current_data.append(get_stat(dset[-1]['l1d_wimpy'], string))
             except:
                  print(f"except {string}")
                  current_data.append(0)
@@ -97,7 +107,7 @@ def create_bar_graph(coup_path, regular_path, name, l2, l1, cycles):
         print('should be saving a file')
         fig.tight_layout()
         
-        fig.savefig('plots/l2_'+name+'_'+l2[k]+".png", format='png', dpi=600)
+        fig.savefig('plots/l2_'+name+'_'+l2[k].replace('/', '_')+".png", format='png', dpi=600)
 
     # L1 data
     ik = 0
@@ -120,7 +130,7 @@ def create_bar_graph(coup_path, regular_path, name, l2, l1, cycles):
         print('should be saving a file')
         fig.tight_layout()
         
-        fig.savefig('plots/l1_'+name+'_'+l1[ik]+".png", format='png', dpi=600)
+        fig.savefig('plots/l1_'+name+'_'+l1[ik].replace('/', '_')+".png", format='png', dpi=600)
         ik+=1
 
     #check if cycles graph should be made
@@ -150,7 +160,7 @@ if __name__ == "__main__":
     parser.add_argument("coup", help="The relative path to the folder with the coup stats h5 files", type=str)
     parser.add_argument("regular", help="The relative path to the folder with the non-coup stats h5 files", type=str)
     parser.add_argument("name", help="Name that the png that will be created", type=str)
-    parser.add_argument("-l2", nargs='+', help="all the l2 arguments you want to make graphs for")
+    parser.add_argument("-l2", nargs='+', help="all the l2 arguments you want to make graphs for (stats, or transition cells like trans/U/GETS)")
     parser.add_argument("-l1", nargs='+', help="all the l1 arguments you want to make graphs for")
     parser.add_argument("-average_cycles", help="Do you have to make a graph comaring average cycles", type=bool)
     
@@ -0,0 +1,222 @@
+/* COUP opportunity analyzer: finds the lines of an access trace (from a
+ * TracingCache) whose traffic COUP would remove, and estimates how much.
+ *
+ * Without COUP, a core that updates a shared line reads it (GETS) and then
+ * writes it (GETX). When several cores update a line with no reads in
+ * between, each update moves the line and invalidates the previous updater.
+ * With COUP, each updater gets the line in U once, and the read that ends the
+ * run reduces it, invalidating each updater once.
+ *
+ * So for each line, the analyzer splits its accesses into epochs: runs of
+ * updates (a GETX right after a GETS from the same child) that end at the
+ * first read (a GETS not followed by its child's GETX) or plain write (any
+ * other GETX). Epochs with at least -u distinct updaters are COUP
+ * opportunities, and the analyzer estimates their savings:
+ *  - MESI: a GETS and a GETX per update, and an invalidation per change of
+ *    updater (the line moves from core to core).
+ *  - COUP: a GETU per updater, and an invalidation per updater (the reduction).
+ *
+ * The trace is streamed in chunks. Each chunk is split by line address among
+ * -j worker threads, which own disjoint sets of lines, so the per-line order
+ * of accesses is preserved and workers share nothing. Accesses are processed
+ * in trace order: run sorttrace first if the trace interleaves children.
+ */
+
+#include <algorithm>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "access_tracing.h"
+#include "galloc.h"
+
+using namespace std;
+
+#define CHUNK_RECORDS (1024*1024u)
+
+struct Options {
+    uint32_t threads = 4;
+    uint32_t minUpdaters = 2;
+    uint32_t topLines = 20;
+};
+
+struct LineState {
+    //Current epoch
+    int32_t pendingGets = -1; //child whose GETS may be the read half of an update
+    int32_t lastUpdater = -1;
+    uint64_t epochUpdates = 0;
+    uint64_t epochTransfers = 0; //updates by a different child than the previous one
+    vector<uint16_t> updaters;
+
+    //Totals over COUP epochs
+    uint64_t coupEpochs = 0;
+    uint64_t coupUpdates = 0;
+    uint64_t mesiInvs = 0;
+    uint64_t savedInvs = 0;
+    int64_t savedMsgs = 0;
+};
+
+struct Totals {
+    uint64_t records = 0;
+    uint64_t lines = 0;
+    uint64_t coupLines = 0;
+    uint64_t coupEpochs = 0;
+    uint64_t coupUpdates = 0;
+    uint64_t mesiInvs = 0;
+    uint64_t savedInvs = 0;
+    int64_t savedMsgs = 0;
+};
+
+class Partition {
+    private:
+        unordered_map<Address, LineState> lines;
+        const uint32_t minUpdaters;
+        uint64_t records;
+
+        void endEpoch(LineState& l) {
+            uint64_t updaters = l.updaters.size();
+            if (updaters >= minUpdaters) {
+                uint64_t mesiMsgs = 2*l.epochUpdates + l.epochTransfers;
+                uint64_t coupMsgs = 2*updaters;
+                l.coupEpochs++;
+                l.coupUpdates += l.epochUpdates;
+                l.mesiInvs += l.epochTransfers;
+                l.savedInvs += (l.epochTransfers > updaters)? l.epochTransfers - updaters : 0;
+                l.savedMsgs += (int64_t)mesiMsgs - (int64_t)coupMsgs;
+            }
+            l.lastUpdater = -1;
+            l.epochUpdates = 0;
+            l.epochTransfers = 0;
+            l.updaters.clear();
+        }
+
+        void update(LineState& l, uint16_t child) {
+            l.epochUpdates++;
+            if (l.lastUpdater != child) l.epochTransfers++;
+            l.lastUpdater = child;
+            if (find(l.updaters.begin(), l.updaters.end(), child) == l.updaters.end()) l.updaters.push_back(child);
+        }
+
+    public:
+        explicit Partition(uint32_t _minUpdaters) : minUpdaters(_minUpdaters), records(0) {}
+
+        void process(const vector<AccessRecord>& accs) {
+            for (const AccessRecord& acc : accs) {
+                records++;
+                if (IsPut(acc.type)) continue; //evictions don't change what the line is used for
+                LineState& l = lines[acc.lineAddr];
+                bool completesUpdate = (acc.type == GETX) && (l.pendingGets == (int32_t)acc.childId);
+                //Any access but its own GETX makes a pending GETS a read
+                if (l.pendingGets != -1 && !completesUpdate) endEpoch(l);
+                l.pendingGets = -1;
+
+                if (acc.type == GETS) {
+                    l.pendingGets = acc.childId;
+                } else if (completesUpdate) {
+                    update(l, acc.childId);
+                } else {
+                    endEpoch(l); //plain write, or a request type MESI traces don't have
+                }
+            }
+        }
+
+        void finish(Totals& t, vector<pair<Address, LineState>>& coupLines) {
+            t.records += records;
+            t.lines += lines.size();
+            for (auto& kv : lines) {
+                LineState& l = kv.second;
+                endEpoch(l); //a trailing pending GETS is a read; ends the epoch either way
+                if (!l.coupEpochs) continue;
+                t.coupLines++;
+                t.coupEpochs += l.coupEpochs;
+                t.coupUpdates += l.coupUpdates;
+                t.mesiInvs += l.mesiInvs;
+                t.savedInvs += l.savedInvs;
+                t.savedMsgs += l.savedMsgs;
+                coupLines.push_back(kv);
+            }
+        }
+};
+
+static inline uint32_t partitionOf(Address lineAddr, uint32_t parts) {
+    return ((lineAddr * 0x9E3779B97F4A7C15ul) >> 32) % parts; //interleave lines so hot regions spread across workers
+}
+
+static void usage(const char* prog) {
+    info("Finds COUP opportunities (lines updated by several children with no interleaved reads) in an access trace");
+    info("Usage: %s [-j threads] [-u minUpdaters] [-n topLines] <trace>", prog);
+    info("  -j: worker threads (default 4)");
+    info("  -u: distinct updaters for an epoch to count (default 2)");
+    info("  -n: lines to print, by estimated savings (default 20)");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    InitLog(""); //no log header
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:u:n:h")) != -1) {
+        switch (opt) {
+            case 'j': o.threads = atoi(optarg); break;
+            case 'u': o.minUpdaters = atoi(optarg); break;
+            case 'n': o.topLines = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || !o.threads || !o.minUpdaters) usage(argv[0]);
+
+    gm_init(32<<20 /*32 MB, should be enough*/);
+    AccessTraceReader tr(argv[optind]);
+    uint64_t totalRecords = tr.getNumRecords();
+    info("Analyzing %ld records from %d children, %d threads", totalRecords, tr.getNumChildren(), o.threads);
+
+    vector<Partition*> parts;
+    for (uint32_t p = 0; p < o.threads; p++) parts.push_back(new Partition(o.minUpdaters));
+    vector<vector<AccessRecord>> chunks(o.threads);
+
+    uint64_t read = 0;
+    while (!tr.empty()) {
+        for (auto& c : chunks) c.clear();
+        for (uint32_t i = 0; i < CHUNK_RECORDS && !tr.empty(); i++) {
+            AccessRecord acc = tr.read();
+            chunks[partitionOf(acc.lineAddr, o.threads)].push_back(acc);
+            read++;
+        }
+
+        vector<thread> workers;
+        for (uint32_t p = 0; p < o.threads; p++) workers.push_back(thread([&, p]() { parts[p]->process(chunks[p]); }));
+        for (thread& w : workers) w.join();
+
+        printf("Read %3ld%%\r", read*100/totalRecords);
+        fflush(stdout);
+    }
+    printf("\n");
+
+    Totals t;
+    vector<pair<Address, LineState>> coupLines;
+    for (Partition* p : parts) p->finish(t, coupLines);
+    assert(t.records == totalRecords);
+
+    uint64_t traced = t.records;
+    info("%ld lines, %ld with COUP opportunities (%ld epochs, %ld updates)", t.lines, t.coupLines, t.coupEpochs, t.coupUpdates);
+    info("Invalidations in COUP epochs: %ld, saved by COUP: %ld", t.mesiInvs, t.savedInvs);
+    info("Requests + invalidations saved: %ld (%.1f%% of traced requests)", t.savedMsgs, traced? 100.0*t.savedMsgs/traced : 0.0);
+
+    sort(coupLines.begin(), coupLines.end(), [](const pair<Address, LineState>& a, const pair<Address, LineState>& b) {
+        return a.second.savedMsgs > b.second.savedMsgs;
+    });
+    if (coupLines.size() > o.topLines) coupLines.resize(o.topLines);
+    if (coupLines.size()) {
+        info("%20s %10s %12s %12s %12s", "LineAddr", "Epochs", "Updates", "SavedInvs", "SavedMsgs");
+        for (auto& kv : coupLines) {
+            const LineState& l = kv.second;
+            info("%20p %10ld %12ld %12ld %12ld", (uint64_t*)kv.first, l.coupEpochs, l.coupUpdates, l.savedInvs, l.savedMsgs);
+        }
+    }
+
+    for (Partition* p : parts) delete p;
+    return 0;
+}
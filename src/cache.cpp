@@ -31,7 +31,14 @@
 #include "zsim.h"
 
 Cache::Cache(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, const g_string& _name)
-    : cc(_cc), array(_array), rp(_rp), numLines(_numLines), accLat(_accLat), invLat(_invLat), name(_name) {}
+    : cc(_cc), array(_array), rp(_rp), numLines(_numLines), evTrace(nullptr), evCacheId(0), transStats(nullptr), hotLines(nullptr), accLat(_accLat), invLat(_invLat), name(_name)
+{
+    if (dynamic_cast<MESICC*>(cc)) ccKind = CC_MESI;
+    else if (dynamic_cast<MESITerminalCC*>(cc)) ccKind = CC_MESI_TERMINAL;
+    else if (dynamic_cast<MEUSICC*>(cc)) ccKind = CC_MEUSI;
+    else if (dynamic_cast<MEUSITerminalCC*>(cc)) ccKind = CC_MEUSI_TERMINAL;
+    else ccKind = CC_OTHER;
+}
 
 const char* Cache::getName() {
     return name.c_str();
@@ -56,14 +63,19 @@ void Cache::initCacheStats(AggregateStat* cacheStat) {
     cc->initStats(cacheStat);
     array->initStats(cacheStat);
     rp->initStats(cacheStat);
+    if (transStats) transStats->initStats(cacheStat);
 }
 
 uint64_t Cache::access(MemReq& req) {
-    
+    DISPATCH_CC(accessImpl, req);
+}
+
+template <typename C>
+uint64_t Cache::accessImpl(C* cc, MemReq& req) {
     uint64_t respCycle = req.cycle;
     bool skipAccess = cc->startAccess(req); //may need to skip access due to races (NOTE: may change req.type!)
     if (likely(!skipAccess)) {
-        bool updateReplacement = (req.type == GETS) || (req.type == GETX) || (req.type == GETU);
+        bool updateReplacement = (req.type == GETS) || (req.type == GETX) || (req.type == GETU) || (req.type == RATOM);
         int32_t lineId = array->lookup(req.lineAddr, &req, updateReplacement);
         respCycle += accLat;
 
@@ -72,10 +84,13 @@ uint64_t Cache::access(MemReq& req) {
             Address wbLineAddr;
             lineId = array->preinsert(req.lineAddr, &req, &wbLineAddr); //find the lineId to replace
             trace(Cache, "[%s] Evicting 0x%lx", name.c_str(), wbLineAddr);
+            MESIState evState = cc->getState(lineId);
+            if (evTrace && evState != I) recordEvent(req.srcId, COH_EV_EVICTION, wbLineAddr, evState, I, COUP_NONE, respCycle);
 
             //Evictions are not in the critical path in any sane implementation -- we do not include their delays
             //NOTE: We might be "evicting" an invalid line for all we know. Coherence controllers will know what to do
-            cc->processEviction(req, wbLineAddr, lineId, respCycle); //1. if needed, send invalidates/downgrades to lower level
+            uint64_t evDoneCycle = cc->processEviction(req, wbLineAddr, lineId, respCycle); //1. if needed, send invalidates/downgrades to lower level
+            if (transStats && evState != I) transStats->inc(evState, COH_EV_EVICTION, evDoneCycle - respCycle);
 
             array->postinsert(req.lineAddr, &req, lineId); //do the actual insertion. NOTE: Now we must split insert into a 2-phase thing because cc unlocks us.
             
@@ -89,7 +104,13 @@ uint64_t Cache::access(MemReq& req) {
             wbAcc = evRec->popRecord();
         }
 
+        MESIState oldState = (lineId != -1)? cc->getState(lineId) : I;
         respCycle = cc->processAccess(req, lineId, respCycle);
+        if (evTrace) recordEvent(req.srcId, req.type, req.lineAddr, oldState, (lineId != -1)? cc->getState(lineId) : I, req.coupOp, req.cycle);
+        if (transStats) transStats->inc(oldState, req.type, respCycle - req.cycle);
+        if (hotLines && ((req.type == GETX && (oldState == S || oldState == U)) || (req.type == GETU && oldState == S))) {
+            hotLines->record(HOT_UPG, req.lineAddr, req.srcId);
+        }
 
 
         // Access may have generated another timing record. If *both* access
@@ -134,10 +155,28 @@ void Cache::startInvalidate() {
 
 uint64_t Cache::finishInvalidate(const InvReq& req) {
     int32_t lineId = array->lookup(req.lineAddr, nullptr, false);
+    if (req.held) {
+        *req.held = (lineId != -1) && cc->isValid(lineId);
+        if (!*req.held) {
+            cc->skipInv(); //releases downLock
+            return req.cycle + invLat;
+        }
+    }
     assert_msg(lineId != -1, "[%s] Invalidate on non-existing address 0x%lx type %s lineId %d, reqWriteback %d", name.c_str(), req.lineAddr, InvTypeName(req.type), lineId, *req.writeback);
     uint64_t respCycle = req.cycle + invLat;
     trace(Cache, "[%s] Invalidate start 0x%lx type %s lineId %d, reqWriteback %d", name.c_str(), req.lineAddr, InvTypeName(req.type), lineId, *req.writeback);
+    MESIState oldState = cc->getState(lineId);
     respCycle = cc->processInv(req, lineId, respCycle); //send invalidates or downgrades to children, and adjust our own state
+    if (evTrace) {
+        //cc has unlocked the line, so derive its new state instead of reading it
+        MESIState newState = (req.type == INV)? I : (req.type == INVX)? S : (req.type == UPD)? U : oldState;
+        recordEvent(req.srcId, COH_EV_INV + req.type, req.lineAddr, oldState, newState, req.coupOp, req.cycle);
+    }
+    if (transStats) transStats->inc(oldState, COH_EV_INV + req.type, respCycle - req.cycle);
+    if (hotLines && oldState != I) {
+        if (req.type == INV && oldState == U) hotLines->record(HOT_RED, req.lineAddr, req.srcId);
+        else if (req.type == INV || req.type == INVX) hotLines->record(HOT_INV, req.lineAddr, req.srcId);
+    }
     trace(Cache, "[%s] Invalidate end 0x%lx type %s lineId %d, reqWriteback %d, latency %ld", name.c_str(), req.lineAddr, InvTypeName(req.type), lineId, *req.writeback, respCycle - req.cycle);
 
     return respCycle;
@@ -28,6 +28,9 @@
 
 #include "cache_arrays.h"
 #include "coherence_ctrls.h"
+#include "coherence_events.h"
+#include "coup_cc.h"
+#include "hot_lines.h"
 #include "g_std/g_string.h"
 #include "g_std/g_vector.h"
 #include "memory_hierarchy.h"
@@ -38,8 +41,9 @@ class Network;
 
 /* General coherent modular cache. The replacement policy and cache array are
  * pretty much mix and match. The coherence controller interfaces are general
- * too, but to avoid virtual function call overheads we work with MESI
- * controllers, since for now we only have MESI controllers
+ * too, but to avoid virtual function call overheads, accesses are specialized
+ * to the concrete (final) class of each cache's controller: MESI or MEUSI,
+ * chosen per cache (sys.caches.<grp>.protocol).
  */
 class Cache : public BaseCache {
     protected:
@@ -47,8 +51,22 @@ class Cache : public BaseCache {
         CacheArray* array;
         ReplPolicy* rp;
 
+        //Concrete class of cc, see DISPATCH_CC
+        enum CCKind {CC_OTHER, CC_MESI, CC_MESI_TERMINAL, CC_MEUSI, CC_MEUSI_TERMINAL};
+        CCKind ccKind;
+
         uint32_t numLines;
 
+        //Coherence event trace, nullptr unless sys.caches.<grp>.traceEvents is set (see coherence_events.h)
+        CoherenceEventTrace* evTrace;
+        uint16_t evCacheId;
+
+        //(state x request) transition stats, nullptr unless sys.caches.<grp>.transitionStats is set
+        CoherenceTransitionStats* transStats;
+
+        //Hot-line profiler of this bank (merged by the group), nullptr unless sys.caches.<grp>.hotLines is set
+        HotLineProfiler* hotLines;
+
         //Latencies
         uint32_t accLat; //latency of a normal access (could split in get/put, probably not needed)
         uint32_t invLat; //latency of an invalidation
@@ -63,6 +81,19 @@ class Cache : public BaseCache {
         void setChildren(const g_vector<BaseCache*>& children, Network* network);
         void initStats(AggregateStat* parentStat);
 
+        void setEventTrace(CoherenceEventTrace* _evTrace) {
+            evTrace = _evTrace;
+            evCacheId = evTrace->registerCache(name.c_str());
+        }
+
+        void enableTransitionStats() {
+            transStats = new CoherenceTransitionStats();
+        }
+
+        void setHotLines(HotLineProfiler* _hotLines) {
+            hotLines = _hotLines;
+        }
+
         virtual uint64_t access(MemReq& req);
 
         //NOTE: reqWriteback is pulled up to true, but not pulled down to false.
@@ -76,6 +107,26 @@ class Cache : public BaseCache {
 
         void startInvalidate(); // grabs cc's downLock
         uint64_t finishInvalidate(const InvReq& req); // performs inv and releases downLock
+
+        inline void recordEvent(uint32_t srcId, uint8_t kind, Address lineAddr, MESIState oldState, MESIState newState, CoupOp coupOp, uint64_t cycle) {
+            evTrace->record({cycle, lineAddr, evCacheId, (uint16_t)srcId, kind, (uint8_t)oldState, (uint8_t)newState, (uint8_t)coupOp});
+        }
+
+    private:
+        //cc shadows the member with its concrete type, so calls to it are devirtualized
+        template <typename C> uint64_t accessImpl(C* cc, MemReq& req);
 };
 
+/* Calls method(cc, args...), a member template on the CC class, with cc cast to
+ * its concrete class. Returns its result.
+ */
+#define DISPATCH_CC(method, ...) \
+    switch (ccKind) { \
+        case CC_MESI: return method(static_cast<MESICC*>(cc), __VA_ARGS__); \
+        case CC_MESI_TERMINAL: return method(static_cast<MESITerminalCC*>(cc), __VA_ARGS__); \
+        case CC_MEUSI: return method(static_cast<MEUSICC*>(cc), __VA_ARGS__); \
+        case CC_MEUSI_TERMINAL: return method(static_cast<MEUSITerminalCC*>(cc), __VA_ARGS__); \
+        default: return method(cc, __VA_ARGS__); \
+    }
+
 #endif  // CACHE_H_
@@ -210,9 +210,10 @@ void MESITopCC::init(const g_vector<BaseCache*>& _children, Network* network, co
         children[c] = _children[c];
         childrenRTTs[c] = (network)? network->getRTT(name, children[c]->getName()) : 0;
     }
+    sharers->init(children.size(), name);
 }
 
-uint64_t MESITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId) {
+uint64_t MESITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId, uint32_t skipChild) {
     //Send down downgrades/invalidates
     Entry* e = &array[lineId];
 
@@ -223,20 +224,23 @@ uint64_t MESITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType t
 
     uint64_t maxCycle = cycle; //keep maximum cycle only, we assume all invals are sent in parallel
     if (!e->isEmpty()) {
-        uint32_t numChildren = children.size();
         uint32_t sentInvs = 0;
-        for (uint32_t c = 0; c < numChildren; c++) {
-            if (e->sharers[c]) {
-                InvReq req = {lineAddr, type, reqWriteback, cycle, srcId};
-                uint64_t respCycle = children[c]->invalidate(req);
-                respCycle += childrenRTTs[c];
-                maxCycle = MAX(respCycle, maxCycle);
-                if (type == INV) e->sharers[c] = false;
-                sentInvs++;
-            }
-        }
-        assert(sentInvs == e->numSharers);
+        uint32_t heldInvs = 0;
+        bool precise = sharers->isPrecise();
+        sharers->forEach(lineId, [&](uint32_t c) {
+            if (c == skipChild) return;
+            bool held = true;
+            InvReq req = {lineAddr, type, reqWriteback, cycle, srcId, COUP_NONE, precise? nullptr : &held, nullptr};
+            uint64_t respCycle = children[c]->invalidate(req);
+            respCycle += childrenRTTs[c];
+            maxCycle = MAX(respCycle, maxCycle);
+            if (held) heldInvs++;
+            sentInvs++;
+        });
+        assert_msg(heldInvs == e->numSharers, "Line 0x%lx: sent %d invalidates (%d held) to %d sharers", lineAddr, sentInvs, heldInvs, e->numSharers);
+        sharers->recordSpuriousInvs(sentInvs - heldInvs);
         if (type == INV) {
+            sharers->clear(lineId);
             e->numSharers = 0;
         } else {
             //TODO: This is kludgy -- once the sharers format is more sophisticated, handle downgrades with a different codepath
@@ -253,6 +257,7 @@ uint64_t MESITopCC::processEviction(Address wbLineAddr, uint32_t lineId, bool* r
     if (nonInclusiveHack) {
         // Don't invalidate anything, just clear our entry
         array[lineId].clear();
+        sharers->clear(lineId);
         return cycle;
     } else {
         //Send down invalidates
@@ -268,16 +273,14 @@ uint64_t MESITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessType
         case PUTX:
             assert(e->isExclusive());
             if (flags & MemReq::PUTX_KEEPEXCL) {
-                assert(e->sharers[childId]);
                 assert(*childState == M);
                 *childState = E; //they don't hold dirty data anymore
                 break; //don't remove from sharer set. It'll keep exclusive perms.
             }
             //note NO break in general
         case PUTS:
-            assert(e->sharers[childId]);
-            e->sharers[childId] = false;
-            e->numSharers--;
+            assert(*childState != I);
+            removeSharer(e, lineId, childId);
             *childState = I;
             break;
         case GETU:
@@ -285,22 +288,20 @@ uint64_t MESITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessType
             if (e->isEmpty() && haveExclusive && !(flags & MemReq::NOEXCL)) {
                 //Give in E state
                 e->exclusive = true;
-                e->sharers[childId] = true;
-                e->numSharers = 1;
+                addSharer(e, lineId, childId);
                 *childState = E;
             } else {
                 //Give in S state
-                assert(e->sharers[childId] == false);
+                assert(*childState == I);
 
                 if (e->isExclusive()) {
                     //Downgrade the exclusive sharer
-                    respCycle = sendInvalidates(lineAddr, lineId, INVX, inducedWriteback, cycle, srcId);
+                    respCycle = sendInvalidates(lineAddr, lineId, INVX, inducedWriteback, cycle, srcId, childId);
                 }
 
                 assert_msg(!e->isExclusive(), "Can't have exclusivity here. isExcl=%d excl=%d numSharers=%d", e->isExclusive(), e->exclusive, e->numSharers);
 
-                e->sharers[childId] = true;
-                e->numSharers++;
+                addSharer(e, lineId, childId);
                 e->exclusive = false; //dsm: Must set, we're explicitly non-exclusive
                 *childState = S;
             }
@@ -309,18 +310,16 @@ uint64_t MESITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessType
             assert(haveExclusive); //the current cache better have exclusive access to this line
 
             // If child is in sharers list (this is an upgrade miss), take it out
-            if (e->sharers[childId]) {
+            if (*childState != I) {
                 assert_msg(!e->isExclusive(), "Spurious GETX, childId=%d numSharers=%d isExcl=%d excl=%d", childId, e->numSharers, e->isExclusive(), e->exclusive);
-                e->sharers[childId] = false;
-                e->numSharers--;
+                removeSharer(e, lineId, childId);
             }
 
             // Invalidate all other copies
-            respCycle = sendInvalidates(lineAddr, lineId, INV, inducedWriteback, cycle, srcId);
+            respCycle = sendInvalidates(lineAddr, lineId, INV, inducedWriteback, cycle, srcId, childId);
 
             // Set current sharer, mark exclusive
-            e->sharers[childId] = true;
-            e->numSharers++;
+            addSharer(e, lineId, childId);
             e->exclusive = true;
 
             assert(e->numSharers == 1);
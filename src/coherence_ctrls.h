@@ -27,13 +27,13 @@
 #ifndef COHERENCE_CTRLS_H_
 #define COHERENCE_CTRLS_H_
 
-#include <bitset>
 #include "constants.h"
 #include "g_std/g_string.h"
 #include "g_std/g_vector.h"
 #include "locks.h"
 #include "memory_hierarchy.h"
 #include "pad.h"
+#include "sharer_array.h"
 #include "stats.h"
 
 //TODO: Now that we have a pure CC interface, the MESI controllers should go on different files.
@@ -56,10 +56,13 @@ class CC : public GlobAlloc {
         //Inv methods
         virtual void startInv() = 0;
         virtual uint64_t processInv(const InvReq& req, int32_t lineId, uint64_t startCycle) = 0;
+        virtual void skipInv() = 0; //releases the lock taken by startInv() when the line is not present
 
         //Repl policy interface
         virtual uint32_t numSharers(uint32_t lineId) = 0;
         virtual bool isValid(uint32_t lineId) = 0;
+        virtual MESIState getState(uint32_t lineId) = 0;
+        virtual bool hasUSharers(uint32_t lineId) = 0; //evicting the line reduces its children's partial updates
 };
 
 
@@ -168,6 +171,10 @@ class MESIBottomCC : public GlobAlloc {
             return array[lineId] != I;
         }
 
+        inline MESIState getState(uint32_t lineId) {
+            return array[lineId];
+        }
+
         //Could extend with isExclusive, isDirty, etc, but not needed for now.
 
     private:
@@ -179,14 +186,12 @@ class MESIBottomCC : public GlobAlloc {
 class MESITopCC : public GlobAlloc {
     private:
         struct Entry {
-            uint32_t numSharers;
-            std::bitset<MAX_CACHE_CHILDREN> sharers;
+            uint32_t numSharers; //exact, even if the sharer set is imprecise
             bool exclusive;
 
             void clear() {
                 exclusive = false;
                 numSharers = 0;
-                sharers.reset();
             }
 
             bool isEmpty() {
@@ -199,6 +204,7 @@ class MESITopCC : public GlobAlloc {
         };
 
         Entry* array;
+        SharerArray* sharers;
         g_vector<BaseCache*> children;
         g_vector<uint32_t> childrenRTTs;
         uint32_t numLines;
@@ -210,7 +216,7 @@ class MESITopCC : public GlobAlloc {
         PAD();
 
     public:
-        MESITopCC(uint32_t _numLines, bool _nonInclusiveHack) : numLines(_numLines), nonInclusiveHack(_nonInclusiveHack) {
+        MESITopCC(uint32_t _numLines, bool _nonInclusiveHack, SharerArray* _sharers) : sharers(_sharers), numLines(_numLines), nonInclusiveHack(_nonInclusiveHack) {
             array = gm_calloc<Entry>(numLines);
             for (uint32_t i = 0; i < numLines; i++) {
                 array[i].clear();
@@ -221,6 +227,10 @@ class MESITopCC : public GlobAlloc {
 
         void init(const g_vector<BaseCache*>& _children, Network* network, const char* name);
 
+        void initStats(AggregateStat* parentStat) {
+            sharers->initStats(parentStat);
+        }
+
         uint64_t processEviction(Address wbLineAddr, uint32_t lineId, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
 
         uint64_t processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint32_t childId, bool haveExclusive,
@@ -242,7 +252,19 @@ class MESITopCC : public GlobAlloc {
         }
 
     private:
-        uint64_t sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
+        // skipChild: requester, which imprecise sharer sets may still list after it is removed
+        uint64_t sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId,
+                uint32_t skipChild = (uint32_t)-1);
+
+        inline void removeSharer(Entry* e, uint32_t lineId, uint32_t childId) {
+            sharers->remove(lineId, childId);
+            if (--e->numSharers == 0) sharers->clear(lineId);
+        }
+
+        inline void addSharer(Entry* e, uint32_t lineId, uint32_t childId) {
+            sharers->add(lineId, childId);
+            e->numSharers++;
+        }
 };
 
 static inline bool CheckForMESIRace(AccessType& type, MESIState* state, MESIState initialState) {
@@ -268,15 +290,19 @@ static inline bool CheckForMESIRace(AccessType& type, MESIState* state, MESIStat
             assert(*state == I || *state == U);
             //Do nothing. This is still a valid GETX, only it is not an upgrade miss anymore
         } else if (type == GETU) {
-                info("type = %d, state = %d, initialState = %d\n", type, *state, initialState);
-                //panic("I don't know");
+            //Our copy was invalidated or updated meanwhile. Do nothing, this is still a valid GETU
+        } else if (type == RATOM) {
+            //Our copy was invalidated; it was going to be dropped anyway, so this is still a valid remote atomic
+            assert(*state == I);
         } else { //no GETSs can race with INVs, if we are doing a GETS it's because the line was invalid to begin with!
             if (initialState == U) {
+                //A U line that was reduced (INV) while we tried to read it; still a valid GETS
                 assert(*state == I);
-                info("Caught this");
+            } else if (initialState == S) {
+                //Re-read of a partially readable line (sys.coupWordMasks) that was invalidated or downgraded to U meanwhile; still a valid GETS
+                assert(*state == I || *state == U);
             } else {
-                info("type = %d, state = %d, initialState = %d\n", type, *state, initialState);
-                panic("Invalid true race happened (?)");
+                panic("Invalid true race happened (?) type = %d, state = %d, initialState = %d", type, *state, initialState);
             }
         }
     }
@@ -284,18 +310,19 @@ static inline bool CheckForMESIRace(AccessType& type, MESIState* state, MESIStat
 }
 
 // Non-terminal CC; accepts GETS/X and PUTS/X accesses
-class MESICC : public CC {
+class MESICC final : public CC {
     private:
         MESITopCC* tcc;
         MESIBottomCC* bcc;
+        SharerArray* sharers;
         uint32_t numLines;
         bool nonInclusiveHack;
         g_string name;
 
     public:
         //Initialization
-        MESICC(uint32_t _numLines, bool _nonInclusiveHack, g_string& _name) : tcc(nullptr), bcc(nullptr),
-            numLines(_numLines), nonInclusiveHack(_nonInclusiveHack), name(_name) {}
+        MESICC(uint32_t _numLines, bool _nonInclusiveHack, SharerArray* _sharers, g_string& _name) : tcc(nullptr), bcc(nullptr),
+            sharers(_sharers), numLines(_numLines), nonInclusiveHack(_nonInclusiveHack), name(_name) {}
 
         void setParents(uint32_t childId, const g_vector<MemObject*>& parents, Network* network) {
             bcc = new MESIBottomCC(numLines, childId, nonInclusiveHack);
@@ -303,13 +330,13 @@ class MESICC : public CC {
         }
 
         void setChildren(const g_vector<BaseCache*>& children, Network* network) {
-            tcc = new MESITopCC(numLines, nonInclusiveHack);
+            tcc = new MESITopCC(numLines, nonInclusiveHack, sharers);
             tcc->init(children, network, name.c_str());
         }
 
         void initStats(AggregateStat* cacheStat) {
-            //no tcc stats
             bcc->initStats(cacheStat);
+            tcc->initStats(cacheStat);
         }
 
         //Access methods
@@ -413,13 +440,19 @@ class MESICC : public CC {
             return respCycle;
         }
 
+        void skipInv() {
+            bcc->unlock();
+        }
+
         //Repl policy interface
         uint32_t numSharers(uint32_t lineId) {return tcc->numSharers(lineId);}
         bool isValid(uint32_t lineId) {return bcc->isValid(lineId);}
+        MESIState getState(uint32_t lineId) {return bcc->getState(lineId);}
+        bool hasUSharers(uint32_t lineId) {return false;}
 };
 
 // Terminal CC, i.e., without children --- accepts GETS/X, but not PUTS/X
-class MESITerminalCC : public CC {
+class MESITerminalCC final : public CC {
     private:
         MESIBottomCC* bcc;
         uint32_t numLines;
@@ -502,9 +535,15 @@ class MESITerminalCC : public CC {
             return startCycle; //no extra delay in terminal caches
         }
 
+        void skipInv() {
+            bcc->unlock();
+        }
+
         //Repl policy interface
         uint32_t numSharers(uint32_t lineId) {return 0;} //no sharers
         bool isValid(uint32_t lineId) {return bcc->isValid(lineId);}
+        MESIState getState(uint32_t lineId) {return bcc->getState(lineId);}
+        bool hasUSharers(uint32_t lineId) {return false;}
 };
 
 #endif  // COHERENCE_CTRLS_H_
@@ -0,0 +1,70 @@
+#include "coherence_events.h"
+#include <stdio.h>
+#include <string.h>
+
+CoherenceEventTrace::CoherenceEventTrace(const g_string& _fname, uint32_t _numBufs, uint32_t entries)
+    : numBufs(_numBufs), max(entries), fname(_fname), started(false)
+{
+    if (!max) panic("sim.eventTrace.entries must be > 0");
+    bufs = gm_memalign<Buffer>(CACHE_LINE_BYTES, numBufs);
+    for (uint32_t i = 0; i < numBufs; i++) {
+        bufs[i].events = gm_calloc<CohEvent>(max);
+        bufs[i].cur = 0;
+    }
+    futex_init(&fileLock);
+    info("Coherence event trace enabled, %d records per core, file %s", max, fname.c_str());
+}
+
+uint16_t CoherenceEventTrace::registerCache(const char* name) {
+    if (started) panic("Cache %s registered with the coherence event trace after it started", name);
+    if (cacheNames.size() == UINT16_MAX) panic("Too many caches in the coherence event trace");
+    cacheNames.push_back(g_string(name));
+    return cacheNames.size() - 1;
+}
+
+void CoherenceEventTrace::flush(uint32_t buf) {
+    Buffer& b = bufs[buf];
+    if (!b.cur && started) return; //the first flush creates the file, even if empty
+
+    //Files are reopened on every flush, as any process may fill up a buffer
+    futex_lock(&fileLock);
+    FILE* f = fopen(fname.c_str(), started? "a" : "w");
+    if (!f) panic("Could not open coherence event trace %s", fname.c_str());
+    if (!started) {
+        uint32_t numCaches = cacheNames.size();
+        fwrite(COH_EV_MAGIC, sizeof(COH_EV_MAGIC), 1, f);
+        fwrite(&numCaches, sizeof(numCaches), 1, f);
+        for (const g_string& n : cacheNames) {
+            uint16_t len = n.size();
+            fwrite(&len, sizeof(len), 1, f);
+            fwrite(n.c_str(), len, 1, f);
+        }
+        started = true;
+    }
+    if (fwrite(b.events, sizeof(CohEvent), b.cur, f) != b.cur) panic("Could not write coherence event trace %s", fname.c_str());
+    fclose(f);
+    futex_unlock(&fileLock);
+    b.cur = 0;
+}
+
+void CoherenceTransitionStats::initStats(AggregateStat* parentStat) {
+    const char* colNames[COH_EV_NUM_COLS];
+    for (uint32_t k = 0; k < COH_EV_NUM_COLS; k++) {
+        uint8_t kind = (k <= RFLUSH)? k : (k < COH_EV_NUM_COLS - 1)? COH_EV_INV + (k - RFLUSH - 1) : COH_EV_EVICTION;
+        colNames[k] = CohEventKindName(kind);
+    }
+
+    AggregateStat* countStat = new AggregateStat();
+    countStat->init("trans", "Events by initial state (rows) and kind (columns)");
+    AggregateStat* latStat = new AggregateStat();
+    latStat->init("transLat", "Total latency of events by initial state (rows) and kind (columns)");
+    for (uint32_t st = 0; st <= U; st++) {
+        const char* stName = MESIStateName((MESIState)st);
+        counts[st].init(stName, "Events from this state", COH_EV_NUM_COLS, colNames);
+        lats[st].init(stName, "Latency of events from this state", COH_EV_NUM_COLS, colNames);
+        countStat->append(&counts[st]);
+        latStat->append(&lats[st]);
+    }
+    parentStat->append(countStat);
+    parentStat->append(latStat);
+}
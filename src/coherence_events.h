@@ -0,0 +1,122 @@
+#ifndef COHERENCE_EVENTS_H_
+#define COHERENCE_EVENTS_H_
+
+#include <stdint.h>
+#include "g_std/g_string.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "locks.h"
+#include "log.h"
+#include "memory_hierarchy.h"
+#include "pad.h"
+#include "stats.h"
+
+/* Binary trace of coherence events, to follow protocol activity without
+ * info() calls on hot paths. Caches with sys.caches.<grp>.traceEvents = true
+ * record every access, eviction and invalidation they process: the line, the
+ * request, the requester, and the line's state before and after it.
+ *
+ * Each requester (srcId, which must be a core, so traces need execution-
+ * driven simulation) has its own buffer of sim.eventTrace.entries records
+ * (default 64K). A core is simulated by a single thread at a time, so
+ * recording takes no locks; when a buffer fills up, it is appended to the
+ * trace file (sim.eventTrace.file, default <outputDir>/zsim-ev.bin) under a
+ * lock, and the remaining records are flushed at the end of the simulation.
+ * Records are in order for each requester, but files interleave requesters in
+ * chunks; dumpevents decodes them, and can sort them by cycle.
+ *
+ * File format: COH_EV_MAGIC, the number of caches (uint32_t), each cache name
+ * (uint16_t length and chars, indexed by CohEvent::cache), then CohEvents.
+ */
+
+// CohEvent kinds: accesses use their AccessType; invalidations and evictions use these
+static const uint8_t COH_EV_INV = 0x10; //+ InvType
+static const uint8_t COH_EV_EVICTION = 0x20;
+
+static const char COH_EV_MAGIC[8] = {'Z', 'C', 'O', 'H', 'E', 'V', '0', '1'};
+
+struct CohEvent {
+    uint64_t cycle; //cycle the request arrived at the cache
+    uint64_t lineAddr;
+    uint16_t cache;
+    uint16_t srcId;
+    uint8_t kind;
+    uint8_t oldState; //MESIState
+    uint8_t newState;
+    uint8_t coupOp;
+};  // 24 bytes --> no packing needed
+
+inline const char* CohEventKindName(uint8_t kind) {
+    if (kind == COH_EV_EVICTION) return "EVICT";
+    if (kind >= COH_EV_INV) return InvTypeName((InvType)(kind - COH_EV_INV));
+    return AccessTypeName((AccessType)kind);
+}
+
+/* Transition matrix stats (sys.caches.<grp>.transitionStats): for each
+ * initial line state, how many events of each kind (access types, then
+ * invalidation types, then evictions) the cache processed, and their total
+ * latency. Stats are trans.<state>[kind] and transLat.<state>[kind], so the
+ * HDF5 output has one row per state; next states are in the event trace.
+ */
+static const uint32_t COH_EV_NUM_COLS = (RFLUSH + 1) + (UPD + 1) + 1;
+
+class CoherenceTransitionStats : public GlobAlloc {
+    private:
+        VectorCounter counts[U + 1];
+        VectorCounter lats[U + 1];
+
+        static inline uint32_t col(uint8_t kind) {
+            if (kind == COH_EV_EVICTION) return COH_EV_NUM_COLS - 1;
+            if (kind >= COH_EV_INV) return (RFLUSH + 1) + (kind - COH_EV_INV);
+            return kind;
+        }
+
+    public:
+        void initStats(AggregateStat* parentStat);
+
+        inline void inc(MESIState state, uint8_t kind, uint64_t lat) {
+            uint32_t c = col(kind);
+            counts[state].inc(c);
+            lats[state].inc(c, lat);
+        }
+};
+
+class CoherenceEventTrace : public GlobAlloc {
+    private:
+        struct Buffer {
+            CohEvent* events;
+            uint32_t cur;
+            PAD_SZ(sizeof(CohEvent*) + sizeof(uint32_t)); //each requester writes its own
+        };
+
+        Buffer* bufs;
+        const uint32_t numBufs;
+        const uint32_t max;
+        g_string fname;
+        g_vector<g_string> cacheNames;
+        bool started; //file created, with its header
+
+        lock_t fileLock;
+
+    public:
+        CoherenceEventTrace(const g_string& _fname, uint32_t _numBufs, uint32_t entries);
+
+        // Init-time: get the id of a cache that records events
+        uint16_t registerCache(const char* name);
+
+        inline void record(const CohEvent& ev) {
+            if (unlikely(ev.srcId >= numBufs)) panic("Coherence event from requester %d, only cores (0-%d) have buffers", ev.srcId, numBufs - 1);
+            Buffer& b = bufs[ev.srcId];
+            b.events[b.cur++] = ev;
+            if (unlikely(b.cur == max)) flush(ev.srcId);
+        }
+
+        // Appends the records of a requester's buffer to the file
+        void flush(uint32_t buf);
+
+        void flushAll() {
+            for (uint32_t i = 0; i < numBufs; i++) flush(i);
+        }
+};
+
+#endif  // COHERENCE_EVENTS_H_
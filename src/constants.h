@@ -31,9 +31,9 @@
 // PIN 2.9 (rev39599) can't do more than 2048 threads...
 #define MAX_THREADS (2048)
 
-// How many children caches can each cache track? Note each bank is a separate child. This impacts sharer bit-vector sizes.
-#define MAX_CACHE_CHILDREN (256)
-//#define MAX_CACHE_CHILDREN (1024)
+// How many children caches can each cache track? Note each bank is a separate child. Sharer sets are sized by the
+// actual number of children (see sharer_array.h), so this only bounds the per-line sharer counts (16 bits in MEUSI).
+#define MAX_CACHE_CHILDREN (4096)
 
 // Complex multiprocess runs need multiple clocks, and multiple port domains
 #define MAX_CLOCK_DOMAINS (64)
@@ -29,6 +29,7 @@
 #include <stdint.h>
 #include "decoder.h"
 #include "g_std/g_string.h"
+#include "memory_hierarchy.h"
 #include "stats.h"
 
 struct BblInfo {
@@ -48,8 +49,9 @@ struct InstrFuncPtrs {  // NOLINT(whitespace)
     // Same as load/store functions, but last arg indicated whether op is executing
     void (*predLoadPtr)(THREADID, ADDRINT, BOOL);
     void (*predStorePtr)(THREADID, ADDRINT, BOOL);
+    // Commutative update (COUP): only inserted on tagged lock-prefixed RMWs, last arg is the CoupOp (COUP_NONE = plain load)
+    void (*coupUpdatePtr)(THREADID, ADDRINT, UINT32);
     uint64_t type;
-    uint64_t pad[1];
     //NOTE: By having the struct be a power of 2 bytes, indirect calls are simpler (w/ gcc 4.4 -O3, 6->5 instructions, and those instructions are simpler)
 };
 
@@ -60,6 +62,33 @@ struct InstrFuncPtrs {  // NOLINT(whitespace)
 #define FPTR_NOP (2L)
 #define FPTR_RETRY (3L)
 
+/* Groups the active lanes of a vector update by line: calls f(vAddr, lanes, words) for each line they touch, in
+ * address order, with the address of its first active lane, the number of active lanes, and the mask of the 64-bit
+ * words they update. Lanes are naturally aligned (zsim.cpp checks), so none straddles lines or words.
+ */
+template <typename F>
+static inline void ForEachVectorUpdateLine(Address base, uint64_t laneMask, uint32_t width, uint32_t lineBits, F f) {
+    Address curLine = -1L;
+    Address firstAddr = 0;
+    uint32_t lanes = 0;
+    uint64_t words = 0;
+    while (laneMask) {
+        uint32_t lane = __builtin_ctzl(laneMask);
+        laneMask &= laneMask - 1;
+        Address addr = base + lane*width;
+        if ((addr >> lineBits) != curLine) {
+            if (lanes) f(firstAddr, lanes, words);
+            curLine = addr >> lineBits;
+            firstAddr = addr;
+            lanes = 0;
+            words = 0;
+        }
+        lanes++;
+        words |= 1UL << ((addr & ((1UL << lineBits) - 1)) >> 3);
+    }
+    if (lanes) f(firstAddr, lanes, words);
+}
+
 //Generic core class
 
 class Core : public GlobAlloc {
@@ -71,10 +100,9 @@ class Core : public GlobAlloc {
 
     protected:
         g_string name;
-        bool coup;
 
     public:
-        explicit Core(g_string& _name) : lastUpdateCycles(0), lastUpdateInstrs(0), name(_name) { coup = false; }
+        explicit Core(g_string& _name) : lastUpdateCycles(0), lastUpdateInstrs(0), name(_name) {}
 
         virtual uint64_t getInstrs() const = 0; // typically used to find out termination conditions or dumps
         virtual uint64_t getPhaseCycles() const = 0; // used by RDTSC faking --- we need to know how far along we are in the phase, but not the total number of phases
@@ -87,9 +115,15 @@ class Core : public GlobAlloc {
         virtual void leave() {}
         virtual void join() {}
 
-        virtual InstrFuncPtrs GetFuncPtrs() = 0;
+        //Reduction flush magic op (coup_flush): reduce the U lines of [addr, addr+bytes) ahead of the reads that would
+        //reduce them. Only called on simulated threads; cores without a memory hierarchy ignore it.
+        virtual void coupFlush(Address addr, uint64_t bytes) {}
 
-        void coup_op(bool state) { coup = state; }
+        //Vector update magic op (coup_vupdate): update the lanes of laneMask, lane i being the width-byte word at
+        //base + i*width, with op. Cores issue one update per line (see ForEachVectorUpdateLine). Only called on simulated threads.
+        virtual void coupVectorUpdate(Address base, uint64_t laneMask, uint32_t width, CoupOp op) {}
+
+        virtual InstrFuncPtrs GetFuncPtrs() = 0;
 };
 
 #endif  // CORE_H_
@@ -0,0 +1,39 @@
+#include "coup_auto.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "log.h"
+
+CoupAutoFilter::CoupAutoFilter(const char* pcList, const char* symbolList) {
+    for (std::string pcStr : ParseList<std::string>(pcList)) {
+        char* end;
+        ADDRINT pc = strtoull(pcStr.c_str(), &end, 0);
+        if (*end != '\0') panic("coupAutoPCs: %s is not a valid PC", pcStr.c_str());
+        pcs.push_back(pc);
+    }
+    std::sort(pcs.begin(), pcs.end());
+
+    for (std::string sym : ParseList<std::string>(symbolList)) symbols.push_back(g_string(sym.c_str()));
+
+    if (pcs.empty() && symbols.empty()) {
+        info("Automatic COUP mode: all lock-prefixed commutative RMWs with unused results are updates");
+    } else {
+        info("Automatic COUP mode: updates restricted to %ld PCs and %ld symbols", pcs.size(), symbols.size());
+    }
+}
+
+bool CoupAutoFilter::allows(INS ins) const {
+    if (pcs.empty() && symbols.empty()) return true;
+    if (std::binary_search(pcs.begin(), pcs.end(), INS_Address(ins))) return true;
+    if (symbols.empty()) return false;
+
+    std::string name = RTN_FindNameByAddress(INS_Address(ins));
+    if (name.empty()) return false;
+    std::string undecorated = PIN_UndecorateSymbolName(name, UNDECORATION_NAME_ONLY);
+    for (const g_string& sym : symbols) {
+        if (name == sym.c_str() || undecorated == sym.c_str()) return true;
+    }
+    return false;
+}
@@ -0,0 +1,37 @@
+#ifndef COUP_AUTO_H
+#define COUP_AUTO_H
+
+#include "g_std/g_string.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "pin.H"
+
+/* Automatic COUP mode (processN.coupAuto = true).
+ *
+ * Without it, only lock-prefixed adds tagged by the COUP magic op (see
+ * benchmark/coup_hooks.h) are updates. In automatic mode, the decoder also
+ * classifies lock-prefixed ADD/AND/OR/XOR/INC/DEC/XADD to memory as updates
+ * when their results are unused (see Decoder::autoCoupOp()), so unmodified
+ * binaries (e.g., OpenMP reductions, atomic counters) can use U.
+ *
+ * This filter restricts automatic mode to some instructions:
+ * - processN.coupAutoPCs: PCs of the lock-prefixed instructions (e.g.,
+ *   "0x401a2c 0x401b10"); the harness disables ASLR, so they are stable
+ * - processN.coupAutoSymbols: routines whose updates are allowed, by mangled
+ *   or undecorated name (e.g., "hist_update ns::Counter::inc")
+ * An instruction is allowed if it matches either list; if both are empty,
+ * all qualifying instructions are updates.
+ */
+class CoupAutoFilter : public GlobAlloc {
+    private:
+        g_vector<ADDRINT> pcs; //sorted
+        g_vector<g_string> symbols;
+
+    public:
+        CoupAutoFilter(const char* pcList, const char* symbolList);
+
+        // Instrumentation-time only (uses Pin's symbol tables)
+        bool allows(INS ins) const;
+};
+
+#endif  // COUP_AUTO_H
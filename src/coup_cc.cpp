@@ -1,7 +1,10 @@
+#include <algorithm>
 #include "coherence_ctrls.h"
 #include "coup_cc.h"
 #include "cache.h"
+#include "coup_shadow.h"
 #include "network.h"
+#include "zsim.h"
 
 uint32_t MEUSIBottomCC::getParentId(Address lineAddr) {
     //Hash things a bit
@@ -21,6 +24,12 @@ void MEUSIBottomCC::init(const g_vector<MemObject*>& _parents, Network* network,
         parents[p] = _parents[p];
         parentRTTs[p] = (network)? network->getRTT(name, parents[p]->getName()) : 0;
     }
+
+    if (zinfo->coupShadow) {
+        shadowNode = zinfo->coupShadow->getNodeId(name);
+        shadowParentNodes.resize(parents.size());
+        for (uint32_t p = 0; p < parents.size(); p++) shadowParentNodes[p] = zinfo->coupShadow->getNodeId(parents[p]->getName());
+    }
 }
 
 uint64_t MEUSIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback, uint64_t cycle, uint32_t srcId) {
@@ -52,8 +61,11 @@ uint64_t MEUSIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, boo
         // add U state
         case U:
             {
-                MemReq req = {wbLineAddr, PUTU, selfId, state, cycle, &ccLock, *state, srcId, 0 /*no flags*/};
-                respCycle = parents[getParentId(wbLineAddr)]->access(req);
+                uint32_t parentId = getParentId(wbLineAddr);
+                if (zinfo->coupShadow) zinfo->coupShadow->close(shadowNode, shadowParentNodes[parentId], wbLineAddr);
+                MemReq req = {wbLineAddr, PUTU, selfId, state, cycle, &ccLock, *state, srcId, 0 /*no flags*/, opArray[lineId]};
+                respCycle = parents[parentId]->access(req);
+                opArray[lineId] = COUP_NONE;
             }
             break;
 
@@ -63,9 +75,11 @@ uint64_t MEUSIBottomCC::processEviction(Address wbLineAddr, uint32_t lineId, boo
     return respCycle;
 }
 
-uint64_t MEUSIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint64_t cycle, uint32_t srcId, uint32_t flags) {
+uint64_t MEUSIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint64_t cycle, uint32_t srcId, uint32_t flags, CoupOp coupOp,
+        uint64_t* wordMask) {
     uint64_t respCycle = cycle;
     MESIState* state = &array[lineId];
+    uint64_t reqWords = (maskArray && wordMask)? *wordMask : ALL_WORDS;
     switch (type) {
         // A PUTS/PUTX does nothing w.r.t. higher coherence levels --- it dies here
         case PUTS: //Clean writeback, nothing to do (except profiling)
@@ -81,29 +95,63 @@ uint64_t MEUSIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessT
             profPUTX.inc();
             break;
         case PUTU:
-            assert(*state == U);
+            //We hold the line in U, or exclusive as the root of the U tree (then, the merged update dirties it)
+            assert(*state == U || *state == E || *state == M);
+            if (*state == E) *state = M;
             profPUTU.inc();
+            profPUTUOps.inc(coupOp);
+            //Like other writebacks, merging it is off the critical path, but it keeps the reduction unit busy
+            if (redUnit) redUnit->merge(cycle, coupOp);
             break;
         case GETU:
-            if (*state != U) {
+            // Exclusive lines absorb updates like writes
+            if (*state == E || *state == M) {
+                *state = M;
+                profGETUHit.inc();
+                profGETUHitOps.inc(coupOp);
+            // A U line only absorbs updates of its own operator (and, with word masks, to the words it was granted);
+            // otherwise, we must go up so it gets reduced or granted more words
+            } else if (*state != U || opArray[lineId] != coupOp || (maskArray && (reqWords & ~maskArray[lineId]))) {
                 uint32_t parentId = getParentId(lineAddr);
-                MemReq req = {lineAddr, GETU, selfId, state, cycle, &ccLock, *state, srcId, flags};
+                bool extend = (*state == U) && (opArray[lineId] == coupOp);
+                if (*state == U && !extend) {
+                    profGETUOpSwitch.inc();
+                    if (zinfo->coupShadow) zinfo->coupShadow->close(shadowNode, shadowParentNodes[parentId], lineAddr);
+                }
+                if (extend) profGETUWordMiss.inc();
+                //Ask for all the words we will update with this partial
+                uint64_t words = extend? (maskArray[lineId] | reqWords) : reqWords;
+                MemReq req = {lineAddr, GETU, selfId, state, cycle, &ccLock, *state, srcId, flags, coupOp, maskArray? &words : nullptr};
                 uint32_t nextLevelLat = parents[parentId]->access(req) - cycle;
                 uint32_t netLat = parentRTTs[parentId];
                 profGETNextLevelLat.inc(nextLevelLat);
                 profGETNetLat.inc(netLat);
                 respCycle += nextLevelLat + netLat;
                 profGETUMiss.inc();
-                assert(*state == U);
+                profGETUMissOps.inc(coupOp);
+                if (*state == U) {
+                    opArray[lineId] = coupOp;
+                    if (maskArray) maskArray[lineId] = words;
+                    if (zinfo->coupShadow) zinfo->coupShadow->open(shadowNode, lineAddr, coupOp);
+                } else {
+                    //Served exclusive: our parent predicted U would bounce (M), or memory gave it to us as the root of the U tree (E)
+                    assert(*state == M || *state == E);
+                    if (*state == M) profGETUFallback.inc();
+                    opArray[lineId] = COUP_NONE;
+                    if (maskArray) maskArray[lineId] = ALL_WORDS;
+                }
             } else {
                 profGETUHit.inc();
+                profGETUHitOps.inc(coupOp);
             }
             break;
         case GETS:
-            if(*state == U) info("GETS reducing 0x%lx", lineAddr);
-            if (*state == I || *state == U) {
+            if (*state == I || *state == U || (reqWords & ~getReadableWords(lineId))) {
                 uint32_t parentId = getParentId(lineAddr);
-                MemReq req = {lineAddr, GETS, selfId, state, cycle, &ccLock, *state, srcId, flags};
+                if (*state == U && zinfo->coupShadow) zinfo->coupShadow->close(shadowNode, shadowParentNodes[parentId], lineAddr);
+                if (*state == S) profGETSWordMiss.inc();
+                uint64_t words = reqWords; //parent replies with the words we can read
+                MemReq req = {lineAddr, GETS, selfId, state, cycle, &ccLock, *state, srcId, flags, COUP_NONE, maskArray? &words : nullptr};
                 uint32_t nextLevelLat = parents[parentId]->access(req) - cycle;
                 uint32_t netLat = parentRTTs[parentId];
                 profGETNextLevelLat.inc(nextLevelLat);
@@ -111,23 +159,35 @@ uint64_t MEUSIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessT
                 respCycle += nextLevelLat + netLat;
                 profGETSMiss.inc();
                 assert(*state == S || *state == E);
+                opArray[lineId] = COUP_NONE;
+                if (maskArray) maskArray[lineId] = (*state == S)? words : ALL_WORDS;
+                //Partially readable lines may still have partial updates elsewhere, on the words we can't read
+                if (shadowCheckReads && zinfo->coupShadow && getReadableWords(lineId) == ALL_WORDS) zinfo->coupShadow->checkReduced(shadowNode, lineAddr);
             } else {
                 profGETSHit.inc();
             }
+            if (maskArray && wordMask) *wordMask = getReadableWords(lineId);
             break;
+        case RATOM:
+            //Only reaches the bcc at the home bank, which needs the line exclusive to perform the update, like a write
+            profRATOM.inc();
+            //note NO break
         case GETX:
-            if(*state == U) info("GETX reducing 0x%lx", lineAddr);
             if (*state == I || *state == S || *state == U) {
                 //Profile before access, state changes
                 if (*state == I) profGETXMissIM.inc();
                 else profGETXMissSM.inc();
                 uint32_t parentId = getParentId(lineAddr);
+                if (*state == U && zinfo->coupShadow) zinfo->coupShadow->close(shadowNode, shadowParentNodes[parentId], lineAddr);
                 MemReq req = {lineAddr, GETX, selfId, state, cycle, &ccLock, *state, srcId, flags};
                 uint32_t nextLevelLat = parents[parentId]->access(req) - cycle;
                 uint32_t netLat = parentRTTs[parentId];
                 profGETNextLevelLat.inc(nextLevelLat);
                 profGETNetLat.inc(netLat);
                 respCycle += nextLevelLat + netLat;
+                opArray[lineId] = COUP_NONE;
+                if (maskArray) maskArray[lineId] = ALL_WORDS;
+                if (shadowCheckReads && zinfo->coupShadow) zinfo->coupShadow->checkReduced(shadowNode, lineAddr);
             } else {
                 if (*state == E) {
                     // Silent transition
@@ -150,6 +210,33 @@ uint64_t MEUSIBottomCC::processAccess(Address lineAddr, uint32_t lineId, AccessT
     return respCycle;
 }
 
+uint64_t MEUSIBottomCC::forwardRemoteAtomic(Address lineAddr, int32_t lineId, uint64_t cycle, uint32_t srcId, uint32_t flags, CoupOp coupOp, uint32_t updateWords) {
+    //The home bank performs the update on its copy, so it takes ours away (dirty data travels with the request)
+    MESIState dummyState = I;
+    MESIState* state = (lineId == -1)? &dummyState : &array[lineId];
+    assert(*state != U); //no GETUs with remote atomics
+    uint32_t parentId = getParentId(lineAddr);
+    MemReq req = {lineAddr, RATOM, selfId, state, cycle, &ccLock, *state, srcId, flags, coupOp, nullptr, updateWords};
+    uint32_t nextLevelLat = parents[parentId]->access(req) - cycle;
+    uint32_t netLat = parentRTTs[parentId];
+    profGETNextLevelLat.inc(nextLevelLat);
+    profGETNetLat.inc(netLat);
+    profRATOMFwd.inc();
+    assert(*state == I);
+    return cycle + nextLevelLat + netLat;
+}
+
+uint64_t MEUSIBottomCC::forwardFlush(Address lineAddr, uint64_t cycle, uint32_t srcId, uint32_t flags) {
+    //Flushes carry no data and don't change our copy themselves, so the parent sees us as a bystander
+    MESIState dummyState = I;
+    uint32_t parentId = getParentId(lineAddr);
+    MemReq req = {lineAddr, RFLUSH, selfId, &dummyState, cycle, &ccLock, dummyState, srcId, flags};
+    uint32_t nextLevelLat = parents[parentId]->access(req) - cycle;
+    uint32_t netLat = parentRTTs[parentId];
+    profFLUSHFwd.inc();
+    return cycle + nextLevelLat + netLat;
+}
+
 void MEUSIBottomCC::processWritebackOnAccess(Address lineAddr, uint32_t lineId, AccessType type) {
     MESIState* state = &array[lineId];
     assert(*state == M || *state == E || *state == U);
@@ -159,7 +246,7 @@ void MEUSIBottomCC::processWritebackOnAccess(Address lineAddr, uint32_t lineId,
     }
 }
 
-void MEUSIBottomCC::processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback) {
+void MEUSIBottomCC::processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, CoupOp coupOp, bool* reqPartial) {
     MESIState* state = &array[lineId];
     assert(*state != I);
     switch (type) {
@@ -173,13 +260,22 @@ void MEUSIBottomCC::processInval(Address lineAddr, uint32_t lineId, InvType type
         case INV: //invalidate
             assert(*state != I);
             if (*state == M || *state == U) *reqWriteback = true;
+            if (reqPartial) *reqPartial = (*state == U); //S readers hold no updates
+            if (*state == U && zinfo->coupShadow) zinfo->coupShadow->close(shadowNode, shadowParentNodes[getParentId(lineAddr)], lineAddr);
             *state = I;
+            opArray[lineId] = COUP_NONE;
+            if (maskArray) maskArray[lineId] = ALL_WORDS;
             profINV.inc();
             break;
         case UPD:
             assert(*state != I);
+            assert(coupOp != COUP_NONE);
             if (*state == M) *reqWriteback = true;
             *state = U;
+            opArray[lineId] = coupOp;
+            //Conservatively, a downgraded sharer may update any word
+            if (maskArray) maskArray[lineId] = ALL_WORDS;
+            if (zinfo->coupShadow) zinfo->coupShadow->open(shadowNode, lineAddr, coupOp);
             break;
         case FWD: //forward
             assert_msg(*state == S, "Invalid state %s on FWD", MESIStateName(*state));
@@ -209,15 +305,17 @@ void MEUSITopCC::init(const g_vector<BaseCache*>& _children, Network* network, c
     }
     children.resize(_children.size());
     childrenRTTs.resize(_children.size());
+    gatherBuf.resize(_children.size());
     for (uint32_t c = 0; c < children.size(); c++) {
         children[c] = _children[c];
         childrenRTTs[c] = (network)? network->getRTT(name, children[c]->getName()) : 0;
     }
+    sharers->init(children.size(), name);
 }
 
-uint64_t MEUSITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId) {
+uint64_t MEUSITopCC::sendInvalidates(Address lineAddr, uint32_t dirId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId, uint32_t skipChild, bool skipPartial) {
     //Send down downgrades/invalidates
-    Entry* e = &array[lineId];
+    Entry* e = &array[dirId];
 
     //Don't propagate downgrades if sharers are not exclusive.
     if (type == INVX && !e->isExclusive()) {
@@ -226,21 +324,53 @@ uint64_t MEUSITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType
 
     uint64_t maxCycle = cycle; //keep maximum cycle only, we assume all invals are sent in parallel
     if (!e->isEmpty()) {
-        uint32_t numChildren = children.size();
         uint32_t sentInvs = 0;
-        for (uint32_t c = 0; c < numChildren; c++) {
-            if (e->sharers[c]) {
-                InvReq req = {lineAddr, type, reqWriteback, cycle, srcId};
-                uint64_t respCycle = children[c]->invalidate(req);
-                respCycle += childrenRTTs[c];
-                maxCycle = MAX(respCycle, maxCycle);
-                if (type == INV) e->sharers[c] = false;
-                sentInvs++;
+        uint32_t heldInvs = 0;
+        uint32_t numPartials = 0;
+        bool precise = sharers->isPrecise();
+        /* Invalidating U sharers is a reduction: each child sends back its partial update (already
+         * merged with its own children's, if it is an intermediate level), and our reduction unit
+         * folds them into the line as they arrive. So with a reduction tree, each level merges only
+         * its own children instead of the root merging every partial update in the system.
+         */
+        bool reduce = (type == INV) && e->coupState;
+        assert(reduce || !skipPartial);
+        ReductionUnit::Partial* partials = gatherBuf.data();
+        sharers->forEach(dirId, [&](uint32_t c) {
+            if (c == skipChild) return;
+            bool held = true;
+            bool partial = false;
+            InvReq req = {lineAddr, type, reqWriteback, cycle, srcId, (type == UPD || reduce)? e->coupOp : COUP_NONE, precise? nullptr : &held, reduce? &partial : nullptr};
+            uint64_t respCycle = children[c]->invalidate(req);
+            respCycle += childrenRTTs[c];
+            maxCycle = MAX(respCycle, maxCycle);
+            //Only children that held the line in U send back a partial update
+            if (held) {
+                if (partial) partials[numPartials++] = {respCycle, childrenRTTs[c]/2};
+                heldInvs++;
             }
+            sentInvs++;
+        });
+        assert_msg(heldInvs == e->numSharers, "Line 0x%lx: sent %d invalidates (%d held) to %d sharers", lineAddr, sentInvs, heldInvs, e->numSharers);
+        sharers->recordSpuriousInvs(sentInvs - heldInvs);
+
+        if (reduce) {
+            assert_msg(numPartials + e->numReaders == heldInvs, "Line 0x%lx: %d partials, %d readers, %d sharers", lineAddr, numPartials, e->numReaders, heldInvs);
+            if (skipPartial) partials[numPartials++] = requesterPartial(skipChild, cycle);
+            std::sort(partials, partials + numPartials);
+            uint64_t mergeCycle = redUnit->reduce(partials, numPartials, cycle, e->coupOp);
+            maxCycle = MAX(mergeCycle, maxCycle);
+            profReductions.inc();
+            profRedPartials.inc(numPartials);
+            profRedCycles.inc(maxCycle - cycle);
         }
-        assert(sentInvs == e->numSharers);
         if (type == INV) {
+            sharers->clear(dirId);
             e->numSharers = 0;
+            e->coupState = false; //all partial updates have been reduced
+            e->coupOp = COUP_NONE;
+            e->updMask = 0;
+            e->numReaders = 0;
         } else if(type == UPD) {
             e->exclusive = false;
         } else {
@@ -253,27 +383,67 @@ uint64_t MEUSITopCC::sendInvalidates(Address lineAddr, uint32_t lineId, InvType
     return maxCycle;
 }
 
+uint32_t MEUSITopCC::allocEntry(Address lineAddr, uint32_t lineId, uint64_t cycle, uint32_t srcId) {
+    uint32_t dirId = dir->preinsert(lineAddr, [this](uint32_t id) {return array[id].numSharers;});
+    if (dir->isValid(dirId)) {
+        /* Directory eviction: the victim line stays cached, but we can't track its sharers anymore, so they
+         * are invalidated (U sharers are reduced). Like cache evictions, this is off the critical path.
+         */
+        Entry* v = &array[dirId];
+        Address victimAddr = dir->getLineAddr(dirId);
+        dir->recordEviction(v->numSharers, v->coupState);
+        bool writeback = false;
+        sendInvalidates(victimAddr, dirId, INV, &writeback, cycle, srcId);
+        if (writeback) {
+            assert(bcc);
+            bcc->processWritebackOnAccess(victimAddr, dir->getLineId(dirId), PUTX);
+        }
+        dir->erase(dirId);
+    }
+    array[dirId].clear();
+    sharers->clear(dirId);
+    dir->postinsert(lineAddr, lineId, dirId);
+    return dirId;
+}
+
 uint64_t MEUSITopCC::processEviction(Address wbLineAddr, uint32_t lineId, bool* reqWriteback, uint64_t cycle, uint32_t srcId) {
+    int32_t dirId = dir? dir->lookup(lineId) : lineId;
+    if (dirId == -1) return cycle; //no sharers
+    uint64_t respCycle = cycle;
     if (nonInclusiveHack) {
         // Don't invalidate anything, just clear our entry
-        array[lineId].clear();
-        return cycle;
+        array[dirId].clear();
+        sharers->clear(dirId);
     } else {
         //Send down invalidates
-        return sendInvalidates(wbLineAddr, lineId, INV, reqWriteback, cycle, srcId);
+        respCycle = sendInvalidates(wbLineAddr, dirId, INV, reqWriteback, cycle, srcId);
     }
+    releaseEntry(dirId);
+    return respCycle;
 }
 
 
 uint64_t MEUSITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint32_t childId, bool haveExclusive,
-                                  MESIState* childState, bool* inducedWriteback, uint64_t cycle, uint32_t srcId, uint32_t flags) {
-    Entry* e = &array[lineId];
+                                  MESIState* childState, bool* inducedWriteback, uint64_t cycle, uint32_t srcId, uint32_t flags, CoupOp coupOp,
+                                  uint64_t reqWords, uint64_t* wordMask) {
+    uint32_t dirId = lineId;
+    if (dir) {
+        int32_t id = dir->lookup(lineId);
+        if (id == -1 && type == RATOM) return cycle; //no sharers to invalidate
+        if (id == -1) {
+            assert((type == GETS) || (type == GETX) || (type == GETU)); //PUTs come from sharers
+            id = allocEntry(lineAddr, lineId, cycle, srcId);
+        } else if ((type == GETS) || (type == GETX) || (type == GETU)) {
+            dir->touch(id);
+        }
+        dirId = id;
+    }
+    Entry* e = &array[dirId];
     uint64_t respCycle = cycle;
     switch (type) {
         case PUTX:
             assert(e->isExclusive());
             if (flags & MemReq::PUTX_KEEPEXCL) {
-                assert(e->sharers[childId]);
                 assert(*childState == M);
                 *childState = E; //they don't hold dirty data anymore
                 break; //don't remove from sharer set. It'll keep exclusive perms.
@@ -281,56 +451,107 @@ uint64_t MEUSITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessType
             //note NO break in general
         case PUTU:
         case PUTS:
-            assert(e->sharers[childId]);
-            e->sharers[childId] = false;
-            e->numSharers--;
+            assert(*childState != I);
+            if (type == PUTS && e->coupState) e->numReaders--;
+            removeSharer(e, dirId, childId);
             *childState = I;
             break;
         case GETU:
-            // if child is in the sharer list, then it is changing its state to update, don't inv it
-            if (e->sharers[childId]) {
-                e->sharers[childId] = false;
-                e->numSharers--;
-            }
+            {
+                assert(coupOp != COUP_NONE);
+                // if child is in the sharer list, then it is changing its state to update, don't inv it
+                // (if it held the line in U for another operator, its partial update travels with this request)
+                CoupOp prevOp = e->coupOp;
+                bool reqPartial = false;
+                if (*childState != I) {
+                    if (*childState == S && e->coupState) e->numReaders--;
+                    reqPartial = (*childState == U) && (prevOp != coupOp);
+                    removeSharer(e, dirId, childId);
+                }
 
-            if (!e->isEmpty() && !e->coupState) {
-                respCycle = sendInvalidates(lineAddr, lineId, UPD, inducedWriteback, cycle, srcId);
-            }
+                // U sharers of a different operator can't be merged with this one, reduce them (and the requester's partial) first
+                if (e->coupState && e->coupOp != coupOp) {
+                    respCycle = sendInvalidates(lineAddr, dirId, INV, inducedWriteback, cycle, srcId, childId, reqPartial);
+                } else if (reqPartial) {
+                    // The requester was the only U sharer, so its partial update is the whole reduction
+                    ReductionUnit::Partial p = requesterPartial(childId, cycle);
+                    respCycle = redUnit->reduce(&p, 1, cycle, prevOp);
+                    profReductions.inc();
+                    profRedPartials.inc();
+                    profRedCycles.inc(respCycle - cycle);
+                } else if (e->coupState && e->numReaders && (reqWords & ~e->updMask)) {
+                    // Partial readers may hold the newly updated words (we don't track which words each one reads)
+                    profRedReaders.inc();
+                    respCycle = sendInvalidates(lineAddr, dirId, INV, inducedWriteback, cycle, srcId, childId);
+                }
 
-            e->coupState = true;
-            e->sharers[childId] = true;
-            e->numSharers++;
-            e->exclusive = false;
-            *childState = U;
-            info("coup load\n");
+                e->coupOp = coupOp;
+                if (!e->isEmpty() && !e->coupState) {
+                    respCycle = sendInvalidates(lineAddr, dirId, UPD, inducedWriteback, cycle, srcId, childId);
+                }
+
+                //Sharers downgraded to U may update any word
+                e->updMask = e->coupState? (e->updMask | reqWords) : (e->isEmpty()? reqWords : ALL_WORDS);
+                e->coupState = true;
+                addSharer(e, dirId, childId);
+                e->exclusive = false;
+                *childState = U;
+            }
             break;
         case GETS:
             if (e->isEmpty() && haveExclusive && !(flags & MemReq::NOEXCL)) {
                 //Give in E state
                 e->exclusive = true;
-                e->sharers[childId] = true;
-                e->numSharers = 1;
+                addSharer(e, dirId, childId);
                 *childState = E;
+            } else if (wordMask && e->coupState && haveExclusive && !(reqWords & e->updMask)) {
+                /* Partial read: we hold the line's only copy of the words the U sharers don't update, so the
+                 * child can read those without reducing the line. If the child was a U sharer, its partial
+                 * update travels with this request; if it was a partial reader, it is asking for more words.
+                 */
+                if (*childState != I) {
+                    if (*childState == S) e->numReaders--;
+                    removeSharer(e, dirId, childId);
+                }
+                addSharer(e, dirId, childId);
+                *childState = S;
+                if (e->coupState) {
+                    e->numReaders++;
+                    *wordMask = ~e->updMask;
+                    profRedAvoided.inc();
+                } else {
+                    //The child was the only U sharer, so its partial update was the last one; the line is fully reduced
+                    *wordMask = ALL_WORDS;
+                }
             } else {
-                // info("chld state = %d\n", *childState);
                 //Give in S state
-                assert(e->sharers[childId] == false || *childState == U);
+                // A U child is reduced along with the other U sharers (and does not hold the line otherwise)
+                // A S child is a partial reader that wants more words than it was given
+                assert(*childState == I || *childState == U || *childState == S);
+                if (*childState == S) {
+                    if (e->coupState) e->numReaders--;
+                    removeSharer(e, dirId, childId);
+                }
 
                 if (e->isExclusive()) {
                     //Downgrade the exclusive sharer
-                    respCycle = sendInvalidates(lineAddr, lineId, INVX, inducedWriteback, cycle, srcId);
+                    respCycle = sendInvalidates(lineAddr, dirId, INVX, inducedWriteback, cycle, srcId);
                 }
 
                 if (e->coupState) {
-                    respCycle = sendInvalidates(lineAddr, lineId, INV, inducedWriteback, cycle, srcId);
+                    uint32_t uSharers = e->numSharers - e->numReaders;
+                    respCycle = sendInvalidates(lineAddr, dirId, INV, inducedWriteback, cycle, srcId);
+                    if (uSharers) redReadStats.record(uSharers, respCycle - cycle);
                 }
 
                 assert_msg(!e->isExclusive(), "Can't have exclusivity here. isExcl=%d excl=%d numSharers=%d", e->isExclusive(), e->exclusive, e->numSharers);
                 
-                e->sharers[childId] = true;
-                e->numSharers++;
+                addSharer(e, dirId, childId);
                 e->exclusive = false; //dsm: Must set, we're explicitly non-exclusive
                 e->coupState = false;
+                e->coupOp = COUP_NONE;
+                e->updMask = 0;
+                e->numReaders = 0;
                 *childState = S;
             }
             break;
@@ -338,41 +559,90 @@ uint64_t MEUSITopCC::processAccess(Address lineAddr, uint32_t lineId, AccessType
             assert(haveExclusive); //the current cache better have exclusive access to this line
 
             // If child is in sharers list (this is an upgrade miss), take it out
-            if (e->sharers[childId]) {
+            if (*childState != I) {
                 assert_msg(!e->isExclusive(), "Spurious GETX, childId=%d numSharers=%d isExcl=%d excl=%d", childId, e->numSharers, e->isExclusive(), e->exclusive);
-                e->sharers[childId] = false;
-                e->numSharers--;
+                if (*childState == S && e->coupState) e->numReaders--;
+                removeSharer(e, dirId, childId);
             }
 
             // Invalidate all other copies
-            respCycle = sendInvalidates(lineAddr, lineId, INV, inducedWriteback, cycle, srcId);
+            respCycle = sendInvalidates(lineAddr, dirId, INV, inducedWriteback, cycle, srcId, childId);
 
             // Set current sharer, mark exclusive
-            e->sharers[childId] = true;
-            e->numSharers++;
+            addSharer(e, dirId, childId);
             e->exclusive = true;
             e->coupState = false;
+            e->coupOp = COUP_NONE;
+            e->updMask = 0;
+            e->numReaders = 0;
 
             assert(e->numSharers == 1);
 
             *childState = M; //give in M directly
             break;
+        case RATOM:
+            // The update will be performed above us (or by our bcc, if we are the home bank) on the only copy
+            // of the line, so no child may keep one. The requester's copy travels with the request.
+            if (*childState != I) {
+                if (*childState == S && e->coupState) e->numReaders--;
+                removeSharer(e, dirId, childId);
+            }
+            respCycle = sendInvalidates(lineAddr, dirId, INV, inducedWriteback, cycle, srcId, childId);
+            assert(e->isEmpty());
+            e->clear();
+            *childState = I;
+            break;
 
         default: panic("!?");
     }
 
+    releaseEntry(dirId);
     return respCycle;
 }
 
 
 
-uint64_t MEUSITopCC::processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId) {
+uint64_t MEUSITopCC::processFlush(Address lineAddr, uint32_t lineId, bool* inducedWriteback, uint64_t cycle, uint32_t srcId) {
+    int32_t dirId = dir? dir->lookup(lineId) : lineId;
+    if (dirId == -1) return cycle; //no sharers
+    Entry* e = &array[dirId];
+    if (!e->coupState || e->numSharers == e->numReaders) return cycle; //no partial updates to reduce
+    //Same as the reduction a read would trigger, but off its critical path
+    uint64_t respCycle = sendInvalidates(lineAddr, dirId, INV, inducedWriteback, cycle, srcId);
+    profFlushRed.inc();
+    profFlushRedCycles.inc(respCycle - cycle);
+    releaseEntry(dirId);
+    return respCycle;
+}
+
+uint64_t MEUSITopCC::processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId, CoupOp coupOp) {
     if (type == FWD) {//if it's a FWD, we should be inclusive for now, so we must have the line, just invLat works
         assert(!nonInclusiveHack); //dsm: ask me if you see this failing and don't know why
         return cycle;
+    }
+
+    int32_t dirId = dir? dir->lookup(lineId) : lineId;
+    if (dirId == -1) return cycle; //no sharers
+    uint64_t respCycle = cycle;
+    Entry* e = &array[dirId];
+    if (type == UPD) {
+        //U sharers of another operator can't keep updating the line, reduce them first
+        if (e->coupState && e->coupOp != coupOp) respCycle = sendInvalidates(lineAddr, dirId, INV, reqWriteback, cycle, srcId);
+        //Our children become U sharers too; record the operator they update with
+        e->coupOp = coupOp;
+        respCycle = sendInvalidates(lineAddr, dirId, type, reqWriteback, respCycle, srcId);
+        e->coupState = !e->isEmpty();
+        if (!e->coupState) e->coupOp = COUP_NONE;
+        e->updMask = e->coupState? ALL_WORDS : 0;
+        e->numReaders = 0;
+    } else if (type == INVX && e->coupState) {
+        //Without exclusivity, we can't keep absorbing our U sharers' updates, so they are reduced
+        respCycle = sendInvalidates(lineAddr, dirId, INV, reqWriteback, cycle, srcId);
     } else {
         //Just invalidate or downgrade down to children as needed
-        return sendInvalidates(lineAddr, lineId, type, reqWriteback, cycle, srcId);
+        respCycle = sendInvalidates(lineAddr, dirId, type, reqWriteback, cycle, srcId);
     }
+    releaseEntry(dirId);
+    return respCycle;
 }
 
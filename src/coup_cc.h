@@ -1,30 +1,51 @@
 #ifndef COUP_CC_H
 #define COUP_CC_H
 
-#include <bitset>
 #include "constants.h"
+#include "coup_predictor.h"
 #include "g_std/g_string.h"
 #include "g_std/g_vector.h"
 #include "locks.h"
 #include "memory_hierarchy.h"
 #include "pad.h"
+#include "reduction_unit.h"
+#include "sharer_array.h"
+#include "sparse_directory.h"
 #include "stats.h"
+#include "zsim.h"
 #include "coherence_ctrls.h"
 
+// Counter names for per-operator stats, indexed by CoupOp
+static const char* coupOpStatNames[] = {"none", "add", "and", "or", "xor", "fadd32", "fadd64", "min", "max"};
+static_assert(sizeof(coupOpStatNames)/sizeof(const char*) == COUP_NUM_OPS, "coupOpStatNames out of sync with CoupOp");
+
 class MEUSIBottomCC : public GlobAlloc {
     private:
 
         MESIState* array;    /* called MESI state to stay portable with coherence_ctrls, but it should be MEUSIState since it has the U state
                                 check memory hierarchy for more info */
+        CoupOp* opArray;     // reduction operator of each line in U (COUP_NONE otherwise)
+        uint64_t* maskArray; // sys.coupWordMasks only (nullptr otherwise): words a U line may update, or an S line may read
 
         g_vector<MemObject*> parents;
         g_vector<uint32_t> parentRTTs;
         uint32_t numLines;
         uint32_t selfId;
 
+        //Node ids in the COUP shadow-value model (only used if zinfo->coupShadow is set)
+        uint32_t shadowNode;
+        g_vector<uint32_t> shadowParentNodes;
+        bool shadowCheckReads; //only terminal caches, upper levels reduce their U children after the bcc access
+
         //Profiling counters
         Counter profGETSHit, profGETSMiss, profGETXHit, profGETXMissIM /*from invalid*/, profGETXMissSM /*from S, i.e. upgrade misses*/;
         Counter profGETUHit, profGETUMiss, profPUTU;        // profile coup stuff
+        Counter profGETUOpSwitch /*GETU misses on a U line held for another operator*/;
+        Counter profGETUFallback /*GETU misses the parent served exclusive (see CoupPredictor)*/;
+        Counter profGETUWordMiss /*GETU misses to update new words of a U line*/, profGETSWordMiss /*GETS misses on words an S line can't read*/;
+        VectorCounter profGETUHitOps, profGETUMissOps, profPUTUOps; // per-operator breakdown
+        Counter profRATOM /*remote atomics performed here*/, profRATOMFwd /*remote atomics forwarded to the home bank*/;
+        Counter profFLUSHFwd /*reduction flushes forwarded up*/;
         Counter profPUTS, profPUTX /*received from downstream*/;
         Counter profINV, profINVX, profFWD /*received from upstream*/;
         //Counter profWBIncl, profWBCoh /* writebacks due to inclusion or coherence, received from downstream, does not include PUTS */;
@@ -33,25 +54,43 @@ class MEUSIBottomCC : public GlobAlloc {
 
         bool nonInclusiveHack;
 
+        ReductionUnit* redUnit; //merges PUTUs from children, nullptr in terminal caches
+
         PAD();
         lock_t ccLock;
         PAD();
     public:
-        MEUSIBottomCC(uint32_t _numLines, uint32_t _selfId, bool _nonInclusiveHack) : numLines(_numLines), selfId(_selfId), nonInclusiveHack(_nonInclusiveHack) {
+        MEUSIBottomCC(uint32_t _numLines, uint32_t _selfId, bool _nonInclusiveHack, ReductionUnit* _redUnit = nullptr) : numLines(_numLines), selfId(_selfId),
+            shadowCheckReads(false), nonInclusiveHack(_nonInclusiveHack), redUnit(_redUnit) {
             array = gm_calloc<MESIState>(numLines);
+            opArray = gm_calloc<CoupOp>(numLines);
+            maskArray = zinfo->coupWordMasks? gm_calloc<uint64_t>(numLines) : nullptr;
             for (uint32_t i = 0; i < numLines; i++) {
                 array[i] = I;
+                opArray[i] = COUP_NONE;
+                if (maskArray) maskArray[i] = ALL_WORDS;
             }
             futex_init(&ccLock);
         }
 
         void init(const g_vector<MemObject*>& _parents, Network* network, const char* name);
 
+        void setShadowCheckReads() {shadowCheckReads = true;}
+
         inline bool isExclusive(uint32_t lineId) {
             MESIState state = array[lineId];
             return (state == E) || (state == M);
         }
 
+        // Words of the line we can read (all unless we hold it in S, partially)
+        inline uint64_t getReadableWords(uint32_t lineId) {
+            return (maskArray && array[lineId] == S)? maskArray[lineId] : ALL_WORDS;
+        }
+
+        inline CoupOp getCoupOp(uint32_t lineId) {
+            return opArray[lineId];
+        }
+
         void initStats(AggregateStat* parentStat) {
             profGETSHit.init("hGETS", "GETS hits");
             profGETXHit.init("hGETX", "GETX hits");
@@ -60,6 +99,16 @@ class MEUSIBottomCC : public GlobAlloc {
             profGETUHit.init("hGETU", "GETU hits");
             profGETUMiss.init("mGETU", "GETU miss");
             profPUTU.init("PUTU", "Reduce writeback");
+            profGETUOpSwitch.init("mGETUop", "GETU misses on U lines held for a different operator (forced reductions)");
+            profGETUFallback.init("mGETUfb", "GETU misses served an exclusive line instead of U (update done as an atomic)");
+            profGETUWordMiss.init("mGETUw", "GETU misses to update words not granted to the U line");
+            profGETSWordMiss.init("mGETSw", "GETS misses on words the (partially readable) S line can't read");
+            profGETUHitOps.init("hGETUops", "GETU hits per operator", COUP_NUM_OPS, coupOpStatNames);
+            profGETUMissOps.init("mGETUops", "GETU misses per operator", COUP_NUM_OPS, coupOpStatNames);
+            profPUTUOps.init("PUTUops", "Reduce writebacks per operator", COUP_NUM_OPS, coupOpStatNames);
+            profRATOM.init("RATOM", "Remote atomics performed at this (home) bank");
+            profRATOMFwd.init("fwdRATOM", "Remote atomics forwarded to the home bank");
+            profFLUSHFwd.init("fwdFLUSH", "Reduction flushes forwarded to the parent");
 
             profGETXMissIM.init("mGETXIM", "GETX I->M misses");
             profGETXMissSM.init("mGETXSM", "GETX S->M misses (upgrade misses)");
@@ -87,15 +136,36 @@ class MEUSIBottomCC : public GlobAlloc {
             parentStat->append(&profGETUHit);
             parentStat->append(&profGETUMiss);
             parentStat->append(&profPUTU);
+            parentStat->append(&profGETUOpSwitch);
+            parentStat->append(&profGETUFallback);
+            if (maskArray) {
+                parentStat->append(&profGETUWordMiss);
+                parentStat->append(&profGETSWordMiss);
+            }
+            parentStat->append(&profGETUHitOps);
+            parentStat->append(&profGETUMissOps);
+            parentStat->append(&profPUTUOps);
+            if (zinfo->coupMode == COUP_MODE_REMOTE) {
+                parentStat->append(&profRATOM);
+                parentStat->append(&profRATOMFwd);
+            }
+            if (zinfo->coupMode == COUP_MODE_COUP) parentStat->append(&profFLUSHFwd);
         }
 
         uint64_t processEviction(Address wbLineAddr, uint32_t lineId, bool lowerLevelWriteback, uint64_t cycle, uint32_t srcId);
 
-        uint64_t processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint64_t cycle, uint32_t srcId, uint32_t flags);
+        uint64_t processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint64_t cycle, uint32_t srcId, uint32_t flags, CoupOp coupOp,
+                uint64_t* wordMask = nullptr);
+
+        // Ships a remote atomic up to the home bank, dropping our copy of the line (lineId -1 if we don't have it)
+        uint64_t forwardRemoteAtomic(Address lineAddr, int32_t lineId, uint64_t cycle, uint32_t srcId, uint32_t flags, CoupOp coupOp, uint32_t updateWords);
+
+        // Ships a reduction flush up to the parent, which tracks the line's U sharers (including us, if we hold it in U)
+        uint64_t forwardFlush(Address lineAddr, uint64_t cycle, uint32_t srcId, uint32_t flags);
 
         void processWritebackOnAccess(Address lineAddr, uint32_t lineId, AccessType type);
 
-        void processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback);
+        void processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, CoupOp coupOp, bool* reqPartial);
 
         uint64_t processNonInclusiveWriteback(Address lineAddr, AccessType type, uint64_t cycle, MESIState* state, uint32_t srcId, uint32_t flags);
 
@@ -112,6 +182,10 @@ class MEUSIBottomCC : public GlobAlloc {
             return array[lineId] != I;
         }
 
+        inline MESIState getState(uint32_t lineId) {
+            return array[lineId];
+        }
+
         //Could extend with isExclusive, isDirty, etc, but not needed for now.
 
     private:
@@ -119,19 +193,29 @@ class MEUSIBottomCC : public GlobAlloc {
 
 };
 
+/* Entries and sharer sets are indexed by directory id: the line id, or the
+ * entry's slot if the directory is sparse (see sparse_directory.h).
+ */
 class MEUSITopCC : public GlobAlloc {
     private:
+        //One per line (or sparse directory entry), so keep it at 16 bytes; the sharer set is in the SharerArray
         struct Entry {
-            uint32_t numSharers;
-            std::bitset<MAX_CACHE_CHILDREN> sharers;
+            //With word masks: words the U sharers may update, and how many of the sharers are S children
+            //reading other words of the line (while coupState, all S sharers are these partial readers)
+            uint64_t updMask;
+            uint16_t numReaders;
+            uint16_t numSharers; //exact, even if the sharer set is imprecise
             bool exclusive;
             bool coupState;
+            CoupOp coupOp : 8; //operator the U sharers update with, valid iff coupState
 
             void clear() {
                 coupState = false;
+                coupOp = COUP_NONE;
                 exclusive = false;
                 numSharers = 0;
-                sharers.reset();
+                updMask = 0;
+                numReaders = 0;
             }
 
             bool isEmpty() {
@@ -142,22 +226,37 @@ class MEUSITopCC : public GlobAlloc {
                 return (numSharers == 1) && (exclusive);
             }
         };
+        static_assert(sizeof(Entry) == 16, "MEUSITopCC::Entry grew");
+        static_assert(MAX_CACHE_CHILDREN <= UINT16_MAX, "MEUSITopCC::Entry sharer counts are 16 bits");
 
         Entry* array;
+        SharerArray* sharers;
+        SparseDirectory* dir; //nullptr if entries are per line
+        MEUSIBottomCC* bcc; //to absorb writebacks from directory evictions
         g_vector<BaseCache*> children;
         g_vector<uint32_t> childrenRTTs;
-        uint32_t numLines;
+        g_vector<ReductionUnit::Partial> gatherBuf; //partials of the reduction in progress, one per child (lock held)
+        uint32_t numEntries;
 
         bool nonInclusiveHack;
 
+        ReductionUnit* redUnit; //folds children's partial updates into the line during reductions
+        ReductionReadStats redReadStats;
+
+        //Profiling counters
+        Counter profReductions /*INVs of U sharers*/, profRedPartials /*partial updates merged in them*/, profRedCycles /*cycles from first INV to last merge*/;
+        Counter profRedAvoided /*GETS served partially*/, profRedReaders /*reductions caused by updates to words readers may hold*/;
+        Counter profFlushRed /*reductions done by flushes*/, profFlushRedCycles /*their cycles, which later reads don't wait for*/;
+
         PAD();
         lock_t ccLock;
         PAD();
 
     public:
-        MEUSITopCC(uint32_t _numLines, bool _nonInclusiveHack) : numLines(_numLines), nonInclusiveHack(_nonInclusiveHack) {
-            array = gm_calloc<Entry>(numLines);
-            for (uint32_t i = 0; i < numLines; i++) {
+        MEUSITopCC(uint32_t numLines, bool _nonInclusiveHack, ReductionUnit* _redUnit, SharerArray* _sharers, SparseDirectory* _dir)
+            : sharers(_sharers), dir(_dir), bcc(nullptr), numEntries(_dir? _dir->getNumEntries() : numLines), nonInclusiveHack(_nonInclusiveHack), redUnit(_redUnit) {
+            array = gm_calloc<Entry>(numEntries);
+            for (uint32_t i = 0; i < numEntries; i++) {
                 array[i].clear();
             }
 
@@ -166,12 +265,42 @@ class MEUSITopCC : public GlobAlloc {
 
         void init(const g_vector<BaseCache*>& _children, Network* network, const char* name);
 
+        void setBottomCC(MEUSIBottomCC* _bcc) {bcc = _bcc;}
+
+        void initStats(AggregateStat* parentStat) {
+            profReductions.init("red", "Reductions (invalidations of U sharers)");
+            profRedPartials.init("redPartials", "Partial updates merged in reductions");
+            profRedCycles.init("redCycles", "Cycles spent in reductions, from sending invalidations to the last merge");
+            parentStat->append(&profReductions);
+            parentStat->append(&profRedPartials);
+            parentStat->append(&profRedCycles);
+            redReadStats.initStats(parentStat);
+            if (zinfo->coupWordMasks) {
+                profRedAvoided.init("redAvoided", "Reads of words not being updated served without reducing the line");
+                profRedReaders.init("redReaders", "Reductions caused by updates to new words while partial readers held the line");
+                parentStat->append(&profRedAvoided);
+                parentStat->append(&profRedReaders);
+            }
+            if (zinfo->coupMode == COUP_MODE_COUP) {
+                profFlushRed.init("flushRed", "Reductions done by reduction flushes (coup_flush) instead of reads");
+                profFlushRedCycles.init("flushRedCycles", "Cycles spent in flush reductions, i.e., read latency hidden by flushes");
+                parentStat->append(&profFlushRed);
+                parentStat->append(&profFlushRedCycles);
+            }
+            sharers->initStats(parentStat);
+            if (dir) dir->initStats(parentStat);
+        }
+
         uint64_t processEviction(Address wbLineAddr, uint32_t lineId, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
 
         uint64_t processAccess(Address lineAddr, uint32_t lineId, AccessType type, uint32_t childId, bool haveExclusive,
-                MESIState* childState, bool* inducedWriteback, uint64_t cycle, uint32_t srcId, uint32_t flags);
+                MESIState* childState, bool* inducedWriteback, uint64_t cycle, uint32_t srcId, uint32_t flags, CoupOp coupOp,
+                uint64_t reqWords = ALL_WORDS, uint64_t* wordMask = nullptr);
 
-        uint64_t processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
+        uint64_t processInval(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId, CoupOp coupOp);
+
+        // Reduction flush: reduces the line's U sharers, if any, so the next read of the line doesn't have to
+        uint64_t processFlush(Address lineAddr, uint32_t lineId, bool* inducedWriteback, uint64_t cycle, uint32_t srcId);
 
         inline void lock() {
             futex_lock(&ccLock);
@@ -183,46 +312,95 @@ class MEUSITopCC : public GlobAlloc {
 
         /* Replacement policy query interface */
         inline uint32_t numSharers(uint32_t lineId) {
-            return array[lineId].numSharers;
+            int32_t dirId = dir? dir->lookup(lineId) : lineId;
+            return (dirId == -1)? 0 : array[dirId].numSharers;
+        }
+
+        //Partial readers don't count: only U sharers hold partial updates
+        inline bool hasUSharers(uint32_t lineId) {
+            int32_t dirId = dir? dir->lookup(lineId) : lineId;
+            return (dirId != -1) && array[dirId].coupState && array[dirId].numSharers > array[dirId].numReaders;
         }
 
     private:
-        uint64_t sendInvalidates(Address lineAddr, uint32_t lineId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId);
+        // skipChild: requester, which imprecise sharer sets may still list after it is removed
+        // skipPartial: on reductions, the requester's partial update travels with its request; merge it too
+        uint64_t sendInvalidates(Address lineAddr, uint32_t dirId, InvType type, bool* reqWriteback, uint64_t cycle, uint32_t srcId,
+                uint32_t skipChild = (uint32_t)-1, bool skipPartial = false);
+
+        // A requester's partial update arrives with its request
+        inline ReductionUnit::Partial requesterPartial(uint32_t childId, uint64_t cycle) const {
+            return {cycle + childrenRTTs[childId]/2, childrenRTTs[childId]/2};
+        }
+
+        // Sparse directory: allocates an entry for the line, evicting another one if needed
+        uint32_t allocEntry(Address lineAddr, uint32_t lineId, uint64_t cycle, uint32_t srcId);
+
+        // Sparse directory: frees the entry if the line has no sharers left
+        inline void releaseEntry(uint32_t dirId) {
+            if (dir && array[dirId].isEmpty()) dir->erase(dirId);
+        }
+
+        inline void removeSharer(Entry* e, uint32_t dirId, uint32_t childId) {
+            sharers->remove(dirId, childId);
+            if (--e->numSharers == 0) {
+                //Without sharers, the line is no longer in U (nor held exclusive) below us
+                sharers->clear(dirId);
+                e->clear();
+            }
+        }
+
+        inline void addSharer(Entry* e, uint32_t dirId, uint32_t childId) {
+            sharers->add(dirId, childId);
+            e->numSharers++;
+        }
 };
 
 
 // Non-terminal CC; accepts GETS/X and PUTS/X accesses
-class MEUSICC : public CC {
+class MEUSICC final : public CC {
     private:
         MEUSITopCC* tcc;
         MEUSIBottomCC* bcc;
+        ReductionUnit* redUnit; //shared by tcc (reductions) and bcc (PUTUs)
+        SharerArray* sharers;
+        SparseDirectory* dir;
+        CoupPredictor* predictor; //nullptr if GETUs are always granted U
         uint32_t numLines;
         bool nonInclusiveHack;
+        bool atomicsHome; //remote atomics are performed here (LLC banks), other levels forward them
         g_string name;
 
     public:
         //Initialization
-        MEUSICC(uint32_t _numLines, bool _nonInclusiveHack, g_string& _name) : tcc(nullptr), bcc(nullptr),
-            numLines(_numLines), nonInclusiveHack(_nonInclusiveHack), name(_name) {}
+        MEUSICC(uint32_t _numLines, bool _nonInclusiveHack, ReductionUnit* _redUnit, SharerArray* _sharers, SparseDirectory* _dir,
+                CoupPredictor* _predictor, bool _atomicsHome, g_string& _name)
+            : tcc(nullptr), bcc(nullptr), redUnit(_redUnit), sharers(_sharers), dir(_dir), predictor(_predictor), numLines(_numLines),
+              nonInclusiveHack(_nonInclusiveHack), atomicsHome(_atomicsHome), name(_name) {}
 
         void setParents(uint32_t childId, const g_vector<MemObject*>& parents, Network* network) {
-            bcc = new MEUSIBottomCC(numLines, childId, nonInclusiveHack);
+            bcc = new MEUSIBottomCC(numLines, childId, nonInclusiveHack, redUnit);
             bcc->init(parents, network, name.c_str());
+            if (tcc) tcc->setBottomCC(bcc);
         }
 
         void setChildren(const g_vector<BaseCache*>& children, Network* network) {
-            tcc = new MEUSITopCC(numLines, nonInclusiveHack);
+            tcc = new MEUSITopCC(numLines, nonInclusiveHack, redUnit, sharers, dir);
             tcc->init(children, network, name.c_str());
+            if (bcc) tcc->setBottomCC(bcc);
         }
 
         void initStats(AggregateStat* cacheStat) {
-            //no tcc stats
             bcc->initStats(cacheStat);
+            tcc->initStats(cacheStat);
+            redUnit->initStats(cacheStat);
+            if (predictor) predictor->initStats(cacheStat);
         }
 
         //Access methods
         bool startAccess(MemReq& req) {
-            assert((req.type == GETS) || (req.type == GETX) || (req.type == PUTS) || (req.type == PUTX) || (req.type == GETU) || (req.type == PUTU));
+            assert((req.type == GETS) || (req.type == GETX) || (req.type == PUTS) || (req.type == PUTX) || (req.type == GETU) || (req.type == PUTU) ||
+                   (req.type == RATOM) || (req.type == RFLUSH));
 
             /* Child should be locked when called. We do hand-over-hand locking when going
              * down (which is why we require the lock), but not when going up, opening the
@@ -245,6 +423,10 @@ class MEUSICC : public CC {
         bool shouldAllocate(const MemReq& req) {
             if ((req.type == GETU) || (req.type == GETS) || (req.type == GETX)) {
                 return true;
+            } else if (req.type == RATOM) {
+                return atomicsHome; //other levels just forward it
+            } else if (req.type == RFLUSH) {
+                return false; //flushes only act on lines we already have
             } else {
                 assert((req.type == PUTS) || (req.type == PUTX)  || (req.type == PUTU));
                 if (!nonInclusiveHack) {
@@ -264,6 +446,8 @@ class MEUSICC : public CC {
 
         uint64_t processAccess(const MemReq& req, int32_t lineId, uint64_t startCycle, uint64_t* getDoneCycle = nullptr) {
             uint64_t respCycle = startCycle;
+            if (req.type == RATOM) return processRemoteAtomic(req, lineId, startCycle, getDoneCycle);
+            if (req.type == RFLUSH) return processFlush(req, lineId, startCycle, getDoneCycle);
 
             //Handle non-inclusive writebacks by bypassing
             //NOTE: Most of the time, these are due to evictions, so the line is not there. But the second condition can trigger in NUCA-initiated
@@ -280,18 +464,30 @@ class MEUSICC : public CC {
                 assert(!isPrefetch || req.type == GETS || req.type == GETU);
                 uint32_t flags = req.flags & ~MemReq::PREFETCH; //always clear PREFETCH, this flag cannot propagate up
 
+                //Updates to lines predicted to bounce between U and S are served as GETXs (plain atomics on an exclusive line)
+                AccessType type = req.type;
+                CoupOp coupOp = req.coupOp;
+                if (predictor && !isPrefetch && (type == GETS || type == GETX || type == GETU)) {
+                    if (predictor->access(req.lineAddr, type)) {
+                        type = GETX;
+                        coupOp = COUP_NONE;
+                    }
+                }
+
                 //if needed, fetch line or upgrade miss from upper level
-                respCycle = bcc->processAccess(req.lineAddr, lineId, req.type, startCycle, req.srcId, flags);
+                //(with word masks, bcc replaces the requested words with the ones it can read, so keep them for tcc)
+                uint64_t reqWords = req.wordMask? *req.wordMask : ALL_WORDS;
+                respCycle = bcc->processAccess(req.lineAddr, lineId, type, startCycle, req.srcId, flags, coupOp, req.wordMask);
                 if (getDoneCycle) *getDoneCycle = respCycle;
                 if (!isPrefetch) { //prefetches only touch bcc; the demand request from the core will pull the line to lower level
                     //At this point, the line is in a good state w.r.t. upper levels
                     bool lowerLevelWriteback = false;
                     //change directory info, invalidate other children if needed, tell requester about its state
-                    respCycle = tcc->processAccess(req.lineAddr, lineId, req.type, req.childId, bcc->isExclusive(lineId), req.state,
-                            &lowerLevelWriteback, respCycle, req.srcId, flags);
+                    respCycle = tcc->processAccess(req.lineAddr, lineId, type, req.childId, bcc->isExclusive(lineId), req.state,
+                            &lowerLevelWriteback, respCycle, req.srcId, flags, coupOp, reqWords, req.wordMask);
                     if (lowerLevelWriteback) {
                         //Essentially, if tcc induced a writeback, bcc may need to do an E->M transition to reflect that the cache now has dirty data
-                        bcc->processWritebackOnAccess(req.lineAddr, lineId, req.type);
+                        bcc->processWritebackOnAccess(req.lineAddr, lineId, type);
                     }
                 }
             }
@@ -314,20 +510,72 @@ class MEUSICC : public CC {
         }
 
         uint64_t processInv(const InvReq& req, int32_t lineId, uint64_t startCycle) {
-            uint64_t respCycle = tcc->processInval(req.lineAddr, lineId, req.type, req.writeback, startCycle, req.srcId); //send invalidates or downgrades to children
-            bcc->processInval(req.lineAddr, lineId, req.type, req.writeback); //adjust our own state
+            uint64_t respCycle = tcc->processInval(req.lineAddr, lineId, req.type, req.writeback, startCycle, req.srcId, req.coupOp); //send invalidates or downgrades to children
+            bcc->processInval(req.lineAddr, lineId, req.type, req.writeback, req.coupOp, req.partial); //adjust our own state
 
             bcc->unlock();
             return respCycle;
         }
 
+        void skipInv() {
+            bcc->unlock();
+        }
+
         //Repl policy interface
         uint32_t numSharers(uint32_t lineId) {return tcc->numSharers(lineId);}
         bool isValid(uint32_t lineId) {return bcc->isValid(lineId);}
+        MESIState getState(uint32_t lineId) {return bcc->getState(lineId);}
+        bool hasUSharers(uint32_t lineId) {return tcc->hasUSharers(lineId);}
+
+        //Protocol checker interface (see coup_checker.cpp)
+        CoupOp getCoupOp(uint32_t lineId) {return bcc->getCoupOp(lineId);}
+
+    private:
+        uint64_t processRemoteAtomic(const MemReq& req, int32_t lineId, uint64_t startCycle, uint64_t* getDoneCycle) {
+            uint32_t flags = req.flags & ~MemReq::PREFETCH;
+            uint64_t respCycle = startCycle;
+            bool lowerLevelWriteback = false;
+            if (!atomicsHome) {
+                //Invalidate our other children's copies, then ship the update up along with our own copy
+                if (lineId != -1) {
+                    respCycle = tcc->processAccess(req.lineAddr, lineId, RATOM, req.childId, bcc->isExclusive(lineId), req.state,
+                            &lowerLevelWriteback, respCycle, req.srcId, flags, req.coupOp);
+                    if (lowerLevelWriteback) bcc->processWritebackOnAccess(req.lineAddr, lineId, GETX);
+                }
+                respCycle = bcc->forwardRemoteAtomic(req.lineAddr, lineId, respCycle, req.srcId, flags, req.coupOp, req.updateWords);
+                if (getDoneCycle) *getDoneCycle = respCycle;
+            } else {
+                //Get the line exclusive, invalidate all children's copies, and perform the update in our ALU
+                assert(lineId != -1);
+                respCycle = bcc->processAccess(req.lineAddr, lineId, RATOM, startCycle, req.srcId, flags, req.coupOp);
+                if (getDoneCycle) *getDoneCycle = respCycle;
+                respCycle = tcc->processAccess(req.lineAddr, lineId, RATOM, req.childId, bcc->isExclusive(lineId), req.state,
+                        &lowerLevelWriteback, respCycle, req.srcId, flags, req.coupOp);
+                if (lowerLevelWriteback) bcc->processWritebackOnAccess(req.lineAddr, lineId, GETX);
+                respCycle = redUnit->execute(respCycle, req.coupOp, req.updateWords);
+            }
+            return respCycle;
+        }
+
+        uint64_t processFlush(const MemReq& req, int32_t lineId, uint64_t startCycle, uint64_t* getDoneCycle) {
+            if (lineId != -1 && bcc->isExclusive(lineId)) {
+                //U sharers below us fold their partial updates into our copy, so reduce them here
+                if (getDoneCycle) *getDoneCycle = startCycle;
+                bool lowerLevelWriteback = false;
+                uint64_t respCycle = tcc->processFlush(req.lineAddr, lineId, &lowerLevelWriteback, startCycle, req.srcId);
+                if (lowerLevelWriteback) bcc->processWritebackOnAccess(req.lineAddr, lineId, GETX);
+                return respCycle;
+            }
+            //Otherwise, they are tracked above us (if we hold the line in U, the reduction there reduces our children too).
+            //The LLC has no one to ask: if it doesn't hold the line exclusive, no one is updating it.
+            uint64_t respCycle = atomicsHome? startCycle : bcc->forwardFlush(req.lineAddr, startCycle, req.srcId, req.flags);
+            if (getDoneCycle) *getDoneCycle = respCycle;
+            return respCycle;
+        }
 };
 
 // Terminal CC, i.e., without children --- accepts GETS/X, but not PUTS/X
-class MEUSITerminalCC : public CC {
+class MEUSITerminalCC final : public CC {
     private:
         MEUSIBottomCC* bcc;
         uint32_t numLines;
@@ -340,6 +588,7 @@ class MEUSITerminalCC : public CC {
         void setParents(uint32_t childId, const g_vector<MemObject*>& parents, Network* network) {
             bcc = new MEUSIBottomCC(numLines, childId, false /*inclusive*/);
             bcc->init(parents, network, name.c_str());
+            bcc->setShadowCheckReads();
         }
 
         void setChildren(const g_vector<BaseCache*>& children, Network* network) {
@@ -352,7 +601,7 @@ class MEUSITerminalCC : public CC {
 
         //Access methods
         bool startAccess(MemReq& req) {
-            assert((req.type == GETS) || (req.type == GETX) || req.type == GETU); //no puts!
+            assert((req.type == GETS) || (req.type == GETX) || req.type == GETU || req.type == RATOM || req.type == RFLUSH); //no puts!
 
             /* Child should be locked when called. We do hand-over-hand locking when going
              * down (which is why we require the lock), but not when going up, opening the
@@ -372,7 +621,7 @@ class MEUSITerminalCC : public CC {
         }
 
         bool shouldAllocate(const MemReq& req) {
-            return true;
+            return req.type != RATOM && req.type != RFLUSH; //remote atomics are forwarded to the home bank, flushes to our parent
         }
 
         uint64_t processEviction(const MemReq& triggerReq, Address wbLineAddr, int32_t lineId, uint64_t startCycle) {
@@ -383,10 +632,16 @@ class MEUSITerminalCC : public CC {
 
         uint64_t processAccess(const MemReq& req, int32_t lineId, uint64_t startCycle,  uint64_t* getDoneCycle = nullptr) {
             
-            assert(lineId != -1);
             assert(!getDoneCycle);
+            if (req.type == RATOM) return bcc->forwardRemoteAtomic(req.lineAddr, lineId, startCycle, req.srcId, req.flags, req.coupOp, req.updateWords);
+            if (req.type == RFLUSH) {
+                //Exclusive lines have no partial updates anywhere; otherwise, our parent tracks the U sharers
+                if (lineId != -1 && bcc->isExclusive(lineId)) return startCycle;
+                return bcc->forwardFlush(req.lineAddr, startCycle, req.srcId, req.flags);
+            }
+            assert(lineId != -1);
             //if needed, fetch line or upgrade miss from upper level
-            uint64_t respCycle = bcc->processAccess(req.lineAddr, lineId, req.type, startCycle, req.srcId, req.flags);
+            uint64_t respCycle = bcc->processAccess(req.lineAddr, lineId, req.type, startCycle, req.srcId, req.flags, req.coupOp, req.wordMask);
             //at this point, the line is in a good state w.r.t. upper levels
             return respCycle;
         }
@@ -405,14 +660,23 @@ class MEUSITerminalCC : public CC {
         }
 
         uint64_t processInv(const InvReq& req, int32_t lineId, uint64_t startCycle) {
-            bcc->processInval(req.lineAddr, lineId, req.type, req.writeback); //adjust our own state
+            bcc->processInval(req.lineAddr, lineId, req.type, req.writeback, req.coupOp, req.partial); //adjust our own state
             bcc->unlock();
             return startCycle; //no extra delay in terminal caches
         }
 
+        void skipInv() {
+            bcc->unlock();
+        }
+
         //Repl policy interface
         uint32_t numSharers(uint32_t lineId) {return 0;} //no sharers
         bool isValid(uint32_t lineId) {return bcc->isValid(lineId);}
+        MESIState getState(uint32_t lineId) {return bcc->getState(lineId);}
+        bool hasUSharers(uint32_t lineId) {return false;}
+
+        //Protocol checker interface (see coup_checker.cpp)
+        CoupOp getCoupOp(uint32_t lineId) {return bcc->getCoupOp(lineId);}
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,787 @@
+/* Exhaustive state-space checker for the MEUSI protocol (standalone, no Pin).
+ *
+ * Builds a small hierarchy out of the real controllers: 2-4 L1s
+ * (MEUSITerminalCC) under an L2 (MEUSICC), which sits under a mock parent
+ * that stands for the rest of the system. Besides serving the L2's requests,
+ * the parent plays remote requesters (other L2s), so it sends the L2 the
+ * invalidations (INV), downgrades (INVX) and U downgrades (UPD) a real
+ * directory would. Caches are modeled with one line per checked address, and
+ * the checker drives evictions explicitly, so the actions are:
+ *
+ * - Each core: load (GETS), store (GETX), update with each operator (GETU),
+ *   reduction flush (RFLUSH), and evict its L1 line (PUTS/PUTX/PUTU)
+ * - The L2: evict its line (INVs to the L1s, then PUTS/PUTX/PUTU)
+ * - Remote requesters: GETS, GETX and GETU with each operator (INV, INVX or
+ *   UPD to the L2, as needed), and evicting their copy
+ *
+ * The checker explores every interleaving of these in breadth-first order,
+ * checking these invariants after each action:
+ *
+ * - swmr: an L1 in E/M is the only valid L1
+ * - ucompat: U L1s share their operator, and coexist only with I L1s (or
+ *   partial readers in S, with word masks)
+ * - inclusion/perms: the L2 holds every line its L1s hold, with at least
+ *   their permissions (for U L1s: E/M, or U with the same operator)
+ * - dir: the L2's sharer count and U sharers match its L1s
+ * - parent: the L2's state matches the one its parent gave it, and it only
+ *   sends the parent requests that are legal from that state
+ * - shadow: the COUP shadow-value model (coup_shadow.h) saw no lost or
+ *   unreduced partial updates, and every reduced value matches memory
+ *
+ * Controller assertions (this builds without NASSERT) and panics are
+ * reported too. Since the search is breadth-first, the first counterexample
+ * of each invariant is a shortest one; it is replayed on a fresh hierarchy,
+ * printing the states after each action.
+ *
+ * Controllers are reset between traces with a remote GETX (an INV from the
+ * parent), and states are deduplicated by their visible part (per-line
+ * states, operators, sharer counts and the parent's records). Controller
+ * state the checker can't see (e.g., word masks) is not part of the key, so
+ * the search is exhaustive over visible states, not over every internal one.
+ */
+
+#include <deque>
+#include <getopt.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include <unordered_set>
+#include <vector>
+
+#include "coup_cc.h"
+#include "coup_shadow.h"
+#include "galloc.h"
+#include "hash.h"
+#include "log.h"
+#include "memory_hierarchy.h"
+#include "sharer_array.h"
+#include "sparse_directory.h"
+#include "stats.h"
+#include "zsim.h"
+
+// Globals the controllers expect (defined in zsim.cpp in the simulator)
+GlobSimInfo* zinfo;
+uint32_t lineBits;
+uint64_t procMask;
+
+static const uint32_t LINE_SIZE = 64;
+static const uint32_t MAX_CACHES = 4;
+static const uint32_t MAX_ADDRS = 2;
+static const uint32_t MAX_WORDS = 2; //words loaded or updated with word masks
+
+static const CoupOp checkedOps[] = {COUP_ADD, COUP_XOR, COUP_OR, COUP_AND, COUP_FADD64, COUP_MIN, COUP_MAX};
+static const uint32_t NUM_CHECKED_OPS = sizeof(checkedOps)/sizeof(checkedOps[0]);
+
+struct Options {
+    uint32_t caches = 3;
+    uint32_t addrs = 1;
+    uint32_t ops = 2;
+    bool wordMasks = false;
+    SharerFormat sharers = SHARERS_FULL;
+    uint32_t sharersParam = 1;
+    uint32_t dirEntries = 0; //0: inline directory
+    uint32_t maxDepth = 0; //0: unbounded
+};
+
+/* Actions */
+
+enum ActionKind {
+    A_LOAD, A_STORE, A_UPDATE, A_FLUSH, A_EVICT, //a core, on its L1
+    A_L2_EVICT,
+    A_REMOTE_GETS, A_REMOTE_GETX, A_REMOTE_GETU, A_REMOTE_EVICT,
+};
+
+struct Action {
+    ActionKind kind;
+    uint8_t cache;
+    uint8_t addr;
+    uint8_t word;
+    CoupOp op;
+};
+
+typedef std::vector<Action> Trace;
+
+static std::string actionName(const Action& a, const Options& o) {
+    char buf[128];
+    char wordStr[16] = "";
+    if (o.wordMasks && (a.kind == A_LOAD || a.kind == A_UPDATE)) snprintf(wordStr, sizeof(wordStr), " w%d", a.word);
+    switch (a.kind) {
+        case A_LOAD: snprintf(buf, sizeof(buf), "core%d load a%d%s", a.cache, a.addr, wordStr); break;
+        case A_STORE: snprintf(buf, sizeof(buf), "core%d store a%d", a.cache, a.addr); break;
+        case A_UPDATE: snprintf(buf, sizeof(buf), "core%d update(%s) a%d%s", a.cache, CoupOpName(a.op), a.addr, wordStr); break;
+        case A_FLUSH: snprintf(buf, sizeof(buf), "core%d flush a%d", a.cache, a.addr); break;
+        case A_EVICT: snprintf(buf, sizeof(buf), "l1-%d evict a%d", a.cache, a.addr); break;
+        case A_L2_EVICT: snprintf(buf, sizeof(buf), "l2 evict a%d", a.addr); break;
+        case A_REMOTE_GETS: snprintf(buf, sizeof(buf), "remote GETS a%d", a.addr); break;
+        case A_REMOTE_GETX: snprintf(buf, sizeof(buf), "remote GETX a%d", a.addr); break;
+        case A_REMOTE_GETU: snprintf(buf, sizeof(buf), "remote GETU(%s) a%d", CoupOpName(a.op), a.addr); break;
+        case A_REMOTE_EVICT: snprintf(buf, sizeof(buf), "remote evict a%d", a.addr); break;
+        default: panic("!?");
+    }
+    return buf;
+}
+
+/* Mock components */
+
+// Cache with one line per checked address, so lines are never evicted to make room; the checker evicts them explicitly
+template <typename C>
+class ModelCache : public BaseCache {
+    private:
+        C* cc;
+        Address baseLineAddr;
+        g_string name;
+
+    public:
+        ModelCache(C* _cc, Address _baseLineAddr, const g_string& _name) : cc(_cc), baseLineAddr(_baseLineAddr), name(_name) {}
+
+        const char* getName() {return name.c_str();}
+        C* getCC() {return cc;}
+
+        void setParents(uint32_t childId, const g_vector<MemObject*>& parents, Network* network) {
+            cc->setParents(childId, parents, network);
+        }
+
+        void setChildren(const g_vector<BaseCache*>& children, Network* network) {
+            cc->setChildren(children, network);
+        }
+
+        uint64_t access(MemReq& req) {
+            uint64_t respCycle = req.cycle;
+            bool skipAccess = cc->startAccess(req);
+            if (!skipAccess) {
+                int32_t lineId = req.lineAddr - baseLineAddr;
+                respCycle = cc->processAccess(req, lineId, respCycle + 1);
+            }
+            cc->endAccess(req);
+            return respCycle;
+        }
+
+        uint64_t invalidate(const InvReq& req) {
+            cc->startInv();
+            int32_t lineId = req.lineAddr - baseLineAddr;
+            if (req.held) {
+                *req.held = cc->isValid(lineId);
+                if (!*req.held) {
+                    cc->skipInv();
+                    return req.cycle;
+                }
+            }
+            return cc->processInv(req, lineId, req.cycle + 1);
+        }
+
+        void evict(uint32_t lineId, uint64_t cycle) {
+            //Like Cache::access, evict holding our bcc lock, which writebacks hand over to the parent
+            MemReq triggerReq = {baseLineAddr + lineId, GETS, 0, nullptr, cycle, nullptr, I, 0, 0};
+            cc->startInv();
+            cc->processEviction(triggerReq, baseLineAddr + lineId, lineId, cycle);
+            cc->skipInv();
+        }
+};
+
+/* Parent of the L2: serves its requests like a directory would, and plays remote requesters that share the line
+ * with it. Remote copies are not updated (the shadow model only tracks the L2's subtree).
+ */
+class MockParent : public MemObject {
+    public:
+        struct Line {
+            MESIState child; //what we gave the L2
+            CoupOp childOp;
+            MESIState remote; //what remote requesters hold: I, S, M (exclusive) or U
+            CoupOp remoteOp;
+        };
+
+    private:
+        Line lines[MAX_ADDRS];
+        BaseCache* child;
+        Address baseLineAddr;
+        std::string* violation; //set when the L2 sends a request it should not
+
+    public:
+        MockParent(Address _baseLineAddr, std::string* _violation) : child(nullptr), baseLineAddr(_baseLineAddr), violation(_violation) {
+            for (Line& l : lines) l = {I, COUP_NONE, I, COUP_NONE};
+        }
+
+        const char* getName() {return "parent";}
+        void setChild(BaseCache* _child) {child = _child;}
+        const Line& getLine(uint32_t a) const {return lines[a];}
+
+        uint64_t access(MemReq& req) {
+            Line& l = lines[req.lineAddr - baseLineAddr];
+            if (*req.state != l.child && !(l.child == E && *req.state == M)) {
+                flag("l2 sent %s from %s, but holds the line in %s", AccessTypeName(req.type), MESIStateName(*req.state), MESIStateName(l.child));
+            }
+
+            MESIState grant = I;
+            switch (req.type) {
+                case GETS:
+                    //With word masks, an S line may ask for words it was not given
+                    if (l.child == E || l.child == M || (l.child == S && !zinfo->coupWordMasks)) flag("l2 sent GETS from %s", MESIStateName(l.child));
+                    if (l.remote == M) l.remote = S; //INVX
+                    if (l.remote == U) l.remote = I; //reduction
+                    grant = (l.remote == I && !req.is(MemReq::NOEXCL))? E : S;
+                    break;
+                case GETX:
+                    if (l.child == E || l.child == M) flag("l2 sent GETX from %s", MESIStateName(l.child));
+                    l.remote = I;
+                    grant = M;
+                    break;
+                case GETU:
+                    if (req.coupOp == COUP_NONE) flag("l2 sent GETU without an operator");
+                    if (l.child == E || l.child == M) flag("l2 sent GETU from %s", MESIStateName(l.child));
+                    if (l.child == U && l.childOp == req.coupOp && !zinfo->coupWordMasks) flag("l2 sent GETU(%s) holding the line in U for it", CoupOpName(req.coupOp));
+                    if (l.remote == U && l.remoteOp != req.coupOp) l.remote = I; //reduction
+                    if (l.remote == S || l.remote == M) l.remote = U; //UPD
+                    if (l.remote == U) l.remoteOp = req.coupOp;
+                    grant = (l.remote == I)? E : U; //alone, the line is given exclusive, like memory does
+                    break;
+                case PUTS:
+                    if (l.child != S && l.child != E) flag("l2 sent PUTS from %s", MESIStateName(l.child));
+                    break;
+                case PUTX:
+                    if (l.child != E && l.child != M) flag("l2 sent PUTX from %s", MESIStateName(l.child));
+                    break;
+                case PUTU:
+                    if (l.child != U || req.coupOp != l.childOp) {
+                        flag("l2 sent PUTU(%s) from %s(%s)", CoupOpName(req.coupOp), MESIStateName(l.child), CoupOpName(l.childOp));
+                    }
+                    break;
+                default:
+                    flag("l2 sent unexpected %s", AccessTypeName(req.type));
+            }
+            *req.state = grant;
+            l.child = grant;
+            l.childOp = (grant == U)? req.coupOp : COUP_NONE;
+            return req.cycle + 1;
+        }
+
+        // Remote requesters
+        void remoteAccess(uint32_t a, ActionKind kind, CoupOp op, uint64_t cycle) {
+            Line& l = lines[a];
+            switch (kind) {
+                case A_REMOTE_GETS:
+                    if (l.child == E || l.child == M) invalidate(a, INVX, COUP_NONE, cycle);
+                    else if (l.child == U) invalidate(a, INV, COUP_NONE, cycle);
+                    l.remote = S;
+                    break;
+                case A_REMOTE_GETX:
+                    if (l.child != I) invalidate(a, INV, COUP_NONE, cycle);
+                    l.remote = M;
+                    break;
+                case A_REMOTE_GETU:
+                    if (l.child == U && l.childOp != op) invalidate(a, INV, COUP_NONE, cycle);
+                    else if (l.child != I && l.child != U) invalidate(a, UPD, op, cycle);
+                    l.remote = U;
+                    l.remoteOp = op;
+                    break;
+                case A_REMOTE_EVICT:
+                    l.remote = I;
+                    break;
+                default: panic("!?");
+            }
+            if (l.remote != U) l.remoteOp = COUP_NONE;
+        }
+
+    private:
+        void invalidate(uint32_t a, InvType type, CoupOp op, uint64_t cycle) {
+            bool writeback = false;
+            InvReq req = {baseLineAddr + a, type, &writeback, cycle, 0, op, nullptr, nullptr};
+            child->invalidate(req);
+            Line& l = lines[a];
+            l.child = (type == INV)? I : (type == INVX)? S : U;
+            l.childOp = (type == UPD)? op : COUP_NONE;
+        }
+
+        void flag(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+            if (!violation->empty()) return; //keep the first one
+            char buf[256];
+            va_list ap;
+            va_start(ap, fmt);
+            vsnprintf(buf, sizeof(buf), fmt, ap);
+            va_end(ap);
+            *violation = buf;
+        }
+};
+
+/* The checked hierarchy */
+
+struct System {
+    Options o;
+    uint64_t* mem; //application memory of the checked lines (line-aligned), which the shadow model checks against
+    Address baseLineAddr;
+    MockParent* parent;
+    ModelCache<MEUSICC>* l2;
+    ModelCache<MEUSITerminalCC>* l1s[MAX_CACHES];
+    AggregateStat* stats; //shadow model stats first, then the caches'
+    std::string parentViolation;
+    uint64_t cycle;
+    uint64_t storeVal;
+
+    explicit System(const Options& _o) : o(_o), cycle(0), storeVal(0) {
+        mem = gm_memalign<uint64_t>(LINE_SIZE, MAX_ADDRS*LINE_SIZE/sizeof(uint64_t));
+        memset(mem, 0, MAX_ADDRS*LINE_SIZE);
+        baseLineAddr = ((Address)mem) >> lineBits;
+
+        zinfo->coupShadow = new CoupShadow(LINE_SIZE, o.caches, false /*count errors, don't panic*/);
+        stats = new AggregateStat();
+        stats->init("checker", "Checker stats");
+        zinfo->coupShadow->initStats(stats);
+
+        parent = new MockParent(baseLineAddr, &parentViolation);
+
+        ReductionUnit* redUnit = new ReductionUnit(1, 1, 1, LINE_SIZE/8, LINE_SIZE);
+        SharerArray* sharers = new SharerArray(o.dirEntries? o.dirEntries : o.addrs, o.sharers, o.sharersParam);
+        SparseDirectory* dir = nullptr;
+        if (o.dirEntries) {
+            //Single set, so the directory holds any o.dirEntries of the lines
+            dir = new SparseDirectory(o.dirEntries, o.dirEntries, false, o.addrs, new H3HashFamily(1, 0, 0xC0FFEE));
+        }
+        g_string l2Name("l2");
+        l2 = new ModelCache<MEUSICC>(new MEUSICC(o.addrs, false, redUnit, sharers, dir, nullptr, true, l2Name), baseLineAddr, l2Name);
+
+        g_vector<BaseCache*> children;
+        for (uint32_t c = 0; c < o.caches; c++) {
+            g_string name(("l1-" + std::to_string(c)).c_str());
+            l1s[c] = new ModelCache<MEUSITerminalCC>(new MEUSITerminalCC(o.addrs, name), baseLineAddr, name);
+            children.push_back(l1s[c]);
+        }
+
+        //Like init.cpp, parents first, so bccs get shadow node ids in the same order on every rebuild
+        g_vector<MemObject*> l2Parents;
+        l2Parents.push_back(parent);
+        l2->setParents(0, l2Parents, nullptr);
+        g_vector<MemObject*> l1Parents;
+        l1Parents.push_back(l2);
+        for (uint32_t c = 0; c < o.caches; c++) {
+            l1s[c]->setParents(c, l1Parents, nullptr);
+            zinfo->coupShadow->setCoreNode(c, l1s[c]->getName());
+        }
+        l2->setChildren(children, nullptr);
+        parent->setChild(l2);
+
+        //Controllers need their stats initialized; we don't dump them
+        initCacheStats(l2->getName(), l2->getCC());
+        for (uint32_t c = 0; c < o.caches; c++) initCacheStats(l1s[c]->getName(), l1s[c]->getCC());
+        stats->makeImmutable();
+    }
+
+    template <typename C> void initCacheStats(const char* name, C* cc) {
+        AggregateStat* cacheStat = new AggregateStat();
+        cacheStat->init(name, "Cache stats");
+        cc->initStats(cacheStat);
+        stats->append(cacheStat);
+    }
+
+    Address lineAddr(uint32_t a) const {return baseLineAddr + a;}
+
+    uint64_t shadowErrors() const {
+        AggregateStat* s = static_cast<AggregateStat*>(stats->get(0));
+        uint64_t errors = 0;
+        for (uint32_t i = 0; i < s->size(); i++) {
+            const char* n = s->get(i)->name();
+            if (!strcmp(n, "mismatches") || !strcmp(n, "unreduced") || !strcmp(n, "badOps")) {
+                errors += static_cast<ScalarStat*>(s->get(i))->get();
+            }
+        }
+        return errors;
+    }
+
+    // Value a core updates word w of a line with (distinct per core, so lost updates change the result)
+    static uint64_t updateValue(CoupOp op, uint32_t c) {
+        switch (op) {
+            case COUP_ADD: return 1 + c;
+            case COUP_XOR: return 1UL << c;
+            case COUP_OR: return 1UL << (8 + c);
+            case COUP_AND: return ~(1UL << (16 + c));
+            case COUP_FADD64: { double d = 1.0 + c; uint64_t v; memcpy(&v, &d, sizeof(v)); return v; }
+            case COUP_MIN: return -(int64_t)(1 + c);
+            case COUP_MAX: return (1 + c) << 24;
+            default: panic("!?");
+        }
+    }
+
+    bool enabled(const Action& a) {
+        switch (a.kind) {
+            case A_EVICT: return l1s[a.cache]->getCC()->isValid(a.addr);
+            case A_L2_EVICT: return l2->getCC()->isValid(a.addr);
+            case A_REMOTE_EVICT: return parent->getLine(a.addr).remote != I;
+            default: return true;
+        }
+    }
+
+    void step(const Action& a) {
+        cycle += 100;
+        switch (a.kind) {
+            case A_LOAD:
+            case A_STORE:
+            case A_UPDATE:
+                {
+                    //Issued like FilterCache does
+                    MESIState dummyState = I;
+                    AccessType type = (a.kind == A_LOAD)? GETS : (a.kind == A_STORE)? GETX : GETU;
+                    CoupOp op = (a.kind == A_UPDATE)? a.op : COUP_NONE;
+                    uint64_t words = 1UL << a.word;
+                    MemReq req = {lineAddr(a.addr), type, 0, &dummyState, cycle, nullptr, dummyState, a.cache, 0, op,
+                        (o.wordMasks && type != GETX)? &words : nullptr};
+                    l1s[a.cache]->access(req);
+
+                    //Then the core performs the access natively on memory (the shadow model sees updates first, like in zsim.cpp)
+                    uint64_t* word = &mem[a.addr*LINE_SIZE/sizeof(uint64_t) + a.word];
+                    if (a.kind == A_STORE) {
+                        *word = ++storeVal << 32;
+                    } else if (a.kind == A_UPDATE) {
+                        uint64_t v = updateValue(a.op, a.cache);
+                        zinfo->coupShadow->update(a.cache, lineAddr(a.addr), a.word*sizeof(uint64_t), sizeof(uint64_t), a.op, v);
+                        *word = ApplyCoupOp(a.op, *word, v, sizeof(uint64_t));
+                    }
+                }
+                break;
+            case A_FLUSH:
+                {
+                    MESIState dummyState = I;
+                    MemReq req = {lineAddr(a.addr), RFLUSH, 0, &dummyState, cycle, nullptr, dummyState, a.cache, 0};
+                    l1s[a.cache]->access(req);
+                }
+                break;
+            case A_EVICT:
+                l1s[a.cache]->evict(a.addr, cycle);
+                break;
+            case A_L2_EVICT:
+                l2->evict(a.addr, cycle);
+                break;
+            default:
+                parent->remoteAccess(a.addr, a.kind, a.op, cycle);
+        }
+    }
+
+    // Invalidate the whole hierarchy (a remote GETX, then the remote copy is dropped)
+    void reset() {
+        for (uint32_t a = 0; a < o.addrs; a++) {
+            parent->remoteAccess(a, A_REMOTE_GETX, COUP_NONE, cycle);
+            parent->remoteAccess(a, A_REMOTE_EVICT, COUP_NONE, cycle);
+        }
+    }
+
+    // Visible state, used to deduplicate states
+    std::string key() {
+        std::string k;
+        for (uint32_t a = 0; a < o.addrs; a++) {
+            for (uint32_t c = 0; c < o.caches; c++) {
+                k.push_back(l1s[c]->getCC()->getState(a));
+                k.push_back(l1s[c]->getCC()->getCoupOp(a));
+            }
+            MEUSICC* cc = l2->getCC();
+            k.push_back(cc->getState(a));
+            k.push_back(cc->getCoupOp(a));
+            k.push_back(cc->numSharers(a));
+            k.push_back(cc->hasUSharers(a));
+            const MockParent::Line& l = parent->getLine(a);
+            k.push_back(l.child);
+            k.push_back(l.childOp);
+            k.push_back(l.remote);
+            k.push_back(l.remoteOp);
+        }
+        return k;
+    }
+
+    std::string describe() {
+        std::string s;
+        for (uint32_t a = 0; a < o.addrs; a++) {
+            if (a) s += " | ";
+            s += "a" + std::to_string(a) + ": l1s";
+            for (uint32_t c = 0; c < o.caches; c++) s += " " + stateName(l1s[c]->getCC()->getState(a), l1s[c]->getCC()->getCoupOp(a));
+            MEUSICC* cc = l2->getCC();
+            s += ", l2 " + stateName(cc->getState(a), cc->getCoupOp(a));
+            s += " (" + std::to_string(cc->numSharers(a)) + " sharers" + (cc->hasUSharers(a)? ", U" : "") + ")";
+            const MockParent::Line& l = parent->getLine(a);
+            s += ", remote " + stateName(l.remote, l.remoteOp);
+        }
+        return s;
+    }
+
+    static std::string stateName(MESIState s, CoupOp op) {
+        std::string n = MESIStateName(s);
+        if (s == U) n += std::string("(") + CoupOpName(op) + ")";
+        return n;
+    }
+};
+
+/* Invariants */
+
+struct Violation {
+    std::string invariant;
+    std::string msg;
+};
+
+static bool check(System& sys, uint64_t prevShadowErrors, Violation& v) {
+    const Options& o = sys.o;
+    if (!sys.parentViolation.empty()) {
+        v = {"parent", sys.parentViolation};
+        return false;
+    }
+    if (sys.shadowErrors() != prevShadowErrors) {
+        v = {"shadow", "the shadow-value model saw a lost, unreduced or wrong partial update (see warnings above)"};
+        return false;
+    }
+
+    char buf[256];
+    MEUSICC* l2cc = sys.l2->getCC();
+    for (uint32_t a = 0; a < o.addrs; a++) {
+        MESIState l2State = l2cc->getState(a);
+        CoupOp l2Op = l2cc->getCoupOp(a);
+        uint32_t valid = 0;
+        uint32_t excl = 0;
+        bool anyU = false;
+        for (uint32_t c = 0; c < o.caches; c++) {
+            MEUSITerminalCC* cc = sys.l1s[c]->getCC();
+            MESIState s = cc->getState(a);
+            CoupOp op = cc->getCoupOp(a);
+            if (s == I) continue;
+            valid++;
+            if (s == E || s == M) excl++;
+            if (s == U) anyU = true;
+
+            if (l2State == I) {
+                snprintf(buf, sizeof(buf), "a%d: l1-%d holds the line in %s, but the l2 does not", a, c, MESIStateName(s));
+                v = {"inclusion", buf};
+                return false;
+            }
+            bool ok = (s == S)? (l2State != U) :
+                      (s == U)? (l2State == E || l2State == M || (l2State == U && l2Op == op)) :
+                      (l2State == E || l2State == M);
+            if (!ok) {
+                snprintf(buf, sizeof(buf), "a%d: l1-%d holds the line in %s, but the l2 only in %s",
+                        a, c, System::stateName(s, op).c_str(), System::stateName(l2State, l2Op).c_str());
+                v = {"perms", buf};
+                return false;
+            }
+
+            for (uint32_t d = 0; d < c; d++) {
+                MEUSITerminalCC* dcc = sys.l1s[d]->getCC();
+                MESIState ds = dcc->getState(a);
+                CoupOp dop = dcc->getCoupOp(a);
+                if (ds == I) continue;
+                bool bothU = (s == U) && (ds == U);
+                bool partialRead = o.wordMasks && ((s == U && ds == S) || (s == S && ds == U));
+                bool compatible = (s == S && ds == S) || (bothU && op == dop) || partialRead;
+                if (!compatible) {
+                    snprintf(buf, sizeof(buf), "a%d: l1-%d holds the line in %s and l1-%d in %s", a, d,
+                            System::stateName(ds, dop).c_str(), c, System::stateName(s, op).c_str());
+                    v = {(s == U || ds == U) && !(s == E || s == M || ds == E || ds == M)? "ucompat" : "swmr", buf};
+                    return false;
+                }
+            }
+        }
+
+        if (l2cc->numSharers(a) != valid || l2cc->hasUSharers(a) != anyU) {
+            snprintf(buf, sizeof(buf), "a%d: l2 directory has %d sharers%s, but %d l1s hold the line%s", a, l2cc->numSharers(a),
+                    l2cc->hasUSharers(a)? " (with U sharers)" : "", valid, anyU? " (some in U)" : "");
+            v = {"dir", buf};
+            return false;
+        }
+
+        const MockParent::Line& l = sys.parent->getLine(a);
+        //E->M transitions are silent
+        if ((l.child != l2State && !(l.child == E && l2State == M)) || (l2State == U && l.childOp != l2Op)) {
+            snprintf(buf, sizeof(buf), "a%d: l2 holds the line in %s, but its parent gave it %s", a,
+                    System::stateName(l2State, l2Op).c_str(), System::stateName(l.child, l.childOp).c_str());
+            v = {"parent", buf};
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Search */
+
+static const Trace* curTrace = nullptr; //trace being replayed, printed if a controller assertion or panic stops us
+static const Options* curOptions = nullptr;
+
+static void printTrace(const Trace& t, const Options& o) {
+    for (uint32_t i = 0; i < t.size(); i++) printf("  %2d. %s\n", i + 1, actionName(t[i], o).c_str());
+}
+
+static void dumpCurTrace() {
+    if (!curTrace) return;
+    printf("Controller assertion or panic (see above) on trace:\n");
+    printTrace(*curTrace, *curOptions);
+    fflush(stdout);
+    curTrace = nullptr;
+}
+
+static void crashHandler(int sig) {
+    dumpCurTrace();
+    _exit(1);
+}
+
+// Replays t on a fresh hierarchy, printing states along the way
+static void replay(const Trace& t, const Options& o) {
+    System sys(o);
+    printf("  %2d. %-32s %s\n", 0, "(initial)", sys.describe().c_str());
+    for (uint32_t i = 0; i < t.size(); i++) {
+        uint64_t shadowErrors = sys.shadowErrors();
+        sys.step(t[i]);
+        printf("  %2d. %-32s %s\n", i + 1, actionName(t[i], o).c_str(), sys.describe().c_str());
+        Violation v;
+        if (!check(sys, shadowErrors, v)) {
+            printf("      -> %s: %s\n", v.invariant.c_str(), v.msg.c_str());
+            return;
+        }
+    }
+    printf("      (not reproduced on a fresh hierarchy: the violation depends on state left by earlier traces)\n");
+}
+
+static std::vector<Action> allActions(const Options& o) {
+    std::vector<Action> actions;
+    uint32_t words = o.wordMasks? MAX_WORDS : 1;
+    for (uint32_t a = 0; a < o.addrs; a++) {
+        for (uint32_t c = 0; c < o.caches; c++) {
+            for (uint32_t w = 0; w < words; w++) actions.push_back({A_LOAD, (uint8_t)c, (uint8_t)a, (uint8_t)w, COUP_NONE});
+            actions.push_back({A_STORE, (uint8_t)c, (uint8_t)a, 0, COUP_NONE});
+            for (uint32_t i = 0; i < o.ops; i++) {
+                for (uint32_t w = 0; w < words; w++) actions.push_back({A_UPDATE, (uint8_t)c, (uint8_t)a, (uint8_t)w, checkedOps[i]});
+            }
+            actions.push_back({A_FLUSH, (uint8_t)c, (uint8_t)a, 0, COUP_NONE});
+            actions.push_back({A_EVICT, (uint8_t)c, (uint8_t)a, 0, COUP_NONE});
+        }
+        actions.push_back({A_L2_EVICT, 0, (uint8_t)a, 0, COUP_NONE});
+        actions.push_back({A_REMOTE_GETS, 0, (uint8_t)a, 0, COUP_NONE});
+        actions.push_back({A_REMOTE_GETX, 0, (uint8_t)a, 0, COUP_NONE});
+        for (uint32_t i = 0; i < o.ops; i++) actions.push_back({A_REMOTE_GETU, 0, (uint8_t)a, 0, checkedOps[i]});
+        actions.push_back({A_REMOTE_EVICT, 0, (uint8_t)a, 0, COUP_NONE});
+    }
+    return actions;
+}
+
+static void usage(const char* prog) {
+    info("Exhaustively checks the MEUSI protocol on a small hierarchy (an L2 with 2-4 L1s)");
+    info("Usage: %s [-c caches] [-a addrs] [-o ops] [-w] [-s Full|Coarse|LimitedPtr|Hybrid] [-p sharersParam] [-d dirEntries] [-m maxDepth]", prog);
+    info("  -c: L1s, 2-4 (default 3)");
+    info("  -a: addresses, 1-2 (default 1); use 2 with -d 1 to exercise directory evictions");
+    info("  -o: update operators, 1-%d (default 2: add, xor; then or, and, fadd64, min, max)", NUM_CHECKED_OPS);
+    info("  -w: track word masks (sys.coupWordMasks); loads and updates touch one of 2 words");
+    info("  -s, -p: sharer set format and its parameter (pointers or coarseness, default 1)");
+    info("  -d: sparse directory entries (default 0: inline directory)");
+    info("  -m: maximum trace length (default 0: explore all reachable states)");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    InitLog("");
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:a:o:ws:p:d:m:h")) != -1) {
+        switch (opt) {
+            case 'c': o.caches = atoi(optarg); break;
+            case 'a': o.addrs = atoi(optarg); break;
+            case 'o': o.ops = atoi(optarg); break;
+            case 'w': o.wordMasks = true; break;
+            case 's':
+                if (!strcmp(optarg, "Full")) o.sharers = SHARERS_FULL;
+                else if (!strcmp(optarg, "Coarse")) o.sharers = SHARERS_COARSE;
+                else if (!strcmp(optarg, "LimitedPtr")) o.sharers = SHARERS_LIMITED;
+                else if (!strcmp(optarg, "Hybrid")) o.sharers = SHARERS_HYBRID;
+                else usage(argv[0]);
+                break;
+            case 'p': o.sharersParam = atoi(optarg); break;
+            case 'd': o.dirEntries = atoi(optarg); break;
+            case 'm': o.maxDepth = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || o.caches < 2 || o.caches > MAX_CACHES || !o.addrs || o.addrs > MAX_ADDRS || !o.ops || o.ops > NUM_CHECKED_OPS ||
+            !o.sharersParam || o.dirEntries > o.addrs) {
+        usage(argv[0]);
+    }
+
+    gm_init(256 << 20);
+    zinfo = gm_calloc<GlobSimInfo>();
+    zinfo->lineSize = LINE_SIZE;
+    lineBits = 31 - __builtin_clz(LINE_SIZE);
+    procMask = 0;
+    zinfo->coupWordMasks = o.wordMasks;
+    zinfo->coupMode = COUP_MODE_COUP;
+
+    curOptions = &o;
+    signal(SIGSEGV, crashHandler);
+    atexit(dumpCurTrace);
+
+    printf("Checking MEUSI: %d L1s, %d address(es), %d operator(s)%s%s\n", o.caches, o.addrs, o.ops, o.wordMasks? ", word masks" : "",
+            o.dirEntries? (", sparse directory with " + std::to_string(o.dirEntries) + " entries").c_str() : "");
+
+    std::vector<Action> actions = allActions(o);
+    System* sys = new System(o);
+    std::string initKey = sys->key();
+    std::unordered_set<std::string> visited;
+    visited.insert(initKey);
+
+    std::deque<Trace> queue;
+    queue.push_back(Trace());
+    std::vector<std::pair<Violation, Trace>> violations;
+    uint64_t transitions = 0;
+    uint32_t maxDepth = 0;
+
+    while (!queue.empty()) {
+        Trace t = queue.front();
+        queue.pop_front();
+        if (o.maxDepth && t.size() >= o.maxDepth) continue;
+        //Once we have counterexamples, only finish their depth, so we report the shortest one of each invariant
+        if (!violations.empty() && t.size() >= violations[0].second.size()) break;
+
+        for (const Action& a : actions) {
+            //Replay t, then take a
+            Trace next = t;
+            next.push_back(a);
+            curTrace = &next;
+            for (const Action& p : t) sys->step(p);
+            bool violated = false;
+            if (sys->enabled(a)) {
+                uint64_t shadowErrors = sys->shadowErrors();
+                sys->step(a);
+                transitions++;
+
+                Violation v;
+                if (!check(*sys, shadowErrors, v)) {
+                    violated = true;
+                    bool seen = false;
+                    for (auto& p : violations) seen |= (p.first.invariant == v.invariant);
+                    if (!seen) violations.push_back(std::make_pair(v, next));
+                } else if (!visited.count(sys->key())) {
+                    visited.insert(sys->key());
+                    maxDepth = std::max(maxDepth, (uint32_t)next.size());
+                    queue.push_back(next);
+                }
+            }
+
+            if (violated) {
+                //The controllers may not recover from a violation, so start over with a fresh hierarchy
+                sys = new System(o);
+                curTrace = nullptr;
+                continue;
+            }
+            uint64_t shadowErrors = sys->shadowErrors();
+            sys->reset();
+            if (sys->key() != initKey || sys->shadowErrors() != shadowErrors || !sys->parentViolation.empty()) {
+                printf("Invalidating the hierarchy (remote GETX) did not reset it after trace:\n");
+                printTrace(next, o);
+                printf("  state: %s\n", sys->describe().c_str());
+                curTrace = nullptr;
+                exit(1);
+            }
+            curTrace = nullptr;
+        }
+    }
+
+    printf("Explored %lu states, %lu transitions, longest shortest trace %d\n", visited.size(), transitions, maxDepth);
+    if (violations.empty()) {
+        printf("No invariant violations\n");
+        return 0;
+    }
+    for (auto& p : violations) {
+        printf("Violation of %s: %s\n", p.first.invariant.c_str(), p.first.msg.c_str());
+        printf("Shortest counterexample (%ld actions):\n", p.second.size());
+        replay(p.second, o);
+    }
+    return 1;
+}
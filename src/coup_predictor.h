@@ -0,0 +1,102 @@
+#ifndef COUP_PREDICTOR_H
+#define COUP_PREDICTOR_H
+
+#include "galloc.h"
+#include "log.h"
+#include "memory_hierarchy.h"
+#include "stats.h"
+
+/* COUP grant predictor of a cache bank (sys.caches.<grp>.coupPredictor.*).
+ *
+ * Granting U pays off when updates to a line come in runs; if reads (or
+ * writes) come in between nearly every update, each one reduces the line and
+ * it thrashes between U and S. This predictor watches the requests that reach
+ * the bank and, for lines predicted to bounce, serves GETUs as GETXs: the
+ * requester gets the line exclusive and performs the update as a plain
+ * atomic, as without COUP.
+ *
+ * It is a tagless table of saturating counters indexed by line address.
+ * Requests are classified as updates (GETU) or reads (GETS, GETX). A read
+ * right after an update counts up (a U grant would have bounced), and an
+ * update right after an update counts down (a U grant would have absorbed
+ * it). GETUs fall back to GETX when the counter's upper half is reached.
+ *
+ * Each prediction is checked against the next request to the line: a U grant
+ * was right if it is an update, and a fallback was right if it is a read.
+ */
+class CoupPredictor : public GlobAlloc {
+    private:
+        struct Entry {
+            uint8_t counter;
+            bool lastWasUpdate;
+            bool pending; //prediction not yet checked
+            bool predFallback;
+        };
+
+        Entry* table;
+        const uint32_t mask;
+        const uint8_t maxCounter;
+        const uint8_t threshold;
+
+        Counter profPredU, profPredFallback;
+        Counter profUCorrect, profUWrong, profFallbackCorrect, profFallbackWrong;
+
+    public:
+        CoupPredictor(uint32_t entries, uint32_t bits) : mask(entries - 1), maxCounter((1 << bits) - 1), threshold(1 << (bits - 1)) {
+            if (!entries || (entries & (entries - 1))) panic("COUP predictor entries (%d) must be a power of two", entries);
+            if (!bits || bits > 7) panic("COUP predictor counters must have 1-7 bits (%d)", bits);
+            table = gm_calloc<Entry>(entries);
+        }
+
+        void initStats(AggregateStat* parentStat) {
+            profPredU.init("cpU", "GETUs the COUP predictor granted in U");
+            profPredFallback.init("cpFallback", "GETUs the COUP predictor served as GETXs");
+            profUCorrect.init("cpUCorrect", "U grants followed by an update (correct)");
+            profUWrong.init("cpUWrong", "U grants followed by a read or write (mispredicted)");
+            profFallbackCorrect.init("cpFallbackCorrect", "Fallbacks followed by a read or write (correct)");
+            profFallbackWrong.init("cpFallbackWrong", "Fallbacks followed by an update (mispredicted)");
+            parentStat->append(&profPredU);
+            parentStat->append(&profPredFallback);
+            parentStat->append(&profUCorrect);
+            parentStat->append(&profUWrong);
+            parentStat->append(&profFallbackCorrect);
+            parentStat->append(&profFallbackWrong);
+        }
+
+        // Called on every GET the bank receives; returns true if a GETU should be served as a GETX
+        bool access(Address lineAddr, AccessType type) {
+            assert(type == GETS || type == GETX || type == GETU);
+            Entry& e = table[(lineAddr ^ (lineAddr >> 16)) & mask];
+            bool isUpdate = (type == GETU);
+
+            if (e.pending) {
+                if (e.predFallback) {
+                    if (isUpdate) profFallbackWrong.inc();
+                    else profFallbackCorrect.inc();
+                } else {
+                    if (isUpdate) profUCorrect.inc();
+                    else profUWrong.inc();
+                }
+                e.pending = false;
+            }
+
+            if (e.lastWasUpdate) {
+                if (isUpdate) {
+                    if (e.counter > 0) e.counter--;
+                } else {
+                    if (e.counter < maxCounter) e.counter++;
+                }
+            }
+            e.lastWasUpdate = isUpdate;
+
+            if (!isUpdate) return false;
+            bool fallback = e.counter >= threshold;
+            e.pending = true;
+            e.predFallback = fallback;
+            if (fallback) profPredFallback.inc();
+            else profPredU.inc();
+            return fallback;
+        }
+};
+
+#endif  // COUP_PREDICTOR_H
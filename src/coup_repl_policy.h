@@ -0,0 +1,151 @@
+#ifndef COUP_REPL_POLICY_H
+#define COUP_REPL_POLICY_H
+
+#include "repl_policies.h"
+
+/* COUP-aware replacement (sys.caches.<grp>.repl.coupAware), wrapping a base
+ * policy (LRU, LRUNoSh, LFU or NRU).
+ *
+ * Evicting a line that is U here or has U sharers is expensive: it reduces
+ * every partial update below it (PUTUs), and if the line is still being
+ * updated, the next update must re-acquire it with a GETU. But U lines that
+ * are no longer updated only hold cache space until a read reduces them.
+ *
+ * So this wrapper classifies candidates into:
+ * - Live U lines, updated (GETU) in the last repl.coupLiveWindow accesses
+ *   to this cache: priority repl.coupLivePrio (default 2)
+ * - Dead U lines, the other U lines: priority repl.coupDeadPrio (default 0)
+ * - Other valid lines: priority 1
+ * - Invalid lines, which are always evicted first
+ *
+ * It evicts from the lowest priority present, using the base policy to rank
+ * the candidates within it. With the defaults, live U lines are protected
+ * and dead ones are evicted early; equal priorities disable either.
+ */
+
+// Candidates filtered into a list of line ids; same interface as SetAssocCands and ZCands
+struct IdListCands {
+    struct iterator {
+        const uint32_t* x;
+        explicit inline iterator(const uint32_t* _x) : x(_x) {}
+        inline void inc() {x++;}
+        inline uint32_t operator*() const { return *x; }
+        inline bool operator==(const iterator& it) const { return it.x == x; }
+        inline bool operator!=(const iterator& it) const { return it.x != x; }
+    };
+
+    const uint32_t* b;
+    const uint32_t* e;
+    inline IdListCands(const uint32_t* _b, const uint32_t* _e) : b(_b), e(_e) {}
+    inline iterator begin() const {return iterator(b);}
+    inline iterator end() const {return iterator(e);}
+    inline uint32_t numCands() const { return e-b; }
+};
+
+template <class T>
+class CoupReplPolicy : public T {
+    private:
+        static const int32_t INVALID_PRIO = INT32_MIN;
+        static const int32_t NORMAL_PRIO = 1;
+
+        const int32_t livePrio, deadPrio;
+        const uint64_t liveWindow;
+
+        uint64_t accesses;
+        uint64_t* lastUpdate; //per line, accesses count at its last GETU (0 if never)
+        uint32_t* candBuf;
+        uint32_t numCands;
+
+        Counter profProtected; //replacements that skipped live U candidates
+        VectorCounter profEvictions, profEvictionsUSharers;
+        Counter profEvictionsLive, profEvictionsDead;
+
+    public:
+        template <typename... Args>
+        CoupReplPolicy(uint32_t numLines, uint32_t _numCands, int32_t _livePrio, int32_t _deadPrio, uint64_t _liveWindow, Args... args)
+            : T(args...), livePrio(_livePrio), deadPrio(_deadPrio), liveWindow(_liveWindow), accesses(1), numCands(_numCands)
+        {
+            lastUpdate = gm_calloc<uint64_t>(numLines);
+            candBuf = gm_calloc<uint32_t>(numCands);
+        }
+
+        ~CoupReplPolicy() {
+            gm_free(lastUpdate);
+            gm_free(candBuf);
+        }
+
+        void initStats(AggregateStat* parentStat) {
+            T::initStats(parentStat);
+            static const char* stateNames[] = {"I", "S", "E", "M", "U"};
+            profEvictions.init("coupEv", "Evictions by victim state", 5, stateNames);
+            profEvictionsUSharers.init("coupEvUSh", "Evictions of lines with U sharers, by victim state", 5, stateNames);
+            profEvictionsLive.init("coupEvLive", "Evictions of live U lines (recently updated)");
+            profEvictionsDead.init("coupEvDead", "Evictions of dead U lines");
+            profProtected.init("coupProtected", "Replacements that spared live U lines");
+            parentStat->append(&profEvictions);
+            parentStat->append(&profEvictionsUSharers);
+            parentStat->append(&profEvictionsLive);
+            parentStat->append(&profEvictionsDead);
+            parentStat->append(&profProtected);
+        }
+
+        void update(uint32_t id, const MemReq* req) {
+            T::update(id, req);
+            if (req->type == GETU) lastUpdate[id] = accesses;
+            accesses++;
+        }
+
+        void replaced(uint32_t id) {
+            T::replaced(id);
+            lastUpdate[id] = 0;
+        }
+
+        template <typename C> inline uint32_t rank(const MemReq* req, C cands) {
+            int32_t minPrio = INT32_MAX;
+            bool haveLive = false;
+            for (auto ci = cands.begin(); ci != cands.end(); ci.inc()) {
+                int32_t p = prio(*ci);
+                minPrio = MIN(p, minPrio);
+                haveLive |= isU(*ci) && isLive(*ci);
+            }
+
+            uint32_t n = 0;
+            for (auto ci = cands.begin(); ci != cands.end(); ci.inc()) {
+                if (prio(*ci) == minPrio) {
+                    assert(n < numCands);
+                    candBuf[n++] = *ci;
+                }
+            }
+            uint32_t victim = T::rank(req, IdListCands(candBuf, candBuf + n));
+
+            MESIState state = this->cc->getState(victim);
+            profEvictions.inc(state);
+            if (this->cc->hasUSharers(victim)) profEvictionsUSharers.inc(state);
+            if (isU(victim)) {
+                if (isLive(victim)) profEvictionsLive.inc();
+                else profEvictionsDead.inc();
+            } else if (haveLive && minPrio < livePrio) {
+                profProtected.inc();
+            }
+            return victim;
+        }
+
+        DECL_RANK_BINDINGS;
+
+    private:
+        inline bool isU(uint32_t id) {
+            return this->cc->getState(id) == U || this->cc->hasUSharers(id);
+        }
+
+        inline bool isLive(uint32_t id) {
+            return lastUpdate[id] && accesses - lastUpdate[id] <= liveWindow;
+        }
+
+        inline int32_t prio(uint32_t id) {
+            if (!this->cc->isValid(id)) return INVALID_PRIO;
+            if (!isU(id)) return NORMAL_PRIO;
+            return isLive(id)? livePrio : deadPrio;
+        }
+};
+
+#endif  // COUP_REPL_POLICY_H
@@ -0,0 +1,298 @@
+#include "coup_shadow.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "log.h"
+#include "zsim.h"
+
+#ifdef COUP_CHECKER
+//The protocol checker (coup_checker.cpp) runs without Pin, and its lines live in its own address space
+static inline size_t readAppMem(void* dst, Address vAddr, size_t size) {
+    memcpy(dst, (const void*)vAddr, size);
+    return size;
+}
+#else
+#include "pin.H"
+static inline size_t readAppMem(void* dst, Address vAddr, size_t size) {
+    return PIN_SafeCopy(dst, (void*)vAddr, size);
+}
+#endif
+
+#define MAX_REPORTED_ERRORS 16
+
+// Values are little-endian and truncated to the update width, like the native instruction does
+static inline uint64_t loadVal(const uint8_t* p, uint32_t size) {
+    uint64_t v = 0;
+    memcpy(&v, p, size);
+    return v;
+}
+
+static inline void storeVal(uint8_t* p, uint32_t size, uint64_t v) {
+    memcpy(p, &v, size);
+}
+
+// Partials are added in a different order than the program added them, so FP values may round differently
+static inline bool fpClose(CoupOp op, uint64_t a, uint64_t b) {
+    double x, y;
+    if (op == COUP_FADD32) {
+        float fx, fy;
+        uint32_t ia = a, ib = b;
+        memcpy(&fx, &ia, sizeof(float));
+        memcpy(&fy, &ib, sizeof(float));
+        x = fx;
+        y = fy;
+    } else {
+        memcpy(&x, &a, sizeof(double));
+        memcpy(&y, &b, sizeof(double));
+    }
+    if (x != x && y != y) return true; //both NaN
+    double tol = (op == COUP_FADD32)? 1e-4 : 1e-10;
+    return fabs(x - y) <= tol*fmax(fabs(x), fabs(y));
+}
+
+CoupShadow::CoupShadow(uint32_t _lineSize, uint32_t numCores, bool _fatal) : lineSize(_lineSize), fatal(_fatal), reportedErrors(0) {
+    if (lineSize > MAX_LINE_BYTES) panic("sim.coupShadow only supports lines up to %d bytes (lineSize = %d)", MAX_LINE_BYTES, lineSize);
+    coreNodes.resize(numCores, (uint32_t)-1);
+    futex_init(&lock);
+    info("COUP shadow-value model enabled%s", fatal? " (mismatches are fatal)" : "");
+}
+
+void CoupShadow::initStats(AggregateStat* parentStat) {
+    AggregateStat* shStat = new AggregateStat();
+    shStat->init("coupShadow", "COUP shadow-value model stats");
+    profOpens.init("opens", "Partial updates opened (lines entering U at a cache)");
+    profUpdates.init("updates", "Updates applied to partials");
+    profLateUpdates.init("lateUpdates", "Updates with no open partial at the core's L1 (applied directly to the base value)");
+    profMerges.init("merges", "Partial updates folded into the parent or the base value");
+    profChecks.init("checks", "Fully-reduced lines checked against memory");
+    profMismatches.init("mismatches", "Reduced values that did not match memory");
+    profUnreduced.init("unreduced", "Lines that became readable with partial updates still open");
+    profBadOps.init("badOps", "Updates applied with an operator different from their partial's");
+    profSkipped.init("skipped", "Checks skipped (untracked updates or lines of other processes)");
+    shStat->append(&profOpens);
+    shStat->append(&profUpdates);
+    shStat->append(&profLateUpdates);
+    shStat->append(&profMerges);
+    shStat->append(&profChecks);
+    shStat->append(&profMismatches);
+    shStat->append(&profUnreduced);
+    shStat->append(&profBadOps);
+    shStat->append(&profSkipped);
+    parentStat->append(shStat);
+}
+
+uint32_t CoupShadow::getNodeId(const char* name) {
+    for (uint32_t i = 0; i < nodeNames.size(); i++) {
+        if (nodeNames[i] == name) return i;
+    }
+    nodeNames.push_back(g_string(name));
+    return nodeNames.size() - 1;
+}
+
+void CoupShadow::setCoreNode(uint32_t cid, const char* l1dName) {
+    assert(cid < coreNodes.size());
+    coreNodes[cid] = getNodeId(l1dName);
+}
+
+CoupShadow::ShadowLine* CoupShadow::getLine(Address lineAddr, bool create) {
+    g_unordered_map<Address, ShadowLine*>::iterator it = lines.find(lineAddr);
+    if (it != lines.end()) return it->second;
+    if (!create) return nullptr;
+
+    ShadowLine* sl = new ShadowLine();
+    memset(sl->width, 0, sizeof(sl->width));
+    memset(sl->ops, 0, sizeof(sl->ops));
+    sl->untracked = false;
+    //Snapshot the line as it was before entering U. Only the owning process can read it.
+    Address procBits = lineAddr & ~((1UL << (64 - lineBits)) - 1);
+    Address vAddr = (lineAddr & ~procBits) << lineBits;
+    if (procBits != procMask || readAppMem(sl->base, vAddr, lineSize) != lineSize) {
+        sl->untracked = true;
+    }
+    lines[lineAddr] = sl;
+    return sl;
+}
+
+CoupShadow::Partial* CoupShadow::findPartial(ShadowLine* sl, uint32_t node) {
+    for (Partial& p : sl->partials) {
+        if (p.node == node) return &p;
+    }
+    return nullptr;
+}
+
+void CoupShadow::fold(ShadowLine* sl, Partial* dst, const Partial& src) {
+    uint32_t i = 0;
+    while (i < lineSize) {
+        uint32_t w = sl->width[i];
+        if (!w) {
+            i++;
+            continue;
+        }
+        if (src.touched & (1UL << i)) {
+            uint8_t* d = dst? &dst->data[i] : &sl->base[i];
+            if (dst && !(dst->touched & (1UL << i))) {
+                storeVal(d, w, loadVal(&src.data[i], w)); //dst still holds the identity
+                dst->touched |= 1UL << i;
+            } else {
+                storeVal(d, w, ApplyCoupOp(src.op, loadVal(d, w), loadVal(&src.data[i], w), w));
+            }
+        }
+        i += w;
+    }
+}
+
+void CoupShadow::check(Address lineAddr, ShadowLine* sl) {
+    profChecks.inc();
+    if (sl->untracked) {
+        profSkipped.inc();
+        return;
+    }
+    Address procBits = lineAddr & ~((1UL << (64 - lineBits)) - 1);
+    Address vAddr = (lineAddr & ~procBits) << lineBits;
+    uint8_t mem[MAX_LINE_BYTES];
+    if (procBits != procMask || readAppMem(mem, vAddr, lineSize) != lineSize) {
+        profSkipped.inc();
+        return;
+    }
+
+    uint32_t i = 0;
+    while (i < lineSize) {
+        uint32_t w = sl->width[i];
+        if (w) {
+            uint64_t shVal = loadVal(&sl->base[i], w);
+            uint64_t memVal = loadVal(&mem[i], w);
+            bool match = IsFloatCoupOp((CoupOp)sl->ops[i])? fpClose((CoupOp)sl->ops[i], shVal, memVal) : shVal == memVal;
+            if (!match) {
+                profMismatches.inc();
+                reportError("[coupShadow] Line 0x%lx (vAddr 0x%lx) offset %d: reduced value 0x%lx, memory has 0x%lx",
+                        lineAddr, vAddr + i, i, shVal, memVal);
+            }
+            i += w;
+        } else {
+            i++;
+        }
+    }
+}
+
+void CoupShadow::reportError(const char* fmt, ...) {
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (fatal) panic("%s", buf);
+    if (reportedErrors < MAX_REPORTED_ERRORS) {
+        warn("%s", buf);
+        if (++reportedErrors == MAX_REPORTED_ERRORS) warn("[coupShadow] Too many errors, not reporting any more (see coupShadow stats)");
+    }
+}
+
+void CoupShadow::open(uint32_t node, Address lineAddr, CoupOp op) {
+    assert(op != COUP_NONE);
+    futex_lock(&lock);
+    ShadowLine* sl = getLine(lineAddr, true);
+    Partial* p = findPartial(sl, node);
+    if (p) {
+        //Already open (e.g., UPD on a line we got in U through another path); must be for the same operator
+        if (p->op != op) {
+            reportError("[coupShadow] Line 0x%lx reopened at node %s for %s, but its %s partial was not reduced",
+                    lineAddr, nodeNames[node].c_str(), CoupOpName(op), CoupOpName(p->op));
+            profUnreduced.inc();
+            fold(sl, nullptr, *p);
+            p->op = op;
+            p->touched = 0;
+        }
+    } else {
+        Partial np;
+        np.node = node;
+        np.op = op;
+        np.touched = 0; //identity
+        memset(np.data, 0, sizeof(np.data));
+        sl->partials.push_back(np);
+        profOpens.inc();
+    }
+    futex_unlock(&lock);
+}
+
+void CoupShadow::close(uint32_t node, uint32_t parentNode, Address lineAddr) {
+    futex_lock(&lock);
+    ShadowLine* sl = getLine(lineAddr, false);
+    Partial* p = sl? findPartial(sl, node) : nullptr;
+    if (p) {
+        //Partial reductions go to the parent if it keeps accumulating updates of the same operator
+        Partial* pp = findPartial(sl, parentNode);
+        fold(sl, (pp && pp->op == p->op)? pp : nullptr, *p);
+        sl->partials.erase(sl->partials.begin() + (p - &sl->partials[0]));
+        profMerges.inc();
+
+        if (sl->partials.empty()) {
+            check(lineAddr, sl);
+            lines.erase(lineAddr);
+            delete sl;
+        }
+    }
+    futex_unlock(&lock);
+}
+
+void CoupShadow::checkReduced(uint32_t node, Address lineAddr) {
+    futex_lock(&lock);
+    ShadowLine* sl = getLine(lineAddr, false);
+    if (sl) {
+        //Nobody may hold partial updates when a cache gets a readable copy
+        for (const Partial& p : sl->partials) {
+            reportError("[coupShadow] Line 0x%lx readable at node %s, but node %s still holds a %s partial update",
+                    lineAddr, nodeNames[node].c_str(), nodeNames[p.node].c_str(), CoupOpName(p.op));
+            profUnreduced.inc();
+            fold(sl, nullptr, p);
+        }
+        sl->partials.clear();
+        check(lineAddr, sl);
+        lines.erase(lineAddr);
+        delete sl;
+    }
+    futex_unlock(&lock);
+}
+
+void CoupShadow::update(uint32_t cid, Address lineAddr, uint32_t offset, uint32_t size, CoupOp op, uint64_t value) {
+    assert(cid < coreNodes.size());
+    futex_lock(&lock);
+    ShadowLine* sl = getLine(lineAddr, false);
+    if (!sl) {
+        //Line is not in U anywhere; memory will have the update and later snapshots will pick it up
+        profLateUpdates.inc();
+        futex_unlock(&lock);
+        return;
+    }
+
+    if (size > sizeof(uint64_t) || offset + size > lineSize || (sl->width[offset] && sl->width[offset] != size)) {
+        sl->untracked = true; //crosses lines, or mixes update sizes at this offset
+    } else {
+        sl->width[offset] = size;
+        sl->ops[offset] = op;
+    }
+
+    Partial* p = findPartial(sl, coreNodes[cid]);
+    Partial* dst = nullptr;
+    if (!p) {
+        profLateUpdates.inc();
+    } else if (p->op != op) {
+        reportError("[coupShadow] Core %d applied a %s update to line 0x%lx, which its L1 holds in U for %s",
+                cid, CoupOpName(op), lineAddr, CoupOpName(p->op));
+        profBadOps.inc();
+    } else {
+        dst = p;
+        profUpdates.inc();
+    }
+
+    if (!sl->untracked) {
+        if (dst && !(dst->touched & (1UL << offset))) {
+            storeVal(&dst->data[offset], size, value);
+            dst->touched |= 1UL << offset;
+        } else {
+            uint8_t* d = dst? &dst->data[offset] : &sl->base[offset];
+            storeVal(d, size, ApplyCoupOp(op, loadVal(d, size), value, size));
+        }
+    }
+    futex_unlock(&lock);
+}
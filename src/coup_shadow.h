@@ -0,0 +1,93 @@
+#ifndef COUP_SHADOW_H
+#define COUP_SHADOW_H
+
+#include "g_std/g_string.h"
+#include "g_std/g_unordered_map.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "locks.h"
+#include "memory_hierarchy.h"
+#include "stats.h"
+
+/* Functional shadow-value model for U-state lines (sim.coupShadow = true).
+ *
+ * zsim does not move data through the hierarchy, so a reduction bug (a lost
+ * partial update, a U sharer that is never reduced, an update applied with
+ * the wrong operator) is invisible in timing stats. This model tracks, for
+ * every line some cache holds in U, the base value the line had when it
+ * entered U plus one partial value per U holder, which starts as the
+ * operator's identity (offsets the partial has not updated yet). Cores apply their updates to the partial of their L1,
+ * partials are folded into the parent's partial (or into the base) when a U
+ * copy is evicted or invalidated, and once no partials remain, the reduced
+ * base must match the application's memory on every byte that was updated.
+ * FP adds (FADD32/FADD64) are reduced in a different order than the program
+ * performed them, so their values only need to match up to rounding.
+ *
+ * Nodes are the MEUSI bottom controllers, identified by cache name. All state
+ * is behind a single lock, which is a leaf lock (we never call out while
+ * holding it), so this is slow and meant only for validation runs.
+ *
+ * Known false positives: updates are applied to the shadow right before the
+ * native lock-prefixed instruction executes, so a check that races with
+ * another thread in that window may see memory lag the shadow by one update.
+ * Use sim.coupShadowFatal = false (the default) and look at the mismatch
+ * counts, rather than individual warnings, when many threads hammer a line.
+ */
+class CoupShadow : public GlobAlloc {
+    private:
+        static const uint32_t MAX_LINE_BYTES = 64;
+
+        struct Partial {
+            uint32_t node;
+            CoupOp op;
+            uint64_t touched; //offsets this partial has updated; the others hold op's identity
+            uint8_t data[MAX_LINE_BYTES];
+        };
+
+        struct ShadowLine : public GlobAlloc {
+            uint8_t base[MAX_LINE_BYTES];
+            uint8_t width[MAX_LINE_BYTES]; //size of the update at each offset, 0 if untouched
+            uint8_t ops[MAX_LINE_BYTES]; //operator of the last update at each offset
+            bool untracked; //saw an update we can't model (e.g., crossing lines), don't check it
+            g_vector<Partial> partials;
+        };
+
+        const uint32_t lineSize;
+        const bool fatal;
+
+        g_vector<g_string> nodeNames;
+        g_vector<uint32_t> coreNodes; //cid -> node of its L1d
+        g_unordered_map<Address, ShadowLine*> lines;
+
+        lock_t lock;
+        uint32_t reportedErrors;
+
+        Counter profOpens, profUpdates, profLateUpdates, profMerges, profChecks;
+        Counter profMismatches, profUnreduced, profBadOps, profSkipped;
+
+    public:
+        CoupShadow(uint32_t _lineSize, uint32_t numCores, bool _fatal);
+
+        void initStats(AggregateStat* parentStat);
+
+        // Init-time: get the node id of a cache or memory by name (registering it if needed)
+        uint32_t getNodeId(const char* name);
+        void setCoreNode(uint32_t cid, const char* l1dName);
+
+        // Protocol events, called from the MEUSI controllers
+        void open(uint32_t node, Address lineAddr, CoupOp op); //node now holds lineAddr in U
+        void close(uint32_t node, uint32_t parentNode, Address lineAddr); //node lost U, its partial goes up
+        void checkReduced(uint32_t node, Address lineAddr); //node just got a readable copy
+
+        // Updates, called by cores (on the tagged lock-prefixed instruction)
+        void update(uint32_t cid, Address lineAddr, uint32_t offset, uint32_t size, CoupOp op, uint64_t value);
+
+    private:
+        ShadowLine* getLine(Address lineAddr, bool create);
+        Partial* findPartial(ShadowLine* sl, uint32_t node);
+        void fold(ShadowLine* sl, Partial* dst /*nullptr: the base*/, const Partial& src);
+        void check(Address lineAddr, ShadowLine* sl);
+        void reportError(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+#endif  // COUP_SHADOW_H
@@ -32,8 +32,10 @@
 #include <string>
 #include <vector>
 #include "core.h"
+#include "coup_auto.h"
 #include "locks.h"
 #include "log.h"
+#include "zsim.h"
 
 extern "C" {
 #include "xed-interface.h"
@@ -1222,6 +1224,122 @@ bool Decoder::decodeInstr(INS ins, DynUopVec& uops) {
     return inaccurate;
 }
 
+/* COUP updates are lock-prefixed adds right after the COUP magic op (xchg %rcx, %rcx, see Instruction() in
+ * zsim.cpp). They are instrumented with a single coupUpdatePtr call, which the L1d turns into a GETU. Since
+ * the core never consumes the old value, there is no load-to-use dependence, and since the line is not
+ * locked, there are no fences and no store either. Remote atomics (sys.coupMode = Remote) still lock, so they
+ * keep the fences of locked instructions; plain atomics (sys.coupMode = Atomic) are not COUP updates at all.
+ */
+bool Decoder::isCoupTagged(INS ins) {
+    INS prevIns = INS_Prev(ins);
+    if (!INS_Valid(prevIns) || !INS_IsXchg(prevIns) || INS_OperandReg(prevIns, 0) != REG_RCX || INS_OperandReg(prevIns, 1) != REG_RCX) return false;
+    return INS_LockPrefix(ins) && INS_IsMemoryRead(ins) && INS_IsMemoryWrite(ins) && INS_Opcode(ins) == XO(ADD);
+}
+
+bool Decoder::isCoupUpdate(INS ins, const CoupAutoFilter* coupAuto) {
+    //The atomic baseline decodes and instruments them like any other locked RMW (see decodeInstr)
+    if (zinfo->coupMode == COUP_MODE_ATOMIC) return false;
+    if (isCoupTagged(ins)) return true;
+    return coupAuto && autoCoupOp(ins) != COUP_NONE && coupAuto->allows(ins);
+}
+
+/* In automatic COUP mode (see coup_auto.h), untagged lock-prefixed commutative RMWs to memory are updates too,
+ * as long as nothing uses their results: the flags, and for XADD, the old value returned in the register.
+ * RMWs that leave memory unchanged (e.g., lock orq $0x0,(%rsp), GCC's seq_cst fence) are there for their
+ * fence, and stack lines are thread-private, so neither is ever an update.
+ */
+CoupOp Decoder::autoCoupOp(INS ins) {
+    CoupOp op = rmwCoupOp(ins);
+    if (op == COUP_NONE) return COUP_NONE;
+    REG baseReg = INS_OperandMemoryBaseReg(ins, 0);
+    if (REG_valid(baseReg) && REG_FullRegName(baseReg) == REG_RSP) return COUP_NONE;
+    if (INS_OperandCount(ins) > 1 && INS_OperandIsImmediate(ins, 1)) {
+        uint32_t bits = 8*INS_MemoryOperandSize(ins, 0);
+        uint64_t mask = (bits >= 64)? ~0ul : ((1ul << bits) - 1);
+        uint64_t imm = ((uint64_t) INS_OperandImmediate(ins, 1)) & mask;
+        if (imm == ((op == COUP_AND)? mask : 0)) return COUP_NONE; //identity
+    }
+    if (!isDeadAfter(ins, REG_RFLAGS)) return COUP_NONE;
+    if (INS_Opcode(ins) == XO(XADD) && !(INS_OperandIsReg(ins, 1) && isDeadAfter(ins, INS_OperandReg(ins, 1)))) return COUP_NONE;
+    return op;
+}
+
+CoupOp Decoder::rmwCoupOp(INS ins) {
+    if (!INS_LockPrefix(ins) || !INS_IsMemoryRead(ins) || !INS_IsMemoryWrite(ins) || !INS_OperandIsMemory(ins, 0)) return COUP_NONE;
+    switch (INS_Opcode(ins)) {
+        case XO(ADD):
+        case XO(INC):
+        case XO(DEC):
+        case XO(XADD):
+            return COUP_ADD;
+        case XO(AND):
+            return COUP_AND;
+        case XO(OR):
+            return COUP_OR;
+        case XO(XOR):
+            return COUP_XOR;
+        default:
+            return COUP_NONE;
+    }
+}
+
+// Flags ins writes (as a xed_flag_set_t bitmask); if mustWrite, only those it always writes
+static uint32_t writtenFlags(INS ins, bool mustWrite) {
+    const xed_simple_flag_t* flagInfo = xed_decoded_inst_get_rflags_info(INS_XedDec(ins));
+    if (!flagInfo || (mustWrite && xed_simple_flag_get_may_write(flagInfo))) return 0;
+    return xed_simple_flag_get_written_flag_set(flagInfo)->flat;
+}
+
+/* True if reg is overwritten before it is read in the rest of the BBL. We only look at full registers, so a
+ * partial write (e.g., to %al) counts as a full one; compilers don't rely on the upper bits of an atomic's
+ * result this way. Flags are different: they are only dead after an instruction that writes all the ones ins
+ * writes (e.g., not INC or DEC after ADD, as they leave CF). The flags are also dead at calls and returns, as
+ * the ABI does not preserve them. If the BBL ends otherwise, we conservatively assume reg is live.
+ */
+bool Decoder::isDeadAfter(INS ins, REG reg) {
+    reg = REG_FullRegName(reg);
+    for (INS next = INS_Next(ins); INS_Valid(next); next = INS_Next(next)) {
+        Instr instr(next);
+        for (uint32_t i = 0; i < instr.numInRegs; i++) if (instr.inRegs[i] == reg) return false;
+        //Instr does not include the base and index registers of memory operands
+        for (uint32_t op = 0; op < INS_OperandCount(next); op++) {
+            if (!INS_OperandIsMemory(next, op)) continue;
+            REG baseReg = INS_OperandMemoryBaseReg(next, op);
+            REG indexReg = INS_OperandMemoryIndexReg(next, op);
+            if ((REG_valid(baseReg) && REG_FullRegName(baseReg) == reg) || (REG_valid(indexReg) && REG_FullRegName(indexReg) == reg)) return false;
+        }
+        for (uint32_t i = 0; i < instr.numOutRegs; i++) {
+            if (instr.outRegs[i] != reg) continue;
+            if (reg != REG_RFLAGS) return true;
+            uint32_t flags = writtenFlags(ins, false);
+            return (writtenFlags(next, true) & flags) == flags;
+        }
+        if (reg == REG_RFLAGS && (INS_IsCall(next) || INS_IsRet(next))) return true;
+    }
+    return false;
+}
+
+void Decoder::decodeCoupUpdate(INS ins, DynUopVec& uops) {
+    Instr instr(ins);
+    assert(instr.numLoads == 1);
+    uint32_t op = instr.loadOps[0];
+    uint32_t indexReg = INS_OperandMemoryIndexReg(ins, op);
+    bool remote = zinfo->coupMode == COUP_MODE_REMOTE;
+    if (remote) emitFence(uops, 0); //same fences as decodeInstr's locked instructions
+
+    DynUop uop;
+    uop.clear();
+    uop.rs[0] = INS_OperandMemoryBaseReg(ins, op);
+    //Only 2 sources; the update value (if it's in a register) is usually more critical than an index register
+    bool regValue = INS_Opcode(ins) != XO(INC) && INS_Opcode(ins) != XO(DEC) && INS_OperandIsReg(ins, 1);
+    uop.rs[1] = regValue? REG_FullRegName(INS_OperandReg(ins, 1)) : indexReg;
+    uop.rd[0] = 0; //no destination, nothing waits for it
+    uop.type = UOP_COUP_UPDATE;
+    uop.portMask = PORT_2;
+    uops.push_back(uop);
+    if (remote) emitFence(uops, 9);
+}
+
 // See Agner Fog's uarch doc, macro-op fusion for Core 2 / Nehalem
 bool Decoder::canFuse(INS ins) {
     xed_iclass_enum_t opcode = (xed_iclass_enum_t) INS_Opcode(ins);
@@ -1297,7 +1415,7 @@ static std::vector<uint32_t>* bblApproxOpcodes[MAX_BBLS];
 
 #endif
 
-BblInfo* Decoder::decodeBbl(BBL bbl, bool oooDecoding) {
+BblInfo* Decoder::decodeBbl(BBL bbl, bool oooDecoding, const CoupAutoFilter* coupAuto) {
     uint32_t instrs = BBL_NumIns(bbl);
     uint32_t bytes = BBL_Size(bbl);
     BblInfo* bblInfo;
@@ -1329,7 +1447,16 @@ BblInfo* Decoder::decodeBbl(BBL bbl, bool oooDecoding) {
         for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
             bool inaccurate = false;
             uint32_t prevUops = uopVec.size();
-            if (Decoder::canFuse(ins)) {
+            if (Decoder::isCoupUpdate(ins, coupAuto)) {
+                Decoder::decodeCoupUpdate(ins, uopVec);
+
+                instrAddr.push_back(INS_Address(ins));
+                instrBytes.push_back(INS_Size(ins));
+                instrUops.push_back(uopVec.size() - prevUops);
+                instrDesc.push_back(ins);
+
+                curIns++;
+            } else if (Decoder::canFuse(ins)) {
                 inaccurate = Decoder::decodeFusedInstrs(ins, uopVec);
                 instrAddr.push_back(INS_Address(ins));
                 instrBytes.push_back(INS_Size(ins));
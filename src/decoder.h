@@ -28,6 +28,7 @@
 
 #include <stdint.h>
 #include <vector>
+#include "memory_hierarchy.h"
 #include "pin.H"
 
 // Uncomment to get a count of BBLs run. This is currently used to get a distribution of inaccurate instructions decoded that are actually run
@@ -42,7 +43,7 @@
 /* NOTE this uses stronly typed enums, a C++11 feature. This saves a bunch of typecasts while keeping UopType enums 1-byte long.
  * If you use gcc < 4.6 or some other compiler, either go back to casting or lose compactness in the layout.
  */
-enum UopType : uint8_t {UOP_GENERAL, UOP_LOAD, UOP_STORE, UOP_STORE_ADDR, UOP_FENCE};
+enum UopType : uint8_t {UOP_GENERAL, UOP_LOAD, UOP_STORE, UOP_STORE_ADDR, UOP_FENCE, UOP_COUP_UPDATE};
 
 struct DynUop {
     uint16_t rs[MAX_UOP_SRC_REGS];
@@ -78,6 +79,7 @@ struct DynBbl {
 };
 
 struct BblInfo;  // defined in core.h
+class CoupAutoFilter;  // defined in coup_auto.h
 
 /* These are absolute maximums per instruction. If there is some non-conforming instruction, either increase these limits or
  * treat it as a special case.
@@ -126,7 +128,17 @@ class Decoder {
 
     public:
         //If oooDecoding is true, produces a DynBbl with DynUops that can be used in OOO cores
-        static BblInfo* decodeBbl(BBL bbl, bool oooDecoding);
+        //coupAuto is the process's automatic COUP filter (nullptr if disabled)
+        static BblInfo* decodeBbl(BBL bbl, bool oooDecoding, const CoupAutoFilter* coupAuto);
+
+        //True for COUP updates: lock-prefixed adds tagged by the COUP magic op right before them, and in automatic
+        //mode, lock-prefixed commutative RMWs with unused results that coupAuto allows. Never with sys.coupMode = Atomic.
+        static bool isCoupUpdate(INS ins, const CoupAutoFilter* coupAuto);
+        static bool isCoupTagged(INS ins);
+        //Operator of an automatic COUP update, COUP_NONE if ins does not qualify
+        static CoupOp autoCoupOp(INS ins);
+        //Operator the lock-prefixed RMW ins performs on memory, COUP_NONE if it is not a commutative one
+        static CoupOp rmwCoupOp(INS ins);
 
 #ifdef BBL_PROFILING
         static void profileBbl(uint64_t bblIdx);
@@ -136,6 +148,8 @@ class Decoder {
     private:
         //Return true if inaccurate decoding, false if accurate
         static bool decodeInstr(INS ins, DynUopVec& uops);
+        static void decodeCoupUpdate(INS ins, DynUopVec& uops);
+        static bool isDeadAfter(INS ins, REG reg);
 
         /* Every emit function can produce 0 or more uops; it returns the number of uops. These are basic templates to make our life easier */
 
@@ -0,0 +1,111 @@
+/* Decoder for coherence event traces (see coherence_events.h)
+ *
+ * Prints one event per line, or with -t, the number of times each
+ * (cache, event, old state -> new state) transition happened.
+ */
+
+#include <algorithm>
+#include <getopt.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "coherence_events.h"
+#include "log.h"
+#include "memory_hierarchy.h"  // to translate types and states to strings
+
+static void usage(const char* prog) {
+    info("Prints a coherence event trace");
+    info("Usage: %s [-s] [-t] [-l <lineAddr>] [-c <cache>] <trace>", prog);
+    info("  -s: sort events by cycle (files interleave requesters in chunks)");
+    info("  -t: print a summary of state transitions instead of events");
+    info("  -l: only events on this line address");
+    info("  -c: only events of this cache (name)");
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    InitLog(""); //no log header
+    bool sortEvents = false;
+    bool summary = false;
+    bool filterLine = false;
+    uint64_t lineAddr = 0;
+    const char* cacheFilter = nullptr;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "stl:c:h")) != -1) {
+        switch (opt) {
+            case 's': sortEvents = true; break;
+            case 't': summary = true; break;
+            case 'l': filterLine = true; lineAddr = strtoull(optarg, nullptr, 0); break;
+            case 'c': cacheFilter = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) usage(argv[0]);
+
+    FILE* f = fopen(argv[optind], "r");
+    if (!f) panic("Could not open %s", argv[optind]);
+
+    char magic[sizeof(COH_EV_MAGIC)];
+    uint32_t numCaches;
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, COH_EV_MAGIC, sizeof(magic)) != 0) {
+        panic("%s is not a coherence event trace", argv[optind]);
+    }
+    if (fread(&numCaches, sizeof(numCaches), 1, f) != 1) panic("Truncated header");
+    std::vector<std::string> cacheNames;
+    for (uint32_t i = 0; i < numCaches; i++) {
+        uint16_t len;
+        if (fread(&len, sizeof(len), 1, f) != 1) panic("Truncated header");
+        std::string name(len, ' ');
+        if (len && fread(&name[0], len, 1, f) != 1) panic("Truncated header");
+        cacheNames.push_back(name);
+    }
+
+    int32_t cacheId = -1;
+    if (cacheFilter) {
+        auto it = std::find(cacheNames.begin(), cacheNames.end(), std::string(cacheFilter));
+        if (it == cacheNames.end()) panic("No cache %s in trace", cacheFilter);
+        cacheId = it - cacheNames.begin();
+    }
+
+    std::vector<CohEvent> events;
+    CohEvent ev;
+    while (fread(&ev, sizeof(ev), 1, f) == 1) {
+        if (ev.cache >= numCaches) panic("Corrupted trace, event with cache %d (%d caches)", ev.cache, numCaches);
+        if (filterLine && ev.lineAddr != lineAddr) continue;
+        if (cacheId >= 0 && ev.cache != cacheId) continue;
+        events.push_back(ev);
+    }
+    fclose(f);
+
+    if (sortEvents) {
+        //stable, so events of each requester stay in order
+        std::stable_sort(events.begin(), events.end(), [](const CohEvent& a, const CohEvent& b) { return a.cycle < b.cycle; });
+    }
+
+    if (summary) {
+        typedef std::tuple<uint16_t, uint8_t, uint8_t, uint8_t> Transition;  // cache, kind, old, new
+        std::map<Transition, uint64_t> counts;
+        for (const CohEvent& e : events) counts[std::make_tuple(e.cache, e.kind, e.oldState, e.newState)]++;
+        info("%-20s %6s %4s    %4s %12s", "Cache", "Event", "Old", "New", "Count");
+        for (auto& c : counts) {
+            info("%-20s %6s %4s -> %4s %12ld", cacheNames[std::get<0>(c.first)].c_str(), CohEventKindName(std::get<1>(c.first)),
+                    MESIStateName((MESIState)std::get<2>(c.first)), MESIStateName((MESIState)std::get<3>(c.first)), c.second);
+        }
+        info("%ld events", events.size());
+        return 0;
+    }
+
+    info("%12s %-20s %6s %6s %20s %4s    %4s %6s", "Cycle", "Cache", "Src", "Event", "LineAddr", "Old", "New", "Op");
+    for (const CohEvent& e : events) {
+        info("%12ld %-20s %6d %6s %20p %4s -> %4s %6s", e.cycle, cacheNames[e.cache].c_str(), e.srcId, CohEventKindName(e.kind),
+                (uint64_t*)e.lineAddr, MESIStateName((MESIState)e.oldState), MESIStateName((MESIState)e.newState), CoupOpName((CoupOp)e.coupOp));
+    }
+
+    return 0;
+}
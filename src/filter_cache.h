@@ -60,8 +60,7 @@ class FilterCache : public Cache {
 
         lock_t filterLock;
         uint64_t fGETSHit, fGETXHit;
-
-        bool coup;
+        uint64_t fVecLines, fVecLanes;
 
     public:
         FilterCache(uint32_t _numSets, uint32_t _numLines, CC* _cc, CacheArray* _array,
@@ -74,9 +73,9 @@ class FilterCache : public Cache {
             for (uint32_t i = 0; i < numSets; i++) filterArray[i].clear();
             futex_init(&filterLock);
             fGETSHit = fGETXHit = 0;
+            fVecLines = fVecLanes = 0;
             srcId = -1;
             reqFlags = 0;
-            coup = false;
         }
 
         void setSourceId(uint32_t id) {
@@ -87,8 +86,6 @@ class FilterCache : public Cache {
             reqFlags = flags;
         }
 
-        void setCoup(bool flag) { coup = flag; }
-
         void initStats(AggregateStat* parentStat) {
             AggregateStat* cacheStat = new AggregateStat();
             cacheStat->init(name.c_str(), "Filter cache stats");
@@ -99,6 +96,12 @@ class FilterCache : public Cache {
             fgetxStat->init("fhGETX", "Filtered GETX hits", &fGETXHit);
             cacheStat->append(fgetsStat);
             cacheStat->append(fgetxStat);
+            ProxyStat* vecLinesStat = new ProxyStat();
+            vecLinesStat->init("vecLines", "Vector updates (one per line)", &fVecLines);
+            ProxyStat* vecLanesStat = new ProxyStat();
+            vecLanesStat->init("vecLanes", "Lanes updated by vector updates", &fVecLanes);
+            cacheStat->append(vecLinesStat);
+            cacheStat->append(vecLanesStat);
 
             initCacheStats(cacheStat);
             parentStat->append(cacheStat);
@@ -112,7 +115,7 @@ class FilterCache : public Cache {
                 fGETSHit++;
                 return MAX(curCycle, availCycle);
             } else {
-                return replace(vLineAddr, idx, true, curCycle);
+                return replace(vLineAddr, idx, true, curCycle, COUP_NONE, 1UL << wordIdx(vAddr));
             }
         }
 
@@ -130,24 +133,79 @@ class FilterCache : public Cache {
             }
         }
 
-        uint64_t replace(Address vLineAddr, uint32_t idx, bool isLoad, uint64_t curCycle) {
+        //Commutative updates always go through the cache, the controller checks the line's U operator
+        //(unless sys.coupMode performs them as remote atomics). With plain atomics, scalar updates are instrumented
+        //as regular locked RMWs (see Decoder::isCoupUpdate), so only vector updates become stores.
+        inline uint64_t coupUpdate(Address vAddr, uint64_t curCycle, CoupOp op) {
+            if (op == COUP_NONE) return load(vAddr, curCycle);
+            if (zinfo->coupMode == COUP_MODE_ATOMIC) return store(vAddr, curCycle);
+            Address vLineAddr = vAddr >> lineBits;
+            if (zinfo->coupMode == COUP_MODE_REMOTE) return remoteAtomic(vLineAddr, vLineAddr & setMask, curCycle, op);
+            return replace(vLineAddr, vLineAddr & setMask, true, curCycle, op, 1UL << wordIdx(vAddr));
+        }
+
+        //Vector updates issue a single update for all the lanes they touch in a line (words is their 64-bit word mask);
+        //remote atomics charge the home's reduction unit for all the words
+        uint64_t coupVectorUpdate(Address vAddr, uint64_t curCycle, CoupOp op, uint32_t lanes, uint64_t words) {
+            fVecLines++;
+            fVecLanes += lanes;
+            if (zinfo->coupMode == COUP_MODE_ATOMIC) return store(vAddr, curCycle);
+            Address vLineAddr = vAddr >> lineBits;
+            if (zinfo->coupMode == COUP_MODE_REMOTE) return remoteAtomic(vLineAddr, vLineAddr & setMask, curCycle, op, __builtin_popcountl(words));
+            return replace(vLineAddr, vLineAddr & setMask, true, curCycle, op, words);
+        }
+
+        //Remote atomics don't bring the line; the home bank takes our copy away, so stop filtering it
+        uint64_t remoteAtomic(Address vLineAddr, uint32_t idx, uint64_t curCycle, CoupOp coupOp, uint32_t updateWords = 0) {
             Address pLineAddr = procMask | vLineAddr;
             MESIState dummyState = MESIState::I;
             futex_lock(&filterLock);
-            if(coup) info("coup replace\n");
-            MemReq req = {pLineAddr, isLoad? coup? GETU : GETS : GETX, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags};
-            uint64_t respCycle  = access(req);
-            if(coup) info("req.type = %d\n", req.type);
-            
+            MemReq req = {pLineAddr, RATOM, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags, coupOp, nullptr, updateWords};
+            uint64_t respCycle = access(req);
+            if (filterArray[idx].rdAddr == vLineAddr) {
+                filterArray[idx].wrAddr = -1L;
+                filterArray[idx].rdAddr = -1L;
+            }
+            futex_unlock(&filterLock);
+            return respCycle;
+        }
+
+        //Reduction flushes (coup_flush) don't bring the line either, and U lines are never filtered, so nothing to drop
+        uint64_t coupFlush(Address vLineAddr, uint64_t curCycle) {
+            if (zinfo->coupMode != COUP_MODE_COUP) return curCycle; //no U lines to reduce
+            Address pLineAddr = procMask | vLineAddr;
+            MESIState dummyState = MESIState::I;
+            futex_lock(&filterLock);
+            MemReq req = {pLineAddr, RFLUSH, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags};
+            uint64_t respCycle = access(req);
+            futex_unlock(&filterLock);
+            return respCycle;
+        }
+
+        //With word masks, loads and updates only ask for the 64-bit word they access
+        inline uint32_t wordIdx(Address vAddr) const {
+            return (vAddr & ((1UL << lineBits) - 1)) >> 3;
+        }
 
-            coup = false;
+        uint64_t replace(Address vLineAddr, uint32_t idx, bool isLoad, uint64_t curCycle, CoupOp coupOp = COUP_NONE, uint64_t wordsTouched = 1) {
+            Address pLineAddr = procMask | vLineAddr;
+            MESIState dummyState = MESIState::I;
+            futex_lock(&filterLock);
+            bool isCoup = coupOp != COUP_NONE;
+            uint64_t words = wordsTouched; //on GETS, the cache replies with the words we can read
+            MemReq req = {pLineAddr, isCoup? GETU : isLoad? GETS : GETX, 0, &dummyState, curCycle, &filterLock, dummyState, srcId, reqFlags, coupOp,
+                          (zinfo->coupWordMasks && isLoad)? &words : nullptr};
+            uint64_t respCycle  = access(req);
 
             //Due to the way we do the locking, at this point the old address might be invalidated, but we have the new address guaranteed until we release the lock
 
             //Careful with this order
+            //U lines are never filtered: reads must reduce them, and updates must check their operator
+            //Partially readable lines aren't either, since other words of the line may be U elsewhere
+            bool partial = zinfo->coupWordMasks && isLoad && !isCoup && words != ALL_WORDS;
             Address oldAddr = filterArray[idx].rdAddr;
             filterArray[idx].wrAddr = isLoad? -1L : vLineAddr;
-            filterArray[idx].rdAddr = vLineAddr;
+            filterArray[idx].rdAddr = (isCoup || partial)? -1L : vLineAddr;
 
             //For LSU simulation purposes, loads bypass stores even to the same line if there is no conflict,
             //(e.g., st to x, ld from x+8) and we implement store-load forwarding at the core.
@@ -198,6 +198,15 @@ void gm_stats() {
     mspace_malloc_stats(GM->mspace_ptr);
 }
 
+size_t gm_in_use() {
+    assert(GM);
+    //The mspace's footprint is the whole segment (it is created with a fixed base), so walk its chunks instead
+    futex_lock(&GM->lock);
+    struct mallinfo mi = mspace_mallinfo(GM->mspace_ptr);
+    futex_unlock(&GM->lock);
+    return mi.uordblks;
+}
+
 bool gm_isready() {
     assert(GM);
     return (GM->base_regp != nullptr);
@@ -60,6 +60,7 @@ void gm_set_secondary_ptr(void* ptr);
 void* gm_get_secondary_ptr();
 
 void gm_stats();
+size_t gm_in_use(); //bytes of the global heap allocated (not the segment size, gmMBytes), i.e., host memory of the simulated system; walks the heap
 
 bool gm_isready();
 void gm_detach();
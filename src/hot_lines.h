@@ -0,0 +1,255 @@
+#ifndef HOT_LINES_H
+#define HOT_LINES_H
+
+#include <algorithm>
+#include <string>
+#include "g_std/g_unordered_map.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "locks.h"
+#include "log.h"
+#include "memory_hierarchy.h"
+#include "stats.h"
+
+/* Hot-line profiler of a cache group (sys.caches.<grp>.hotLines = K).
+ *
+ * Finds the lines that cause the most coherence traffic, so we know which
+ * data structures to convert to COUP, without tracing every access. Each bank
+ * of the group tracks the top K lines of three kinds of events:
+ *  - inv: invalidations and downgrades the group's caches received (INV or
+ *    INVX on a valid line, including inclusion victims),
+ *  - red: reductions, i.e., U lines invalidated (the cache sends its partial
+ *    update up),
+ *  - upg: upgrade misses (GETX on S or U lines, GETU on S lines).
+ *
+ * Each kind uses the Space-Saving algorithm: K (line, count, error) entries,
+ * kept sorted by count, with a hash index from line to entry. A line not in
+ * the table replaces the last entry and inherits its count as the error, so
+ * counts never underestimate a line's events, and overestimate them by at most
+ * err. Each entry also records the last core that requested the line. Requests
+ * do not carry PCs, so lines cannot be attributed to instructions.
+ *
+ * Banks record into their own tables (under their own lock), so the profiler
+ * does not serialize the group. Tables are merged into the group's top K when
+ * stats are dumped, in <grp>Hot.<kind>: line addresses, counts, errors and
+ * requesters, sorted by count.
+ */
+
+enum HotLineEvent {
+    HOT_INV,
+    HOT_RED,
+    HOT_UPG,
+    HOT_NUM_EVENTS, // not an event, keep last
+};
+
+struct HotLineEntry {
+    Address lineAddr;
+    uint64_t count;
+    uint64_t err;
+    uint32_t srcId;
+};
+
+/* Space-Saving table of one bank and kind of event */
+class HotLineTracker : public GlobAlloc {
+    private:
+        HotLineEntry* entries; //sorted by decreasing count
+        g_unordered_map<Address, uint32_t> index; //lineAddr -> entry
+        uint32_t size; //entries in use
+        const uint32_t max;
+        lock_t lock; //only taken by this bank (and the stats dump)
+
+        inline void swap(uint32_t i, uint32_t j) {
+            HotLineEntry tmp = entries[i];
+            entries[i] = entries[j];
+            entries[j] = tmp;
+            index[entries[i].lineAddr] = i;
+            index[entries[j].lineAddr] = j;
+        }
+
+    public:
+        explicit HotLineTracker(uint32_t k) : size(0), max(k) {
+            entries = gm_calloc<HotLineEntry>(max);
+            index.reserve(2*max);
+            futex_init(&lock);
+        }
+
+        void record(Address lineAddr, uint32_t srcId) {
+            futex_lock(&lock);
+            uint32_t i;
+            g_unordered_map<Address, uint32_t>::iterator it = index.find(lineAddr);
+            if (it != index.end()) {
+                i = it->second;
+            } else if (size < max) {
+                i = size++;
+                entries[i] = {lineAddr, 0, 0, srcId};
+                index[lineAddr] = i;
+            } else {
+                i = max - 1; //replace the least frequent line
+                index.erase(entries[i].lineAddr);
+                entries[i] = {lineAddr, entries[i].count, entries[i].count, srcId};
+                index[lineAddr] = i;
+            }
+            HotLineEntry& e = entries[i];
+            e.count++;
+            e.srcId = srcId;
+            //Keep the table sorted; ties keep the incumbent first
+            while (i > 0 && entries[i-1].count < entries[i].count) {
+                swap(i-1, i);
+                i--;
+            }
+            futex_unlock(&lock);
+        }
+
+        /* Copies the table to buf (max entries). Returns the number of
+         * entries, and the count any untracked line may have reached.
+         */
+        uint32_t snapshot(HotLineEntry* buf, uint64_t& untrackedMax) {
+            futex_lock(&lock);
+            uint32_t n = size;
+            for (uint32_t i = 0; i < n; i++) buf[i] = entries[i];
+            untrackedMax = (size == max)? entries[max-1].count : 0;
+            futex_unlock(&lock);
+            return n;
+        }
+};
+
+/* Per-bank profiler; caches record their events here */
+class HotLineProfiler : public GlobAlloc {
+    private:
+        HotLineTracker* trackers[HOT_NUM_EVENTS];
+
+    public:
+        explicit HotLineProfiler(uint32_t k) {
+            for (uint32_t e = 0; e < HOT_NUM_EVENTS; e++) trackers[e] = new HotLineTracker(k);
+        }
+
+        inline void record(HotLineEvent ev, Address lineAddr, uint32_t srcId) {
+            trackers[ev]->record(lineAddr, srcId);
+        }
+
+        HotLineTracker* getTracker(HotLineEvent ev) const { return trackers[ev]; }
+};
+
+/* Group-wide view of one kind of event: merges the banks' tables into the top K */
+class HotLineMerger : public GlobAlloc {
+    private:
+        struct Acc {
+            uint64_t count;
+            uint64_t err;
+            uint64_t untrackedSeen; //sum of untrackedMax of the full tables that track this line
+            uint32_t srcId;
+            uint64_t srcCount; //count of the bank srcId comes from
+        };
+
+        g_vector<HotLineTracker*> shards;
+        HotLineEntry* merged;
+        HotLineEntry* buf;
+        uint32_t size;
+        const uint32_t max;
+
+        static bool before(const HotLineEntry& a, const HotLineEntry& b) {
+            return (a.count != b.count)? a.count > b.count : a.lineAddr < b.lineAddr;
+        }
+
+        /* Space-Saving tables are mergeable: sum each line's counts and errors
+         * across banks, and for every full table that does not track the line,
+         * add that table's minimum count to both (the line may have reached it
+         * there). Counts remain upper bounds, and err keeps bounding the
+         * overestimation.
+         */
+        void merge() {
+            g_unordered_map<Address, Acc> acc;
+            uint64_t untrackedTotal = 0;
+            for (HotLineTracker* t : shards) {
+                uint64_t untrackedMax;
+                uint32_t n = t->snapshot(buf, untrackedMax);
+                untrackedTotal += untrackedMax;
+                for (uint32_t i = 0; i < n; i++) {
+                    const HotLineEntry& e = buf[i];
+                    Acc& a = acc[e.lineAddr]; //value-initialized on insertion
+                    a.count += e.count;
+                    a.err += e.err;
+                    a.untrackedSeen += untrackedMax;
+                    if (e.count > a.srcCount) {
+                        a.srcCount = e.count;
+                        a.srcId = e.srcId;
+                    }
+                }
+            }
+
+            g_vector<HotLineEntry> all;
+            all.reserve(acc.size());
+            for (auto& it : acc) {
+                const Acc& a = it.second;
+                uint64_t missed = untrackedTotal - a.untrackedSeen;
+                all.push_back({it.first, a.count + missed, a.err + missed, a.srcId});
+            }
+            size = std::min((uint32_t)all.size(), max);
+            std::partial_sort(all.begin(), all.begin() + size, all.end(), before);
+            for (uint32_t i = 0; i < size; i++) merged[i] = all[i];
+        }
+
+        //Stats are dumped entry by entry, so re-merge when each one starts
+        inline const HotLineEntry* get(uint32_t i) {
+            if (i == 0) merge();
+            return (i < size)? &merged[i] : nullptr;
+        }
+
+    public:
+        explicit HotLineMerger(uint32_t k) : size(0), max(k) {
+            merged = gm_calloc<HotLineEntry>(max);
+            buf = gm_calloc<HotLineEntry>(max);
+        }
+
+        void addShard(HotLineTracker* t) { shards.push_back(t); }
+
+        void initStats(AggregateStat* parentStat, const char* name, const char* desc) {
+            AggregateStat* tStat = new AggregateStat();
+            tStat->init(name, desc);
+            auto lineStat = makeLambdaVectorStat([this](uint32_t i) { const HotLineEntry* e = get(i); return e? e->lineAddr : 0; }, max);
+            lineStat->init("line", "Line addresses, by decreasing count");
+            auto countStat = makeLambdaVectorStat([this](uint32_t i) { const HotLineEntry* e = get(i); return e? e->count : 0; }, max);
+            countStat->init("count", "Events (upper bound)");
+            auto errStat = makeLambdaVectorStat([this](uint32_t i) { const HotLineEntry* e = get(i); return e? e->err : 0; }, max);
+            errStat->init("err", "Maximum overestimation of count");
+            auto srcStat = makeLambdaVectorStat([this](uint32_t i) { const HotLineEntry* e = get(i); return e? (uint64_t)e->srcId : 0; }, max);
+            srcStat->init("src", "Last requester (core) in the bank with most events; requests carry no PC, so no per-PC attribution");
+            tStat->append(lineStat);
+            tStat->append(countStat);
+            tStat->append(errStat);
+            tStat->append(srcStat);
+            parentStat->append(tStat);
+        }
+};
+
+/* Hot-line profiler of a cache group: hands out per-bank profilers, and
+ * merges their tables when stats are dumped.
+ */
+class HotLineGroup : public GlobAlloc {
+    private:
+        const uint32_t k;
+        HotLineMerger* mergers[HOT_NUM_EVENTS];
+
+    public:
+        explicit HotLineGroup(uint32_t _k) : k(_k) {
+            if (!k) panic("Hot-line profiler needs at least one entry");
+            for (uint32_t e = 0; e < HOT_NUM_EVENTS; e++) mergers[e] = new HotLineMerger(k);
+        }
+
+        HotLineProfiler* addBank() {
+            HotLineProfiler* p = new HotLineProfiler(k);
+            for (uint32_t e = 0; e < HOT_NUM_EVENTS; e++) mergers[e]->addShard(p->getTracker((HotLineEvent)e));
+            return p;
+        }
+
+        void initStats(AggregateStat* parentStat, const char* group) {
+            AggregateStat* hotStat = new AggregateStat();
+            hotStat->init(gm_strdup((std::string(group) + "Hot").c_str()), "Hot-line profiler stats");
+            mergers[HOT_INV]->initStats(hotStat, "inv", "Lines most invalidated or downgraded");
+            mergers[HOT_RED]->initStats(hotStat, "red", "Lines most reduced");
+            mergers[HOT_UPG]->initStats(hotStat, "upg", "Lines with most upgrade misses");
+            parentStat->append(hotStat);
+        }
+};
+
+#endif  // HOT_LINES_H
@@ -25,6 +25,7 @@
  */
 
 #include "init.h"
+#include <functional>
 #include <list>
 #include <sstream>
 #include <stdlib.h>
@@ -38,6 +39,8 @@
 #include "contention_sim.h"
 #include "core.h"
 #include "coup_cc.h"
+#include "coup_repl_policy.h"
+#include "coup_shadow.h"
 #include "detailed_mem.h"
 #include "detailed_mem_params.h"
 #include "ddr_mem.h"
@@ -61,9 +64,11 @@
 #include "process_stats.h"
 #include "process_tree.h"
 #include "profile_stats.h"
+#include "reduction_unit.h"
 #include "repl_policies.h"
 #include "scheduler.h"
 #include "simple_core.h"
+#include "socket_directory.h"
 #include "stats.h"
 #include "stats_filter.h"
 #include "str.h"
@@ -83,7 +88,7 @@ extern void EndOfPhaseActions(); //in zsim.cpp
  * follow the layout of zinfo, top-down.
  */
 
-BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name, uint32_t bankSize, bool isTerminal, uint32_t domain) {
+BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name, uint32_t bankSize, bool isTerminal, bool isLLC, uint32_t domain) {
     string type = config.get<const char*>(prefix + "type", "Simple");
     // Shortcut for TraceDriven type
     if (type == "TraceDriven") {
@@ -146,7 +151,24 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
     string replType = config.get<const char*>(prefix + "repl.type", (arrayType == "IdealLRUPart")? "IdealLRUPart" : "LRU");
     ReplPolicy* rp = nullptr;
 
-    if (replType == "LRU" || replType == "LRUNoSh") {
+    bool coupAware = config.get<bool>(prefix + "repl.coupAware", false);
+    if (coupAware) {
+        //Priorities may be negative (config ints are signed)
+        int32_t livePrio = (int32_t)config.get<uint32_t>(prefix + "repl.coupLivePrio", 2);
+        int32_t deadPrio = (int32_t)config.get<uint32_t>(prefix + "repl.coupDeadPrio", 0);
+        uint64_t liveWindow = config.get<uint64_t>(prefix + "repl.coupLiveWindow", numLines);
+        if (replType == "LRU" && !isTerminal) {
+            rp = new CoupReplPolicy< LRUReplPolicy<true> >(numLines, candidates, livePrio, deadPrio, liveWindow, numLines);
+        } else if (replType == "LRU" || replType == "LRUNoSh") {
+            rp = new CoupReplPolicy< LRUReplPolicy<false> >(numLines, candidates, livePrio, deadPrio, liveWindow, numLines);
+        } else if (replType == "LFU") {
+            rp = new CoupReplPolicy<LFUReplPolicy>(numLines, candidates, livePrio, deadPrio, liveWindow, numLines);
+        } else if (replType == "NRU") {
+            rp = new CoupReplPolicy<NRUReplPolicy>(numLines, candidates, livePrio, deadPrio, liveWindow, numLines, candidates);
+        } else {
+            panic("%s: repl.coupAware needs an LRU, LRUNoSh, LFU or NRU repl.type, not %s", name.c_str(), replType.c_str());
+        }
+    } else if (replType == "LRU" || replType == "LRUNoSh") {
         bool sharersAware = (replType == "LRU") && !isTerminal;
         if (sharersAware) {
             rp = new LRUReplPolicy<true>(numLines);
@@ -260,13 +282,79 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
     bool nonInclusiveHack = config.get<bool>(prefix + "nonInclusiveHack", false);
     if (nonInclusiveHack) assert(type == "Simple" && !isTerminal);
 
+    //Coherence protocol: MEUSI (MESI + COUP's U state), or the original MESI as a baseline
+    string protocol = config.get<const char*>(prefix + "protocol", "MEUSI");
+    bool mesi = (protocol == "MESI");
+    if (!mesi && protocol != "MEUSI") panic("%s: Invalid protocol %s (MESI or MEUSI)", name.c_str(), protocol.c_str());
+    if (mesi && (zinfo->coupMode != COUP_MODE_ATOMIC || zinfo->coupWordMasks)) {
+        panic("%s: MESI caches have no U state or remote atomics, use sys.coupMode = Atomic without sys.coupWordMasks", name.c_str());
+    }
+
     // Finally, build the cache
     Cache* cache;
     CC* cc;
+    ReductionUnit* redUnit = nullptr;
     if (isTerminal) {
-        cc = new MEUSITerminalCC(numLines, name);
+        if (mesi) cc = new MESITerminalCC(numLines, name);
+        else cc = new MEUSITerminalCC(numLines, name);
     } else {
-        cc = new MEUSICC(numLines, nonInclusiveHack, name);
+        //Reduction unit that merges COUP partial updates (by default, one full-line merge per cycle)
+        if (!mesi) {
+            uint32_t redOpsPerCycle = config.get<uint32_t>(prefix + "reduction.opsPerCycle", 1);
+            uint32_t redPipelineDepth = config.get<uint32_t>(prefix + "reduction.pipelineDepth", 1);
+            uint32_t redFpPipelineDepth = config.get<uint32_t>(prefix + "reduction.fpPipelineDepth", 4);
+            uint32_t redLanes = config.get<uint32_t>(prefix + "reduction.lanes", zinfo->lineSize/8);
+            GatherTopology redGather = ParseGatherTopology(config.get<const char*>(prefix + "reduction.gather", "Parallel"));
+            uint32_t redHopMergeLat = config.get<uint32_t>(prefix + "reduction.hopMergeLat", 1);
+            redUnit = new ReductionUnit(redOpsPerCycle, redPipelineDepth, redFpPipelineDepth, redLanes, zinfo->lineSize, redGather, redHopMergeLat);
+        }
+
+        //Directory: one entry per line (Inline), or a sparse directory sized independently (entries per bank)
+        string dirType = config.get<const char*>(prefix + "directory.type", "Inline");
+        SparseDirectory* dir = nullptr;
+        uint32_t dirEntries = numLines;
+        if (dirType == "Sparse") {
+            dirEntries = config.get<uint32_t>(prefix + "directory.entries", numLines);
+            uint32_t dirWays = config.get<uint32_t>(prefix + "directory.ways", 8);
+            string dirRepl = config.get<const char*>(prefix + "directory.repl", "LRU");
+            if (dirRepl != "LRU" && dirRepl != "FewestSharers") panic("%s: Invalid directory.repl %s", name.c_str(), dirRepl.c_str());
+            if (!dirWays || dirEntries % dirWays != 0) panic("%s: Directory entries must be a multiple of directory.ways", name.c_str());
+            uint32_t dirSets = dirEntries/dirWays;
+            uint32_t dirSetBits = 31 - __builtin_clz(dirSets);
+            if ((1u << dirSetBits) != dirSets) panic("%s: Number of directory sets must be a power of two (you specified %d sets)", name.c_str(), dirSets);
+            size_t seed = _Fnv_hash_bytes(prefix.c_str(), prefix.size()+1, 0xD1EC7);
+            HashFamily* dirHf = new H3HashFamily(1, dirSetBits, 0xCAC7EAFFA1 + seed);
+            dir = new SparseDirectory(dirEntries, dirWays, dirRepl == "FewestSharers", numLines, dirHf);
+        } else if (dirType != "Inline") {
+            panic("%s: Invalid directory type %s", name.c_str(), dirType.c_str());
+        }
+        if (mesi && dir) panic("%s: Sparse directories need protocol = MEUSI", name.c_str());
+
+        //Sharer sets (see sharer_array.h); full bit vectors get large and slow with many children
+        string sharersType = config.get<const char*>(prefix + "sharers.type", "Full");
+        SharerArray* sharers;
+        if (sharersType == "Full") {
+            sharers = new SharerArray(dirEntries, SHARERS_FULL, 0);
+        } else if (sharersType == "Coarse") {
+            sharers = new SharerArray(dirEntries, SHARERS_COARSE, config.get<uint32_t>(prefix + "sharers.coarseness", 4));
+        } else if (sharersType == "LimitedPtr") {
+            sharers = new SharerArray(dirEntries, SHARERS_LIMITED, config.get<uint32_t>(prefix + "sharers.pointers", 4));
+        } else if (sharersType == "Hybrid") {
+            sharers = new SharerArray(dirEntries, SHARERS_HYBRID, config.get<uint32_t>(prefix + "sharers.pointers", 4));
+        } else {
+            panic("%s: Invalid sharers type %s", name.c_str(), sharersType.c_str());
+        }
+
+        //COUP grant predictor (see coup_predictor.h), off by default: GETUs are always granted U
+        CoupPredictor* predictor = nullptr;
+        if (config.get<bool>(prefix + "coupPredictor.enabled", false)) {
+            if (mesi) panic("%s: The COUP predictor needs protocol = MEUSI", name.c_str());
+            uint32_t predEntries = config.get<uint32_t>(prefix + "coupPredictor.entries", 4096);
+            uint32_t predBits = config.get<uint32_t>(prefix + "coupPredictor.bits", 2);
+            predictor = new CoupPredictor(predEntries, predBits);
+        }
+        if (mesi) cc = new MESICC(numLines, nonInclusiveHack, sharers, name);
+        else cc = new MEUSICC(numLines, nonInclusiveHack, redUnit, sharers, dir, predictor, isLLC, name);
     }
     rp->setCC(cc);
     if (!isTerminal) {
@@ -276,7 +364,10 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
             uint32_t mshrs = config.get<uint32_t>(prefix + "mshrs", 16);
             uint32_t tagLat = config.get<uint32_t>(prefix + "tagLat", 5);
             uint32_t timingCandidates = config.get<uint32_t>(prefix + "timingCandidates", candidates);
-            cache = new TimingCache(numLines, cc, array, rp, accLat, invLat, mshrs, tagLat, ways, timingCandidates, domain, name);
+            cache = new TimingCache(numLines, cc, array, rp, accLat, invLat, mshrs, tagLat, ways, timingCandidates, domain, redUnit, name);
+        } else if (type == "Directory") {
+            if (!isLLC) panic("%s: Directories must be the last level (the memory side of the sockets)", name.c_str());
+            cache = new SocketDirectory(numLines, cc, array, rp, accLat, invLat, name);
         } else if (type == "Tracing") {
             g_string traceFile = config.get<const char*>(prefix + "traceFile","");
             if (traceFile.empty()) traceFile = g_string(zinfo->outputDir) + "/" + name + ".trace";
@@ -291,6 +382,19 @@ BaseCache* BuildCacheBank(Config& config, const string& prefix, g_string& name,
         cache = new FilterCache(numSets, numLines, cc, array, rp, accLat, invLat, name);
     }
 
+    //Coherence event trace (see coherence_events.h), shared by all caches that record events
+    if (config.get<bool>(prefix + "traceEvents", false)) {
+        //Buffers are per core; trace-driven requesters are the trace's children, not cores
+        if (zinfo->traceDriven) panic("%s: traceEvents needs execution-driven simulation (sim.traceDriven = false)", name.c_str());
+        if (!zinfo->cohEvents) {
+            g_string evFile = config.get<const char*>("sim.eventTrace.file", "");
+            if (evFile.empty()) evFile = g_string(zinfo->outputDir) + "/zsim-ev.bin";
+            zinfo->cohEvents = new CoherenceEventTrace(evFile, zinfo->numCores, config.get<uint32_t>("sim.eventTrace.entries", 64*1024));
+        }
+        cache->setEventTrace(zinfo->cohEvents);
+    }
+    if (config.get<bool>(prefix + "transitionStats", false)) cache->enableTransitionStats();
+
 #if 0
     info("Built L%d bank, %d bytes, %d lines, %d ways (%d candidates if array is Z), %s array, %s hash, %s replacement, accLat %d, invLat %d name %s",
             level, bankSize, numLines, ways, candidates, arrayType.c_str(), hashType.c_str(), replType.c_str(), accLat, invLat, name.c_str());
@@ -372,7 +476,7 @@ MemObject* BuildMemoryController(Config& config, uint32_t lineSize, uint32_t fre
 
 typedef vector<vector<BaseCache*>> CacheGroup;
 
-CacheGroup* BuildCacheGroup(Config& config, const string& name, bool isTerminal) {
+CacheGroup* BuildCacheGroup(Config& config, const string& name, uint32_t caches, bool isTerminal, bool isLLC) {
     CacheGroup* cgp = new CacheGroup;
     CacheGroup& cg = *cgp;
 
@@ -394,7 +498,6 @@ CacheGroup* BuildCacheGroup(Config& config, const string& name, bool isTerminal)
 
     uint32_t size = config.get<uint32_t>(prefix + "size", 64*1024);
     uint32_t banks = config.get<uint32_t>(prefix + "banks", 1);
-    uint32_t caches = config.get<uint32_t>(prefix + "caches", 1);
 
     uint32_t bankSize = size/banks;
     if (size % banks != 0) {
@@ -413,7 +516,7 @@ CacheGroup* BuildCacheGroup(Config& config, const string& name, bool isTerminal)
             }
             g_string bankName(ss.str().c_str());
             uint32_t domain = (i*banks + j)*zinfo->numDomains/(caches*banks); //(banks > 1)? nextDomain() : (i*banks + j)*zinfo->numDomains/(caches*banks);
-            cg[i][j] = BuildCacheBank(config, prefix, bankName, bankSize, isTerminal, domain);
+            cg[i][j] = BuildCacheBank(config, prefix, bankName, bankSize, isTerminal, isLLC, domain);
         }
     }
 
@@ -475,15 +578,64 @@ static void InitSystem(Config& config) {
         return childMap[group].size() == 0;
     };
 
+    /* Number of caches of each group. Large systems are easier to write as clusters: with clusterSize = N, a group
+     * has one cache per N child caches (e.g., an L2 per 8 L1i|L1d pairs is clusterSize = 16). Terminal groups
+     * without caches get one per core that uses them, so only core counts need to change to scale a system.
+     */
+    unordered_map<string, uint32_t> coreCaches; //terminal group -> cores using it (as icache or dcache)
+    if (!zinfo->traceDriven) {
+        vector<const char*> coreGroupNames;
+        config.subgroups("sys.cores", coreGroupNames);
+        for (const char* group : coreGroupNames) {
+            string corePrefix = string("sys.cores.") + group + ".";
+            if (config.get<const char*>(corePrefix + "type", "Simple") == string("Null")) continue;
+            uint32_t cores = config.get<uint32_t>(corePrefix + "cores", 1);
+            coreCaches[config.get<const char*>(corePrefix + "icache")] += cores;
+            coreCaches[config.get<const char*>(corePrefix + "dcache")] += cores;
+        }
+    }
+
+    unordered_map<string, uint32_t> numCaches;
+    std::function<uint32_t(const string&)> countCaches = [&](const string& group) -> uint32_t {
+        if (numCaches.count(group)) {
+            if (!numCaches[group]) panic("The cache 'tree' has a loop at %s", group.c_str());
+            return numCaches[group];
+        }
+        numCaches[group] = 0; //in progress
+        string groupPrefix = prefix + group + ".";
+        uint32_t caches;
+        if (config.get<bool>(groupPrefix + "isPrefetcher", false)) {
+            caches = config.get<uint32_t>(groupPrefix + "prefetchers", 1);
+        } else if (config.exists(groupPrefix + "clusterSize")) {
+            if (config.exists(groupPrefix + "caches")) panic("%s: specify either caches or clusterSize, not both", group.c_str());
+            uint32_t clusterSize = config.get<uint32_t>(groupPrefix + "clusterSize");
+            uint32_t children = 0;
+            for (auto& childVec : childMap[group]) {
+                if (childVec.size()) children += countCaches(childVec[0])*childVec.size();
+            }
+            if (!clusterSize || !children || children % clusterSize) {
+                panic("%s: clusterSize (%d) must divide its %d child caches", group.c_str(), clusterSize, children);
+            }
+            caches = children/clusterSize;
+        } else if (isTerminal(group) && !config.exists(groupPrefix + "caches") && coreCaches.count(group)) {
+            caches = coreCaches[group];
+        } else {
+            caches = config.get<uint32_t>(groupPrefix + "caches", 1);
+        }
+        numCaches[group] = caches;
+        return caches;
+    };
+
     // Build each of the groups, starting with the LLC
     unordered_map<string, CacheGroup*> cMap;
+    unordered_map<string, SocketLinks*> socketLinks; //directory group -> links to its sockets
     list<string> fringe;  // FIFO
     fringe.push_back(llc);
     while (!fringe.empty()) {
         string group = fringe.front();
         fringe.pop_front();
         if (cMap.count(group)) panic("The cache 'tree' has a loop at %s", group.c_str());
-        cMap[group] = BuildCacheGroup(config, group, isTerminal(group));
+        cMap[group] = BuildCacheGroup(config, group, countCaches(group), isTerminal(group), group == llc);
         for (auto& childVec : childMap[group]) fringe.insert(fringe.end(), childVec.begin(), childVec.end());
     }
 
@@ -561,6 +713,20 @@ static void InitSystem(Config& config) {
         uint32_t children = childCaches.size();
         assert(children);
 
+        //Memory-side directory (see socket_directory.h): each child cache is a socket
+        SocketLinks* links = nullptr;
+        bool numaHomes = true;
+        if (config.get<const char*>(prefix + grp + ".type", "Simple") == string("Directory")) {
+            string linkPrefix = prefix + grp + ".links.";
+            uint32_t sockets = childCaches.size();
+            uint32_t banks = parentCaches[0].size();
+            numaHomes = config.get<bool>(linkPrefix + "numaHomes", true);
+            if (numaHomes && banks % sockets != 0) panic("%s: with numaHomes, its banks (%d) must be a multiple of its sockets (%d)", grp, banks, sockets);
+            links = new SocketLinks(sockets, !numaHomes, config.get<uint32_t>(linkPrefix + "latency", 40), config.get<uint32_t>(linkPrefix + "bandwidth", 20800),
+                    zinfo->freqMHz, config.get<uint32_t>(linkPrefix + "ctrlBytes", 8), zinfo->lineSize, g_string(grp) + "Links");
+            socketLinks[grp] = links;
+        }
+
         uint32_t childrenPerParent = children/parents;
         if (children % parents != 0) {
             panic("%s has %d caches and %d children, they are non-divisible. "
@@ -593,8 +759,11 @@ static void InitSystem(Config& config) {
                 info("Hierarchy: %s -> %s", Str(cacheNames).c_str(), parentName.c_str());
             }
 
-            for (BaseCache* bank : parentCaches[p]) {
-                bank->setChildren(childrenVec, network);
+            uint32_t banks = parentCaches[p].size();
+            for (uint32_t b = 0; b < banks; b++) {
+                //With NUMA homes, each socket is home to an equal share of the directory banks
+                if (links) static_cast<SocketDirectory*>(parentCaches[p][b])->connectSockets(links, numaHomes? b*links->getSockets()/banks : links->dirNode());
+                parentCaches[p][b]->setChildren(childrenVec, network);
             }
         }
     }
@@ -679,6 +848,7 @@ static void InitSystem(Config& config) {
                     FilterCache* dc = dynamic_cast<FilterCache*>(dgroup[assignedCaches[dcache]][0]);
                     assert(dc);
                     dc->setSourceId(coreIdx);
+                    if (zinfo->coupShadow) zinfo->coupShadow->setCoreNode(coreIdx, dc->getName());
                     assignedCaches[dcache]++;
 
                     //Build the core
@@ -762,6 +932,20 @@ static void InitSystem(Config& config) {
         groupStat->init(gm_strdup(group), "Cache stats");
         for (vector<BaseCache*>& banks : *cMap[group]) for (BaseCache* bank : banks) bank->initStats(groupStat);
         zinfo->rootStat->append(groupStat);
+
+        //Hot-line profiler (see hot_lines.h): one table per bank, merged on stats dumps
+        uint32_t hotEntries = config.get<uint32_t>(string("sys.caches.") + group + ".hotLines", 0);
+        if (hotEntries) {
+            HotLineGroup* hotLines = new HotLineGroup(hotEntries);
+            for (vector<BaseCache*>& banks : *cMap[group]) for (BaseCache* bank : banks) {
+                Cache* cache = dynamic_cast<Cache*>(bank);
+                if (!cache) panic("%s: hotLines needs a cache group", group);
+                cache->setHotLines(hotLines->addBank());
+            }
+            hotLines->initStats(zinfo->rootStat, group);
+        }
+
+        if (socketLinks.count(group)) socketLinks[group]->initStats(zinfo->rootStat);
     }
 
     //Initialize event recorders
@@ -772,6 +956,8 @@ static void InitSystem(Config& config) {
     for (auto mem : mems) mem->initStats(memStat);
     zinfo->rootStat->append(memStat);
 
+    if (zinfo->coupShadow) zinfo->coupShadow->initStats(zinfo->rootStat);
+
     //Odds and ends: BuildCacheGroup new'd the cache groups, we need to delete them
     for (pair<string, CacheGroup*> kv : cMap) delete kv.second;
     cMap.clear();
@@ -856,6 +1042,21 @@ static void InitGlobalStats() {
     ProxyStat* phaseStat = new ProxyStat();
     phaseStat->init("phase", "Simulated phases", &zinfo->numPhases);
     zinfo->rootStat->append(phaseStat);
+
+    //Host cost of the simulation, to track how it scales with simulated cores
+    auto heapStat = makeLambdaStat([]() { return gm_in_use() >> 10; });
+    heapStat->init("heapKB", "Global heap in use (host memory of the simulated system), KB");
+    zinfo->rootStat->append(heapStat);
+
+    auto kipsStat = makeLambdaStat([]() -> uint64_t {
+        uint64_t simNs = zinfo->profSimTime->count(PROF_BOUND) + zinfo->profSimTime->count(PROF_WEAVE);
+        if (!simNs || !zinfo->cores) return 0;
+        uint64_t instrs = 0;
+        for (uint32_t i = 0; i < zinfo->numCores; i++) instrs += zinfo->cores[i]->getInstrs();
+        return (uint64_t)(1e6*instrs/simNs); //instrs/ns * 1e9/1e3
+    });
+    kipsStat->init("hostKIPS", "Simulation speed: thousands of simulated instructions per host second (bound + weave)");
+    zinfo->rootStat->append(kipsStat);
 }
 
 
@@ -967,6 +1168,32 @@ void SimInit(const char* configFile, const char* outputDir, uint32_t shmid) {
     zinfo->lineSize = config.get<uint32_t>("sys.lineSize", 64);
     assert(zinfo->lineSize > 0);
 
+    //COUP per-word update masks; lines must fit in a 64-bit mask of 8-byte words
+    zinfo->coupWordMasks = config.get<bool>("sys.coupWordMasks", false);
+    if (zinfo->coupWordMasks && zinfo->lineSize > 64*8) panic("sys.coupWordMasks needs lines of up to 512 bytes (lineSize = %d)", zinfo->lineSize);
+
+    //How commutative updates are performed; must be known before building the caches
+    string coupMode = config.get<const char*>("sys.coupMode", "COUP");
+    if (coupMode == "COUP") {
+        zinfo->coupMode = COUP_MODE_COUP;
+    } else if (coupMode == "Remote") {
+        zinfo->coupMode = COUP_MODE_REMOTE;
+    } else if (coupMode == "Atomic") {
+        zinfo->coupMode = COUP_MODE_ATOMIC;
+    } else {
+        panic("Invalid sys.coupMode %s (COUP, Remote or Atomic)", coupMode.c_str());
+    }
+
+    zinfo->cohEvents = nullptr; //created by the first cache that records events
+
+    //COUP shadow values; the memory hierarchy registers its caches with it, so it must be created first
+    if (config.get<bool>("sim.coupShadow", false)) {
+        if (zinfo->coupMode != COUP_MODE_COUP) panic("sim.coupShadow validates reductions, it needs sys.coupMode = COUP");
+        zinfo->coupShadow = new CoupShadow(zinfo->lineSize, zinfo->numCores, config.get<bool>("sim.coupShadowFatal", false));
+    } else {
+        zinfo->coupShadow = nullptr;
+    }
+
     //Port virtualization
     for (uint32_t i = 0; i < MAX_PORT_DOMAINS; i++) zinfo->portVirt[i] = new PortVirtualizer();
 
@@ -24,10 +24,12 @@
  */
 
 #include "memory_hierarchy.h"
+#include <string.h>
 
-static const char* accessTypeNames[] = {"GETS", "GETX", "PUTS", "PUTX"};
-static const char* invTypeNames[] = {"INV", "INVX"};
-static const char* mesiStateNames[] = {"I", "S", "E", "M"};
+static const char* accessTypeNames[] = {"GETS", "GETX", "PUTS", "PUTX", "GETU", "PUTU", "RATOM", "RFLUSH"};
+static const char* invTypeNames[] = {"INV", "INVX", "FWD", "UPD"};
+static const char* mesiStateNames[] = {"I", "S", "E", "M", "U"};
+static const char* coupOpNames[] = {"NONE", "ADD", "AND", "OR", "XOR", "FADD32", "FADD64", "MIN", "MAX"};
 
 const char* AccessTypeName(AccessType t) {
     assert_msg(t >= 0 && (size_t)t < sizeof(accessTypeNames)/sizeof(const char*), "AccessTypeName got an out-of-range input, %d", t);
@@ -44,9 +46,54 @@ const char* MESIStateName(MESIState s) {
     return mesiStateNames[s];
 }
 
+const char* CoupOpName(CoupOp op) {
+    assert_msg(op >= 0 && (size_t)op < sizeof(coupOpNames)/sizeof(const char*), "CoupOpName got an out-of-range input, %d", op);
+    return coupOpNames[op];
+}
+
+static inline int64_t signExtend(uint64_t v, uint32_t size) {
+    uint32_t shift = 64 - 8*size;
+    return ((int64_t)(v << shift)) >> shift;
+}
+
+uint64_t ApplyCoupOp(CoupOp op, uint64_t a, uint64_t b, uint32_t size) {
+    assert(size >= 1 && size <= 8);
+    switch (op) {
+        case COUP_ADD: return a + b;
+        case COUP_AND: return a & b;
+        case COUP_OR: return a | b;
+        case COUP_XOR: return a ^ b;
+        case COUP_FADD32:
+            {
+                float fa, fb;
+                uint32_t ia = a, ib = b;
+                memcpy(&fa, &ia, sizeof(float));
+                memcpy(&fb, &ib, sizeof(float));
+                float fr = fa + fb;
+                uint32_t ir;
+                memcpy(&ir, &fr, sizeof(float));
+                return ir;
+            }
+        case COUP_FADD64:
+            {
+                double da, db;
+                memcpy(&da, &a, sizeof(double));
+                memcpy(&db, &b, sizeof(double));
+                double dr = da + db;
+                uint64_t r;
+                memcpy(&r, &dr, sizeof(double));
+                return r;
+            }
+        case COUP_MIN: return (signExtend(a, size) <= signExtend(b, size))? a : b;
+        case COUP_MAX: return (signExtend(a, size) >= signExtend(b, size))? a : b;
+        default: panic("Invalid COUP operator %d", op);
+    }
+}
+
 #include <type_traits>
 
 static inline void CompileTimeAsserts() {
     static_assert(std::is_pod<MemReq>::value, "MemReq not POD!");
+    static_assert(sizeof(coupOpNames)/sizeof(const char*) == COUP_NUM_OPS, "coupOpNames out of sync with CoupOp");
 }
 
@@ -50,6 +50,8 @@ typedef enum {
     // -- !! modified !! --
     GETU, // get line, update permission needed (triggered by a commutative load)
     PUTU, // update writeback (lower cache is evicting this line, update value)
+    RATOM, // remote atomic: perform a commutative update at the home (LLC) bank, without moving the line there (sys.coupMode = Remote)
+    RFLUSH, // reduction flush: reduce the line's U sharers where they are tracked, without moving the line (coup_flush)
 } AccessType;
 
 /* Types of Invalidation. An Invalidation is a request issued from upper to lower
@@ -74,12 +76,52 @@ typedef enum {
 
 } MESIState;
 
+/* Commutative update operators (COUP). GETU/PUTU requests and U-state lines
+ * are tagged with the operator they reduce with. A line in U can only absorb
+ * updates of a single operator; an update with a different operator must
+ * reduce all partial values first.
+ *
+ * Integer operators work on the update's width, like the lock-prefixed x86
+ * instructions they come from. x86 has no atomic FP adds, mins or maxes, so
+ * the rest are emulated (see EmulateCoupUpdate in zsim.cpp): FADD32/FADD64
+ * add IEEE floats/doubles, and MIN/MAX compare signed integers.
+ */
+typedef enum {
+    COUP_NONE, // not a commutative update
+    COUP_ADD,
+    COUP_AND,
+    COUP_OR,
+    COUP_XOR,
+    COUP_FADD32,
+    COUP_FADD64,
+    COUP_MIN,
+    COUP_MAX,
+    COUP_NUM_OPS, // not an operator, keep last
+} CoupOp;
+
+/* How commutative updates are performed (sys.coupMode), so the same binary
+ * can compare COUP against the common alternatives.
+ */
+typedef enum {
+    COUP_MODE_COUP,   // GETU, updates are buffered in U lines and reduced on reads
+    COUP_MODE_REMOTE, // RATOM, updates are shipped to and performed at the home LLC bank
+    COUP_MODE_ATOMIC, // GETX, updates are plain atomics on an exclusive line (lock add)
+} CoupMode;
+
 //Convenience methods for clearer debug traces
 const char* AccessTypeName(AccessType t);
 const char* InvTypeName(InvType t);
 const char* MESIStateName(MESIState s);
+const char* CoupOpName(CoupOp op);
 
-inline bool IsGet(AccessType t) { return t == GETS || t == GETX || t == GETU; }
+// Operators without an atomic x86 instruction, which zsim performs on behalf of the program
+inline bool IsEmulatedCoupOp(CoupOp op) { return op >= COUP_FADD32 && op <= COUP_MAX; }
+inline bool IsFloatCoupOp(CoupOp op) { return op == COUP_FADD32 || op == COUP_FADD64; }
+
+// Combines two values of an update's width (1-8 bytes, little-endian in the low bits) with op
+uint64_t ApplyCoupOp(CoupOp op, uint64_t a, uint64_t b, uint32_t size);
+
+inline bool IsGet(AccessType t) { return t == GETS || t == GETX || t == GETU || t == RATOM || t == RFLUSH; }
 inline bool IsPut(AccessType t) { return t == PUTS || t == PUTX || t == PUTU; }
 
 
@@ -109,10 +151,23 @@ struct MemReq {
     };
     uint32_t flags;
 
+    //Reduction operator of GETU/PUTU requests; COUP_NONE otherwise
+    CoupOp coupOp;
+
+    //With sys.coupWordMasks, 8-byte words of the line that GETS/GETU requests touch (nullptr for the whole line).
+    //On GETS, parents overwrite it with the words the requester may read (see MEUSITopCC).
+    uint64_t* wordMask;
+
+    //64-bit words a vector update (coup_vupdate) performs with this GETU/RATOM; 0 for scalar updates, which touch one
+    uint32_t updateWords;
+
     inline void set(Flag f) {flags |= f;}
     inline bool is (Flag f) const {return flags & f;}
 };
 
+// Word mask of a full line
+static const uint64_t ALL_WORDS = ~0UL;
+
 /* Invalidation/downgrade request */
 struct InvReq {
     Address lineAddr;
@@ -121,6 +176,11 @@ struct InvReq {
     bool* writeback;
     uint64_t cycle;
     uint32_t srcId;
+    CoupOp coupOp; //operator the line is updated with after an UPD, or reduced with on an INV of a U line (COUP_NONE otherwise)
+    // If set, the line may not be present (imprecise sharer sets); the child reports whether it held it
+    bool* held;
+    // If set (reductions), the child reports whether it held the line in U, i.e., sent back a partial update
+    bool* partial;
 };
 
 /** INTERFACES **/
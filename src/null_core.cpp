@@ -59,13 +59,14 @@ void NullCore::join() {
 //Static class functions: Function pointers and trampolines
 
 InstrFuncPtrs NullCore::GetFuncPtrs() {
-    return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, FPTR_ANALYSIS, {0}};
+    return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, CoupUpdateFunc, FPTR_ANALYSIS};
 }
 
 void NullCore::LoadFunc(THREADID tid, ADDRINT addr) {}
 void NullCore::StoreFunc(THREADID tid, ADDRINT addr) {}
 void NullCore::PredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred) {}
 void NullCore::PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred) {}
+void NullCore::CoupUpdateFunc(THREADID tid, ADDRINT addr, UINT32 op) {}
 
 void NullCore::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
     NullCore* core = static_cast<NullCore*>(cores[tid]);
@@ -64,6 +64,7 @@ OOOCore::OOOCore(FilterCache* _l1i, FilterCache* _l1d, g_string& _name) : Core(_
         regScoreboard[i] = 0;
     }
     prevBbl = nullptr;
+    nextCoupOp = 0;
 
     lastStoreCommitCycle = 0;
     lastStoreAddrCommitCycle = 0;
@@ -131,7 +132,7 @@ void OOOCore::contextSwitch(int32_t gid) {
 }
 
 
-InstrFuncPtrs OOOCore::GetFuncPtrs() {return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, FPTR_ANALYSIS, {0}};}
+InstrFuncPtrs OOOCore::GetFuncPtrs() {return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, CoupUpdateFunc, FPTR_ANALYSIS};}
 
 inline void OOOCore::load(Address addr) {
     loadAddrs[loads++] = addr;
@@ -141,6 +142,11 @@ void OOOCore::store(Address addr) {
     storeAddrs[stores++] = addr;
 }
 
+inline void OOOCore::coupUpdate(Address addr, CoupOp op) {
+    loadCoupOps[loads] = op;
+    loadAddrs[loads++] = addr;
+}
+
 // Predicated loads and stores call this function, gets recorded as a 0-cycle op.
 // Predication is rare enough that we don't need to model it perfectly to be accurate (i.e. the uops still execute, retire, etc), but this is needed for correctness.
 void OOOCore::predFalseLoad() {
@@ -151,6 +157,69 @@ void OOOCore::predFalseStore() {
     storeAddrs[stores++] = -1L;
 }
 
+//Magic ops run before the BBL's loads and stores are simulated, so flushes and vector updates are recorded with
+//their position among them, and bbl() issues them in program order
+void OOOCore::coupFlush(Address addr, uint64_t bytes) {
+    if (!bytes) return;
+    pendingCoupOps.push_back(PendingCoupOp());
+    PendingCoupOp& p = pendingCoupOps.back();
+    p.loads = loads;
+    p.stores = stores;
+    p.isFlush = true;
+    p.addr = addr;
+    p.bytes = bytes;
+}
+
+//A vector update is a single op for all its lanes (at most 64); issueVectorUpdate splits it by line
+void OOOCore::coupVectorUpdate(Address base, uint64_t laneMask, uint32_t width, CoupOp op) {
+    pendingCoupOps.push_back(PendingCoupOp());
+    PendingCoupOp& p = pendingCoupOps.back();
+    p.loads = loads;
+    p.stores = stores;
+    p.isFlush = false;
+    p.addr = base;
+    p.laneMask = laneMask;
+    p.width = width;
+    p.op = op;
+}
+
+inline void OOOCore::issueCoupOps(uint32_t loadIdx, uint32_t storeIdx) {
+    while (nextCoupOp < pendingCoupOps.size() && pendingCoupOps[nextCoupOp].loads <= loadIdx && pendingCoupOps[nextCoupOp].stores <= storeIdx) {
+        PendingCoupOp& p = pendingCoupOps[nextCoupOp++];
+        if (p.isFlush) issueFlush(p.addr, p.bytes);
+        else issueVectorUpdate(p.addr, p.laneMask, p.width, p.op);
+    }
+}
+
+//Flushes are issued one line per cycle and stall decode until they are all done (they precede a barrier, so there is
+//nothing to overlap them with). Like fetches, they don't go through the instruction window.
+inline void OOOCore::issueFlush(Address addr, uint64_t bytes) {
+    Address firstLine = addr >> lineBits;
+    Address lastLine = (addr + bytes - 1) >> lineBits;
+    uint64_t doneCycle = curCycle;
+    for (Address lineAddr = firstLine; lineAddr <= lastLine; lineAddr++) {
+        uint64_t dispatchCycle = curCycle + (lineAddr - firstLine);
+        uint64_t respCycle = l1d->coupFlush(lineAddr, dispatchCycle);
+        cRec.record(curCycle, dispatchCycle, respCycle);
+        doneCycle = MAX(doneCycle, respCycle);
+    }
+    decodeCycle = MAX(decodeCycle, doneCycle);
+}
+
+//Vector updates are issued the same way, one line per cycle. Like scalar updates (lock-prefixed RMWs), they complete
+//before later instructions, so they also stall decode.
+inline void OOOCore::issueVectorUpdate(Address base, uint64_t laneMask, uint32_t width, CoupOp op) {
+    uint64_t dispatchCycle = curCycle;
+    uint64_t doneCycle = curCycle;
+    ForEachVectorUpdateLine(base, laneMask, width, lineBits, [&](Address vAddr, uint32_t lanes, uint64_t words) {
+        uint64_t respCycle = l1d->coupVectorUpdate(vAddr, dispatchCycle, op, lanes, words) + L1D_LAT;
+        cRec.record(curCycle, dispatchCycle, respCycle);
+        doneCycle = MAX(doneCycle, respCycle);
+        dispatchCycle++;
+    });
+    decodeCycle = MAX(decodeCycle, doneCycle);
+}
+
 void OOOCore::branch(Address pc, bool taken, Address takenNpc, Address notTakenNpc) {
     branchPc = pc;
     branchTaken = taken;
@@ -164,6 +233,7 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
         prevBbl = bblInfo;
         // Kill lingering ops from previous BBL
         loads = stores = 0;
+        pendingCoupOps.clear();
         return;
     }
 
@@ -183,6 +253,11 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
     for (uint32_t i = 0; i < bbl->uops; i++) {
         DynUop* uop = &(bbl->uop[i]);
 
+        // Flushes and vector updates go after the memory ops that precede them, and stall the ones that follow
+        if (unlikely(nextCoupOp < pendingCoupOps.size()) && (uop->type == UOP_LOAD || uop->type == UOP_COUP_UPDATE || uop->type == UOP_STORE)) {
+            issueCoupOps(loadIdx, storeIdx);
+        }
+
         // Decode stalls
         uint32_t decDiff = uop->decCycle - prevDecCycle;
         decodeCycle = MAX(decodeCycle + decDiff, uopQueue.minAllocCycle());
@@ -293,6 +368,29 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
                 }
                 break;
 
+            case UOP_COUP_UPDATE:
+                {
+                    // Same LSU constraints as a load, but the update is sent as a GETU and does not read
+                    // the old value, so there is no st-ld forwarding (and the decoder gives it no destination)
+                    uint64_t lqCycle = loadQueue.minAllocCycle();
+                    if (lqCycle > dispatchCycle) {
+#ifdef LSU_IW_BACKPRESSURE
+                        insWindow.poisonRange(curCycle, lqCycle, 0x4 /*PORT_2, loads*/);
+#endif
+                        dispatchCycle = lqCycle;
+                    }
+                    dispatchCycle = MAX(lastStoreAddrCommitCycle+1, dispatchCycle);
+
+                    CoupOp op = loadCoupOps[loadIdx];
+                    Address addr = loadAddrs[loadIdx++];
+                    uint64_t reqSatisfiedCycle = l1d->coupUpdate(addr, dispatchCycle, op) + L1D_LAT;
+                    cRec.record(curCycle, dispatchCycle, reqSatisfiedCycle);
+
+                    commitCycle = reqSatisfiedCycle;
+                    loadQueue.markRetire(commitCycle);
+                }
+                break;
+
             case UOP_STORE:
                 {
                     // dispatchCycle = MAX(storeQueue.minAllocCycle(), dispatchCycle);
@@ -360,7 +458,11 @@ inline void OOOCore::bbl(Address bblAddr, BblInfo* bblInfo) {
     // If these assertions fail, most likely, something's off in the decoder
     assert_msg(loadIdx == loads, "%s: loadIdx(%d) != loads (%d)", name.c_str(), loadIdx, loads);
     assert_msg(storeIdx == stores, "%s: storeIdx(%d) != stores (%d)", name.c_str(), storeIdx, stores);
+    issueCoupOps(loads, stores); //those after the BBL's last memory op
+    assert(nextCoupOp == pendingCoupOps.size());
     loads = stores = 0;
+    pendingCoupOps.clear(); //keeps its capacity, so steady-state BBLs don't allocate
+    nextCoupOp = 0;
 
 
     /* Simulate frontend for branch pred + fetch of this BBL
@@ -502,6 +604,8 @@ void OOOCore::PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred) {
     else core->predFalseStore();
 }
 
+void OOOCore::CoupUpdateFunc(THREADID tid, ADDRINT addr, UINT32 op) {static_cast<OOOCore*>(cores[tid])->coupUpdate(addr, (CoupOp)op);}
+
 void OOOCore::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
     OOOCore* core = static_cast<OOOCore*>(cores[tid]);
     core->bbl(bblAddr, bblInfo);
@@ -31,6 +31,7 @@
 #include <string>
 #include "core.h"
 #include "g_std/g_multimap.h"
+#include "g_std/g_vector.h"
 #include "memory_hierarchy.h"
 #include "ooo_core_recorder.h"
 #include "pad.h"
@@ -372,10 +373,24 @@ class OOOCore : public Core {
 
         //Record load and store addresses
         Address loadAddrs[256];
+        CoupOp loadCoupOps[256]; //operator of each load recorded by coupUpdate(), only read by UOP_COUP_UPDATE
         Address storeAddrs[256];
         uint32_t loads;
         uint32_t stores;
 
+        //Reduction flushes (coup_flush) and vector updates of the BBL, issued by bbl() in program order with its loads and stores
+        struct PendingCoupOp {
+            uint32_t loads, stores; //memory ops of the BBL that precede it
+            bool isFlush;
+            Address addr;
+            uint64_t bytes; //flushes
+            uint64_t laneMask; //vector updates (addr is the base)
+            uint32_t width;
+            CoupOp op;
+        };
+        g_vector<PendingCoupOp> pendingCoupOps; //a BBL may have any number of them (e.g., unrolled coup_flush calls)
+        uint32_t nextCoupOp; //next to issue, only used within bbl()
+
         uint64_t lastStoreCommitCycle;
         uint64_t lastStoreAddrCommitCycle; //tracks last store addr uop, all loads queue behind it
 
@@ -446,6 +461,8 @@ class OOOCore : public Core {
 
         virtual void join();
         virtual void leave();
+        virtual void coupFlush(Address addr, uint64_t bytes);
+        virtual void coupVectorUpdate(Address base, uint64_t laneMask, uint32_t width, CoupOp op);
 
         InstrFuncPtrs GetFuncPtrs();
 
@@ -457,6 +474,12 @@ class OOOCore : public Core {
     private:
         inline void load(Address addr);
         inline void store(Address addr);
+        inline void coupUpdate(Address addr, CoupOp op);
+
+        // Issues the pending flushes and vector updates that precede the BBL's loadIdx-th load and storeIdx-th store
+        inline void issueCoupOps(uint32_t loadIdx, uint32_t storeIdx);
+        inline void issueFlush(Address addr, uint64_t bytes);
+        inline void issueVectorUpdate(Address base, uint64_t laneMask, uint32_t width, CoupOp op);
 
         /* NOTE: Analysis routines cannot touch curCycle directly, must use
          * advance() for long jumps or insWindow.advancePos() for 1-cycle
@@ -481,6 +504,7 @@ class OOOCore : public Core {
         static void StoreFunc(THREADID tid, ADDRINT addr);
         static void PredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred);
         static void PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred);
+        static void CoupUpdateFunc(THREADID tid, ADDRINT addr, UINT32 op);
         static void BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo);
         static void BranchFunc(THREADID tid, ADDRINT pc, BOOL taken, ADDRINT takenNpc, ADDRINT notTakenNpc);
 } ATTR_LINE_ALIGNED;  // Take up an int number of cache lines
@@ -30,6 +30,7 @@
 #include <vector>
 #include "config.h"
 #include "constants.h"
+#include "coup_auto.h"
 #include "event_queue.h"
 #include "process_stats.h"
 #include "stats.h"
@@ -187,6 +188,11 @@ static void PopulateLevel(Config& config, const std::string& prefix, std::vector
         }  //  else leave mask empty, no cores
         g_vector<uint64_t> ffiPoints(ParseList<uint64_t>(config.get<const char*>(p_ss.str() +  ".ffiPoints", "")));
 
+        CoupAutoFilter* coupAuto = nullptr;
+        if (config.get<bool>(p_ss.str() +  ".coupAuto", false)) {
+            coupAuto = new CoupAutoFilter(config.get<const char*>(p_ss.str() +  ".coupAutoPCs", ""), config.get<const char*>(p_ss.str() +  ".coupAutoSymbols", ""));
+        }
+
         if (dumpInstrs) {
             if (dumpHeartbeats) warn("Dumping eventual stats on both heartbeats AND instructions; you won't be able to distinguish both!");
             auto getInstrs = [procIdx]() { return zinfo->processStats->getProcessInstrs(procIdx); };
@@ -207,7 +213,7 @@ static void PopulateLevel(Config& config, const std::string& prefix, std::vector
         else
             panic("Invalid synced fast forward mode %s", syncedFastForwardStr.c_str());
 
-        ProcessTreeNode* ptn = new ProcessTreeNode(procIdx, groupIdx, startFastForwarded, startPaused, syncedFastForward, clockDomain, portDomain, dumpHeartbeats, dumpsResetHeartbeats, restarts, mask, ffiPoints, syscallBlacklistRegex, gpr);
+        ProcessTreeNode* ptn = new ProcessTreeNode(procIdx, groupIdx, startFastForwarded, startPaused, syncedFastForward, clockDomain, portDomain, dumpHeartbeats, dumpsResetHeartbeats, restarts, mask, ffiPoints, syscallBlacklistRegex, coupAuto, gpr);
         //info("Created ProcessTreeNode, procIdx %d", procIdx);
         parent->addChild(ptn);
         children.push_back(ptn);
@@ -229,7 +235,7 @@ static void PopulateLevel(Config& config, const std::string& prefix, std::vector
 }
 
 void CreateProcessTree(Config& config) {
-    ProcessTreeNode* rootNode = new ProcessTreeNode(-1, -1, false, false, SFF_NEVER, 0, 0, 0, false, 0, g_vector<bool> {},  g_vector<uint64_t> {}, g_string {}, nullptr);
+    ProcessTreeNode* rootNode = new ProcessTreeNode(-1, -1, false, false, SFF_NEVER, 0, 0, 0, false, 0, g_vector<bool> {},  g_vector<uint64_t> {}, g_string {}, nullptr, nullptr);
     uint32_t procIdx = 0;
     uint32_t groupIdx = 0;
     std::vector<ProcessTreeNode*> globProcVector;
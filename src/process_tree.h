@@ -33,6 +33,7 @@
 #include "zsim.h"
 
 class Config;
+class CoupAutoFilter;
 
 enum SyncedFastForwardMode {
     SFF_ALWAYS,
@@ -60,13 +61,14 @@ class ProcessTreeNode : public GlobAlloc {
         const g_vector<bool> mask;
         const g_vector<uint64_t> ffiPoints;
         const g_string syscallBlacklistRegex;
+        const CoupAutoFilter* coupAuto; //nullptr unless in automatic COUP mode
 
     public:
         ProcessTreeNode(uint32_t _procIdx, uint32_t _groupIdx, bool _inFastForward, bool _inPause, const SyncedFastForwardMode& _syncedFastForward,
                         uint32_t _clockDomain, uint32_t _portDomain, uint64_t _dumpHeartbeats, bool _dumpsResetHeartbeats, uint32_t _restarts,
-                        const g_vector<bool>& _mask, const g_vector<uint64_t>& _ffiPoints, const g_string& _syscallBlacklistRegex, const char*_patchRoot)
+                        const g_vector<bool>& _mask, const g_vector<uint64_t>& _ffiPoints, const g_string& _syscallBlacklistRegex, const CoupAutoFilter* _coupAuto, const char*_patchRoot)
             : patchRoot(_patchRoot), procIdx(_procIdx), groupIdx(_groupIdx), curChildren(0), heartbeats(0), started(false), inFastForward(_inFastForward),
-              inPause(_inPause), restartsLeft(_restarts), syncedFastForward(_syncedFastForward), clockDomain(_clockDomain), portDomain(_portDomain), dumpHeartbeats(_dumpHeartbeats), dumpsResetHeartbeats(_dumpsResetHeartbeats), mask(_mask), ffiPoints(_ffiPoints), syscallBlacklistRegex(_syscallBlacklistRegex) {}
+              inPause(_inPause), restartsLeft(_restarts), syncedFastForward(_syncedFastForward), clockDomain(_clockDomain), portDomain(_portDomain), dumpHeartbeats(_dumpHeartbeats), dumpsResetHeartbeats(_dumpsResetHeartbeats), mask(_mask), ffiPoints(_ffiPoints), syscallBlacklistRegex(_syscallBlacklistRegex), coupAuto(_coupAuto) {}
 
         void addChild(ProcessTreeNode* child) {
             children.push_back(child);
@@ -144,6 +146,10 @@ class ProcessTreeNode : public GlobAlloc {
             return syscallBlacklistRegex;
         }
 
+        const CoupAutoFilter* getCoupAuto() const {
+            return coupAuto;
+        }
+
         //Currently there's no API to get back to a paused state; processes can start in a paused state, but once they are unpaused, they are unpaused for good
 };
 
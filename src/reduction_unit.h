@@ -0,0 +1,262 @@
+#ifndef REDUCTION_UNIT_H
+#define REDUCTION_UNIT_H
+
+#include <string>
+#include "bithacks.h"
+#include "constants.h"
+#include "galloc.h"
+#include "log.h"
+#include "memory_hierarchy.h"
+#include "stats.h"
+
+/* Reduction unit of a cache bank: the ALU that folds partial updates of U
+ * lines (received on reductions and PUTUs) into the bank's copy. With
+ * sys.coupMode = Remote, the LLC banks also perform remote atomics on it.
+ *
+ * - opsPerCycle: merge ops issued per cycle (throughput)
+ * - pipelineDepth: cycles from issuing an op to having its result
+ * - fpPipelineDepth: same, for FP adds (FADD32/FADD64), which go through
+ *   the unit's FP adders
+ * - lanes: 64-bit words combined per op, so merging a full line takes
+ *   ceil(words per line / lanes) ops
+ *
+ * Partials of the same line are combined pairwise inside the unit, so a
+ * reduction is throughput-bound and pays the pipeline depth once.
+ *
+ * How partials get to the unit on a reduction depends on the gather
+ * topology (reduction.gather), with hopMergeLat cycles per merge outside it:
+ * - Parallel (default): each sharer sends its partial straight to this bank,
+ *   and the unit merges them as they arrive.
+ * - Serial: partials are chained through the sharers, in the order they have
+ *   them; each one merges its own into the running partial and forwards it.
+ * - Tree: a binary tree through the NoC; sharers merge pairwise, so partials
+ *   take log2(sharers) sharer-to-sharer hops.
+ * - Combining: in-network combining; routers merge partials as their paths to
+ *   this bank meet, adding log2(sharers) merges to the slowest path.
+ * In the last three, the unit merges a single, fully combined partial. A hop
+ * between sharers is assumed to take as long as the sender's trip to us.
+ *
+ * The bound phase only models contention among the partials of a single
+ * reduction (as if the unit was otherwise idle). TimingCache models
+ * contention across accesses in the weave phase, by issuing each access's
+ * ops through weaveIssue() and delaying its response by the extra wait.
+ */
+enum GatherTopology {
+    GATHER_PARALLEL,
+    GATHER_SERIAL,
+    GATHER_TREE,
+    GATHER_COMBINING,
+};
+
+class ReductionUnit : public GlobAlloc {
+    public:
+        // A partial update on its way to us: when it arrives, and the one-way latency from its sharer
+        struct Partial {
+            uint64_t arrival;
+            uint32_t lat;
+
+            inline uint64_t ready() const { return arrival - lat; }
+            bool operator<(const Partial& other) const { return arrival < other.arrival; }
+        };
+
+    private:
+        const uint32_t opsPerCycle;
+        const uint32_t pipelineDepth;
+        const uint32_t fpPipelineDepth;
+        const uint32_t lanes;
+        const uint32_t opsPerMerge;
+        const GatherTopology gather;
+        const uint32_t hopMergeLat;
+
+        uint32_t pendingOps; //ops issued by the access in progress (bound phase)
+        uint64_t weaveFreeSlot; //first free issue slot, in ops (cycle*opsPerCycle + op), weave phase
+
+        Counter profMerges, profAtomics, profOps, profStallCycles;
+        Counter profGatherMerges;
+
+    public:
+        ReductionUnit(uint32_t _opsPerCycle, uint32_t _pipelineDepth, uint32_t _fpPipelineDepth, uint32_t _lanes, uint32_t lineSize,
+                GatherTopology _gather = GATHER_PARALLEL, uint32_t _hopMergeLat = 1)
+            : opsPerCycle(_opsPerCycle), pipelineDepth(_pipelineDepth), fpPipelineDepth(_fpPipelineDepth), lanes(_lanes), opsPerMerge((lineSize/8 + lanes - 1)/lanes),
+              gather(_gather), hopMergeLat(_hopMergeLat), pendingOps(0), weaveFreeSlot(0)
+        {
+            if (!opsPerCycle || !lanes) panic("Reduction unit needs opsPerCycle and lanes > 0");
+            if (!opsPerMerge) panic("Reduction unit: lines must be at least 8 bytes");
+        }
+
+        void initStats(AggregateStat* parentStat) {
+            profMerges.init("ruMerges", "Partial updates merged by the reduction unit");
+            profAtomics.init("ruAtomics", "Remote atomics performed by the reduction unit");
+            profOps.init("ruOps", "Ops issued by the reduction unit");
+            profStallCycles.init("ruStallCycles", "Cycles reductions waited for the reduction unit (weave phase)");
+            parentStat->append(&profMerges);
+            parentStat->append(&profAtomics);
+            parentStat->append(&profOps);
+            parentStat->append(&profStallCycles);
+            if (gather != GATHER_PARALLEL) {
+                profGatherMerges.init("gatherMerges", "Partial updates merged on their way to the reduction unit (reduction.gather)");
+                parentStat->append(&profGatherMerges);
+            }
+        }
+
+        // Bound phase: merge n partials of op that arrive at the given cycles (sorted) starting at cycle; returns when the line is reduced
+        uint64_t merge(const uint64_t* arrivalCycles, uint32_t n, uint64_t cycle, CoupOp op) {
+            return mergeArrivals([arrivalCycles](uint32_t i) { return arrivalCycles[i]; }, n, cycle, op);
+        }
+
+        // Same, with the arrival cycle of partial i given by arrivalCycle(i)
+        template <typename F>
+        uint64_t mergeArrivals(F arrivalCycle, uint32_t n, uint64_t cycle, CoupOp op) {
+            uint64_t slot = cycle*opsPerCycle;
+            for (uint32_t i = 0; i < n; i++) {
+                slot = MAX(slot, arrivalCycle(i)*opsPerCycle) + opsPerMerge;
+            }
+            uint32_t ops = n*opsPerMerge;
+            pendingOps += ops;
+            profMerges.inc(n);
+            profOps.inc(ops);
+            return n? (slot - 1)/opsPerCycle + depth(op) : cycle;
+        }
+
+        uint64_t merge(uint64_t cycle, CoupOp op) {
+            return merge(&cycle, 1, cycle, op);
+        }
+
+        // Bound phase: gather and merge the n partials of a reduction (sorted by arrival) starting at cycle, per the
+        // gather topology; returns when the line is reduced. Clobbers partials.
+        uint64_t reduce(Partial* partials, uint32_t n, uint64_t cycle, CoupOp op) {
+            if (!n) return cycle;
+            uint64_t combined; //when the fully combined partial arrives
+            switch (gather) {
+                case GATHER_PARALLEL:
+                    return mergeArrivals([partials](uint32_t i) { return partials[i].arrival; }, n, cycle, op);
+                case GATHER_SERIAL:
+                    {
+                        uint64_t t = partials[0].ready();
+                        for (uint32_t i = 1; i < n; i++) {
+                            t = MAX(t + partials[i-1].lat, partials[i].ready()) + hopMergeLat;
+                        }
+                        combined = t + partials[n-1].lat;
+                    }
+                    break;
+                case GATHER_TREE:
+                    {
+                        //Each level pairs up neighbors (by arrival); the earlier one sends its partial to the later one,
+                        //which then ships the merged one as if it was its own (in place, so arrival = ready + lat still)
+                        uint32_t m = n;
+                        while (m > 1) {
+                            uint32_t next = 0;
+                            for (uint32_t i = 0; i < m; i += 2) {
+                                if (i + 1 < m) {
+                                    const Partial& a = partials[i];
+                                    const Partial& b = partials[i+1];
+                                    uint64_t ready = MAX(a.ready() + a.lat, b.ready()) + hopMergeLat;
+                                    partials[next] = {ready + b.lat, b.lat};
+                                } else {
+                                    partials[next] = partials[i];
+                                }
+                                next++;
+                            }
+                            m = next;
+                        }
+                        combined = partials[0].arrival;
+                    }
+                    break;
+                case GATHER_COMBINING:
+                    {
+                        uint32_t levels = (n > 1)? ilog2(n - 1) + 1 : 0; //ceil(log2(n))
+                        combined = partials[n-1].arrival + levels*hopMergeLat;
+                    }
+                    break;
+                default: panic("!?");
+            }
+            profGatherMerges.inc(n - 1);
+            return merge(&combined, 1, cycle, op);
+        }
+
+        // Bound phase: perform a remote atomic on words 64-bit words (0 for a scalar one, i.e., 1 word) starting at
+        // cycle; returns when its result is ready. Vector atomics take ceil(words / lanes) ops.
+        uint64_t execute(uint64_t cycle, CoupOp op, uint32_t words = 0) {
+            uint32_t ops = words? (words + lanes - 1)/lanes : 1;
+            pendingOps += ops;
+            profAtomics.inc();
+            profOps.inc(ops);
+            return cycle + (ops - 1)/opsPerCycle + depth(op);
+        }
+
+        inline uint32_t depth(CoupOp op) const {
+            return IsFloatCoupOp(op)? fpPipelineDepth : pipelineDepth;
+        }
+
+        // Ops issued since the last call; TimingCache uses it to tell which accesses used the unit
+        uint32_t takePendingOps() {
+            uint32_t ops = pendingOps;
+            pendingOps = 0;
+            return ops;
+        }
+
+        // Weave phase: issue ops starting at cycle, returns the extra cycles they wait for earlier reductions
+        uint64_t weaveIssue(uint64_t cycle, uint32_t ops) {
+            assert(ops);
+            uint64_t slot = MAX(cycle*opsPerCycle, weaveFreeSlot);
+            weaveFreeSlot = slot + ops;
+            uint64_t lastIssue = (slot + ops - 1)/opsPerCycle;
+            uint64_t uncontendedLastIssue = (cycle*opsPerCycle + ops - 1)/opsPerCycle;
+            uint64_t stall = lastIssue - uncontendedLastIssue;
+            profStallCycles.inc(stall);
+            return stall;
+        }
+};
+
+static inline GatherTopology ParseGatherTopology(const std::string& str) {
+    if (str == "Parallel") return GATHER_PARALLEL;
+    if (str == "Serial") return GATHER_SERIAL;
+    if (str == "Tree") return GATHER_TREE;
+    if (str == "Combining") return GATHER_COMBINING;
+    panic("Invalid reduction gather topology %s (Parallel, Serial, Tree or Combining)", str.c_str());
+}
+
+/* Latency of reads that reduce a line (GETS to a line in U), by the number of
+ * U sharers reduced. Stats are redReadLat.s<N>[bucket]: reads that reduced
+ * up to N sharers (powers of 2), by latency bucket (powers of 2: bucket k has
+ * latencies under 2^(k+1)), and redReadCycles[row], their total latency.
+ */
+class ReductionReadStats : public GlobAlloc {
+    private:
+        static const uint32_t LAT_BUCKETS = 16;
+        static const uint32_t SHARER_BUCKETS = 32 - __builtin_clz(MAX_CACHE_CHILDREN - 1) + 1;
+
+        VectorCounter hist[SHARER_BUCKETS];
+        VectorCounter cycles;
+
+        static inline uint32_t bucket(uint64_t v) { //ceil(log2(v))
+            return (v > 1)? ilog2(v - 1) + 1 : 0;
+        }
+
+    public:
+        void initStats(AggregateStat* parentStat) {
+            const char** latNames = gm_calloc<const char*>(LAT_BUCKETS);
+            for (uint32_t k = 0; k < LAT_BUCKETS; k++) {
+                latNames[k] = gm_strdup((k == LAT_BUCKETS - 1)? "inf" : ("lt" + std::to_string(2UL << k)).c_str());
+            }
+            const char** sharerNames = gm_calloc<const char*>(SHARER_BUCKETS);
+            AggregateStat* histStat = new AggregateStat();
+            histStat->init("redReadLat", "Reads that reduced a line, by U sharers (rows, up to) and latency (columns, under)");
+            for (uint32_t s = 0; s < SHARER_BUCKETS; s++) {
+                sharerNames[s] = gm_strdup(("s" + std::to_string(1UL << s)).c_str());
+                hist[s].init(sharerNames[s], "Reads that reduced up to this many U sharers", LAT_BUCKETS, latNames);
+                histStat->append(&hist[s]);
+            }
+            cycles.init("redReadCycles", "Total latency of reads that reduced a line, by U sharers (up to)", SHARER_BUCKETS, sharerNames);
+            parentStat->append(histStat);
+            parentStat->append(&cycles);
+        }
+
+        inline void record(uint32_t uSharers, uint64_t lat) {
+            uint32_t s = MIN(bucket(uSharers), SHARER_BUCKETS - 1);
+            hist[s].inc(MIN(ilog2(lat | 1), LAT_BUCKETS - 1)); //lat < 2^(k+1)
+            cycles.inc(s, lat);
+        }
+};
+
+#endif  // REDUCTION_UNIT_H
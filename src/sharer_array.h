@@ -0,0 +1,246 @@
+#ifndef SHARER_ARRAY_H
+#define SHARER_ARRAY_H
+
+#include <string.h>
+#include "bithacks.h"
+#include "g_std/g_vector.h"
+#include "galloc.h"
+#include "log.h"
+#include "stats.h"
+
+/* Sharer sets of all the lines of a cache (the directory part of its top CC).
+ *
+ * A full bit vector per line scales with the number of children, so with
+ * hundreds of children the directory dominates host memory and walking it
+ * dominates invalidations. Formats (sys.caches.<grp>.sharers.type):
+ *
+ * - Full: one bit per child (precise)
+ * - Coarse: one bit per group of sharers.coarseness children (imprecise,
+ *   invalidates every child in the group)
+ * - LimitedPtr: sharers.pointers child pointers; past that, the line is
+ *   marked as shared by all children until it loses all sharers (imprecise,
+ *   invalidates by broadcast)
+ * - Hybrid: sharers.pointers child pointers; past that, the line switches
+ *   to a full bit vector from a pool, until it loses all sharers (precise)
+ *
+ * Imprecise formats send invalidations to children that may not hold the
+ * line, which report so through InvReq::held. The tcc keeps the exact sharer
+ * count, and must call clear() when it drops to 0 so imprecise formats do
+ * not accumulate stale sharers.
+ *
+ * Pointers are 16 bits, storing child + 1, so zeroed entries are empty. All
+ * methods must be called with the cache's bcc lock held (tcc accesses and
+ * invalidations both hold it), which also protects the hybrid vector pool.
+ */
+
+enum SharerFormat {SHARERS_FULL, SHARERS_COARSE, SHARERS_LIMITED, SHARERS_HYBRID};
+
+class SharerArray : public GlobAlloc {
+    private:
+        static const uint16_t PTR_BCAST = 0xffff; //slot 0 of an overflowed LimitedPtr line
+        static const uint16_t PTR_VEC = 0xfffe; //slot 0 of an overflowed Hybrid line, vector index in the upper 32 bits
+        static const uint32_t MAX_PTR_CHILDREN = 0xfffd;
+
+        const SharerFormat format;
+        const uint32_t numLines;
+        const uint32_t param; //pointers (LimitedPtr, Hybrid) or children per bit (Coarse)
+        uint32_t numChildren;
+        uint32_t lineWords; //64-bit words per line
+        uint64_t* entries;
+
+        //Hybrid: full bit vectors of overflowed lines
+        uint32_t vecWords;
+        g_vector<uint64_t> vecPool;
+        g_vector<uint32_t> freeVecs;
+
+        Counter profOverflows, profSpuriousInvs;
+
+    public:
+        SharerArray(uint32_t _numLines, SharerFormat _format, uint32_t _param)
+            : format(_format), numLines(_numLines), param(_param), numChildren(0), lineWords(0), entries(nullptr), vecWords(0)
+        {
+            if (format != SHARERS_FULL && param == 0) panic("Sharer format needs pointers/coarseness > 0");
+        }
+
+        void init(uint32_t _numChildren, const char* name) {
+            numChildren = _numChildren;
+            uint32_t ptrWords = (param + 3)/4;
+            switch (format) {
+                case SHARERS_FULL: lineWords = (numChildren + 63)/64; break;
+                case SHARERS_COARSE: lineWords = ((numChildren + param - 1)/param + 63)/64; break;
+                case SHARERS_LIMITED: lineWords = ptrWords; break;
+                case SHARERS_HYBRID: lineWords = ptrWords; vecWords = (numChildren + 63)/64; break;
+            }
+            if ((format == SHARERS_LIMITED || format == SHARERS_HYBRID) && numChildren > MAX_PTR_CHILDREN) {
+                panic("[%s] Too many children (%d) for sharer pointers", name, numChildren);
+            }
+            lineWords = MAX(lineWords, 1u);
+            entries = gm_calloc<uint64_t>((size_t)numLines*lineWords);
+            info("[%s] Sharers: %s (%d), %d children, %ld KB", name, formatName(), param, numChildren, ((size_t)numLines*lineWords*8)/1024);
+        }
+
+        void initStats(AggregateStat* parentStat) {
+            profOverflows.init("dirOverflows", "Sharer sets that overflowed their pointers");
+            profSpuriousInvs.init("dirSpuriousInvs", "Invalidations sent to children that did not hold the line (imprecise sharers)");
+            parentStat->append(&profOverflows);
+            parentStat->append(&profSpuriousInvs);
+        }
+
+        // True if every child that forEach() returns holds the line
+        bool isPrecise() const {
+            return format == SHARERS_FULL || format == SHARERS_HYBRID || (format == SHARERS_COARSE && param == 1);
+        }
+
+        void recordSpuriousInvs(uint32_t n) {
+            profSpuriousInvs.inc(n);
+        }
+
+        void add(uint32_t lineId, uint32_t c) {
+            assert(c < numChildren);
+            uint64_t* e = &entries[(size_t)lineId*lineWords];
+            switch (format) {
+                case SHARERS_FULL: setBit(e, c); break;
+                case SHARERS_COARSE: setBit(e, c/param); break;
+                case SHARERS_LIMITED:
+                case SHARERS_HYBRID:
+                    if (getPtr(e, 0) == PTR_BCAST) break;
+                    if (getPtr(e, 0) == PTR_VEC) {
+                        setBit(getVec(e), c);
+                        break;
+                    }
+                    for (uint32_t i = 0; i < param; i++) {
+                        if (getPtr(e, i) == 0) {
+                            setPtr(e, i, c + 1);
+                            return;
+                        }
+                    }
+                    //Out of pointers
+                    profOverflows.inc();
+                    if (format == SHARERS_LIMITED) {
+                        memset(e, 0, lineWords*sizeof(uint64_t));
+                        setPtr(e, 0, PTR_BCAST);
+                    } else {
+                        uint32_t vecIdx = allocVec();
+                        uint64_t* vec = &vecPool[(size_t)vecIdx*vecWords];
+                        for (uint32_t i = 0; i < param; i++) setBit(vec, getPtr(e, i) - 1);
+                        setBit(vec, c);
+                        memset(e, 0, lineWords*sizeof(uint64_t));
+                        e[0] = PTR_VEC | (((uint64_t)vecIdx) << 32);
+                    }
+                    break;
+            }
+        }
+
+        // Imprecise formats may keep c as a potential sharer until clear()
+        void remove(uint32_t lineId, uint32_t c) {
+            assert(c < numChildren);
+            uint64_t* e = &entries[(size_t)lineId*lineWords];
+            switch (format) {
+                case SHARERS_FULL: clearBit(e, c); break;
+                case SHARERS_COARSE: break; //others in the group may still share it
+                case SHARERS_LIMITED:
+                case SHARERS_HYBRID:
+                    if (getPtr(e, 0) == PTR_BCAST) break;
+                    if (getPtr(e, 0) == PTR_VEC) {
+                        clearBit(getVec(e), c);
+                        break;
+                    }
+                    for (uint32_t i = 0; i < param; i++) {
+                        if (getPtr(e, i) == c + 1) {
+                            setPtr(e, i, 0);
+                            break;
+                        }
+                    }
+                    break;
+            }
+        }
+
+        void clear(uint32_t lineId) {
+            uint64_t* e = &entries[(size_t)lineId*lineWords];
+            if (format == SHARERS_HYBRID && getPtr(e, 0) == PTR_VEC) freeVecs.push_back(e[0] >> 32);
+            memset(e, 0, lineWords*sizeof(uint64_t));
+        }
+
+        // Exact for precise formats; otherwise, false means c is definitely not a sharer
+        bool mayContain(uint32_t lineId, uint32_t c) {
+            bool res = false;
+            forEach(lineId, [&](uint32_t s) { res = res || (s == c); });
+            return res;
+        }
+
+        // Calls f(child) for each (potential) sharer, visiting only set bits or used pointers
+        template <typename F> inline void forEach(uint32_t lineId, F f) {
+            uint64_t* e = &entries[(size_t)lineId*lineWords];
+            switch (format) {
+                case SHARERS_FULL:
+                    forEachBit(e, lineWords, f);
+                    break;
+                case SHARERS_COARSE:
+                    forEachBit(e, lineWords, [&](uint32_t g) {
+                        uint32_t end = MIN((g + 1)*param, numChildren);
+                        for (uint32_t c = g*param; c < end; c++) f(c);
+                    });
+                    break;
+                case SHARERS_LIMITED:
+                case SHARERS_HYBRID:
+                    if (getPtr(e, 0) == PTR_BCAST) {
+                        for (uint32_t c = 0; c < numChildren; c++) f(c);
+                    } else if (getPtr(e, 0) == PTR_VEC) {
+                        forEachBit(getVec(e), vecWords, f);
+                    } else {
+                        for (uint32_t i = 0; i < param; i++) {
+                            uint32_t p = getPtr(e, i);
+                            if (p) f(p - 1);
+                        }
+                    }
+                    break;
+            }
+        }
+
+    private:
+        static inline void setBit(uint64_t* words, uint32_t b) {words[b/64] |= 1UL << (b % 64);}
+        static inline void clearBit(uint64_t* words, uint32_t b) {words[b/64] &= ~(1UL << (b % 64));}
+
+        template <typename F> static inline void forEachBit(const uint64_t* words, uint32_t numWords, F f) {
+            for (uint32_t w = 0; w < numWords; w++) {
+                uint64_t bits = words[w];
+                while (bits) {
+                    f(w*64 + __builtin_ctzl(bits));
+                    bits &= bits - 1;
+                }
+            }
+        }
+
+        static inline uint32_t getPtr(const uint64_t* e, uint32_t i) {return (e[i/4] >> ((i % 4)*16)) & 0xffff;}
+        static inline void setPtr(uint64_t* e, uint32_t i, uint64_t p) {
+            uint32_t shift = (i % 4)*16;
+            e[i/4] = (e[i/4] & ~(0xffffUL << shift)) | (p << shift);
+        }
+
+        inline uint64_t* getVec(const uint64_t* e) {return &vecPool[(size_t)(e[0] >> 32)*vecWords];}
+
+        uint32_t allocVec() {
+            uint32_t vecIdx;
+            if (freeVecs.empty()) {
+                vecIdx = vecPool.size()/vecWords;
+                vecPool.resize(vecPool.size() + vecWords, 0);
+            } else {
+                vecIdx = freeVecs.back();
+                freeVecs.pop_back();
+                memset(&vecPool[(size_t)vecIdx*vecWords], 0, vecWords*sizeof(uint64_t));
+            }
+            return vecIdx;
+        }
+
+        const char* formatName() const {
+            switch (format) {
+                case SHARERS_FULL: return "Full";
+                case SHARERS_COARSE: return "Coarse";
+                case SHARERS_LIMITED: return "LimitedPtr";
+                case SHARERS_HYBRID: return "Hybrid";
+            }
+            return "?";
+        }
+};
+
+#endif  // SHARER_ARRAY_H
@@ -48,15 +48,39 @@ uint64_t SimpleCore::getPhaseCycles() const {
 }
 
 void SimpleCore::load(Address addr) {
-    l1d->setCoup(coup);
     curCycle = l1d->load(addr, curCycle);
-    coup_op(false);
 }
 
 void SimpleCore::store(Address addr) {
     curCycle = l1d->store(addr, curCycle);
 }
 
+void SimpleCore::coupUpdate(Address addr, CoupOp op) {
+    curCycle = l1d->coupUpdate(addr, curCycle, op);
+}
+
+//The L1 issues one flush per cycle, and the core waits for all of them (e.g., right before a barrier)
+void SimpleCore::coupFlush(Address addr, uint64_t bytes) {
+    if (!bytes) return;
+    Address firstLine = addr >> lineBits;
+    Address lastLine = (addr + bytes - 1) >> lineBits;
+    uint64_t doneCycle = curCycle;
+    for (Address lineAddr = firstLine; lineAddr <= lastLine; lineAddr++) {
+        doneCycle = MAX(doneCycle, l1d->coupFlush(lineAddr, curCycle + (lineAddr - firstLine)));
+    }
+    curCycle = doneCycle;
+}
+
+//Vector updates are issued like flushes, one line per cycle
+void SimpleCore::coupVectorUpdate(Address base, uint64_t laneMask, uint32_t width, CoupOp op) {
+    uint64_t doneCycle = curCycle;
+    uint64_t issueCycle = curCycle;
+    ForEachVectorUpdateLine(base, laneMask, width, lineBits, [&](Address vAddr, uint32_t lanes, uint64_t words) {
+        doneCycle = MAX(doneCycle, l1d->coupVectorUpdate(vAddr, issueCycle++, op, lanes, words));
+    });
+    curCycle = doneCycle;
+}
+
 void SimpleCore::bbl(Address bblAddr, BblInfo* bblInfo) {
     //info("BBL %s %p", name.c_str(), bblInfo);
     //info("%d %d", bblInfo->instrs, bblInfo->bytes);
@@ -91,7 +115,7 @@ void SimpleCore::join() {
 //Static class functions: Function pointers and trampolines
 
 InstrFuncPtrs SimpleCore::GetFuncPtrs() {
-    return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, FPTR_ANALYSIS, {0}};
+    return {LoadFunc, StoreFunc, BblFunc, BranchFunc, PredLoadFunc, PredStoreFunc, CoupUpdateFunc, FPTR_ANALYSIS};
 }
 
 void SimpleCore::LoadFunc(THREADID tid, ADDRINT addr) {
@@ -110,6 +134,10 @@ void SimpleCore::PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred) {
     if (pred) static_cast<SimpleCore*>(cores[tid])->store(addr);
 }
 
+void SimpleCore::CoupUpdateFunc(THREADID tid, ADDRINT addr, UINT32 op) {
+    static_cast<SimpleCore*>(cores[tid])->coupUpdate(addr, (CoupOp)op);
+}
+
 void SimpleCore::BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
     SimpleCore* core = static_cast<SimpleCore*>(cores[tid]);
     core->bbl(bblAddr, bblInfo);
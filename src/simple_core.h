@@ -54,6 +54,8 @@ class SimpleCore : public Core {
 
         void contextSwitch(int32_t gid);
         virtual void join();
+        virtual void coupFlush(Address addr, uint64_t bytes);
+        virtual void coupVectorUpdate(Address base, uint64_t laneMask, uint32_t width, CoupOp op);
 
         InstrFuncPtrs GetFuncPtrs();
 
@@ -61,6 +63,7 @@ class SimpleCore : public Core {
         //Simulation functions
         inline void load(Address addr);
         inline void store(Address addr);
+        inline void coupUpdate(Address addr, CoupOp op);
         inline void bbl(Address bblAddr, BblInfo* bblInstrs);
 
         static void LoadFunc(THREADID tid, ADDRINT addr);
@@ -68,6 +71,7 @@ class SimpleCore : public Core {
         static void BblFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo);
         static void PredLoadFunc(THREADID tid, ADDRINT addr, BOOL pred);
         static void PredStoreFunc(THREADID tid, ADDRINT addr, BOOL pred);
+        static void CoupUpdateFunc(THREADID tid, ADDRINT addr, UINT32 op);
 
         static void BranchFunc(THREADID, ADDRINT, BOOL, ADDRINT, ADDRINT) {}
 }  ATTR_LINE_ALIGNED; //This needs to take up a whole cache line, or false sharing will be extremely frequent
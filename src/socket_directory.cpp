@@ -0,0 +1,252 @@
+#include "socket_directory.h"
+#include <math.h>
+#include <string>
+#include "constants.h"
+#include "zsim.h"
+
+// Link stats columns: access types, then invalidation types
+static const uint32_t LINK_KINDS = (RFLUSH + 1) + (UPD + 1);
+
+static inline uint32_t linkKindCol(uint8_t kind) {
+    return (kind >= COH_EV_INV)? (RFLUSH + 1) + (kind - COH_EV_INV) : kind;
+}
+
+/* Socket end of the links: the directory's tcc sees each socket's LLC banks
+ * through these, so its invalidations, downgrades and reductions cross links.
+ */
+class SocketPort : public BaseCache {
+    private:
+        BaseCache* child;
+        SocketLinks* links;
+        const uint32_t home;
+        const uint32_t socket;
+
+    public:
+        SocketPort(BaseCache* _child, SocketLinks* _links, uint32_t _home, uint32_t _socket)
+            : child(_child), links(_links), home(_home), socket(_socket) {}
+
+        const char* getName() {return child->getName();}
+
+        void setParents(uint32_t _childId, const g_vector<MemObject*>& parents, Network* network) {panic("SocketPort has no parents");}
+        void setChildren(const g_vector<BaseCache*>& children, Network* network) {panic("SocketPort has no children");}
+        uint64_t access(MemReq& req) {panic("SocketPort is not accessed, sockets access the directory directly");}
+
+        uint64_t invalidate(const InvReq& req) {
+            uint8_t kind = COH_EV_INV + req.type;
+            //INVs of U lines are reductions (see MEUSITopCC::sendInvalidates): sockets that held the line send back their partial update
+            bool reduction = (req.type == INV) && (req.coupOp != COUP_NONE);
+            bool prevWriteback = *req.writeback;
+            InvReq sockReq = req;
+            sockReq.cycle = links->send(home, socket, kind, links->ctrl(), false, req.cycle);
+            uint64_t respCycle = child->invalidate(sockReq);
+            bool held = !req.held || *req.held;
+            bool sentPartial = reduction && held && (!req.partial || *req.partial);
+            bool respData = held && (sentPartial || (!prevWriteback && *req.writeback));
+            return links->send(socket, home, kind, respData? links->data() : links->ctrl(), sentPartial, respCycle);
+        }
+};
+
+/* Memory side of the directory: notes which requesters' accesses already read
+ * memory through the controller (directory misses)
+ */
+class DirMemPort : public MemObject {
+    private:
+        MemObject* mem;
+        bool* memRead;
+
+    public:
+        DirMemPort(MemObject* _mem, bool* _memRead) : mem(_mem), memRead(_memRead) {}
+
+        const char* getName() {return mem->getName();}
+
+        uint64_t access(MemReq& req) {
+            if (req.type == GETS || req.type == GETX) memRead[req.srcId] = true;
+            return mem->access(req);
+        }
+};
+
+/* SocketLinks */
+
+SocketLinks::SocketLinks(uint32_t _sockets, bool offSocketHome, uint32_t _latency, uint32_t megabytesPerSecond, uint32_t megacyclesPerSecond,
+        uint32_t _ctrlBytes, uint32_t _lineBytes, const g_string& _name)
+    : nodes(_sockets + (offSocketHome? 1 : 0)), sockets(_sockets), latency(_latency),
+      bytesPerCycle(((double)megabytesPerSecond)/((double)megacyclesPerSecond)), ctrlBytes(_ctrlBytes), lineBytes(_lineBytes), name(_name)
+{
+    if (!sockets) panic("%s: no sockets", name.c_str());
+    if (!(bytesPerCycle > 0.0)) panic("%s: link bandwidth must be > 0", name.c_str());
+    channels.resize(nodes*nodes);
+    for (uint32_t src = 0; src < nodes; src++) {
+        for (uint32_t dst = 0; dst < nodes; dst++) {
+            //Sockets talk to homes: every other socket with NUMA homes, or only the off-socket directory
+            bool used = (src != dst) && (!offSocketHome || src == dirNode() || dst == dirNode());
+            if (!used) {
+                channels[src*nodes + dst] = nullptr;
+                continue;
+            }
+            Channel* ch = new Channel();
+            ch->lastPhase = 0;
+            ch->curPhaseBytes = 0;
+            ch->smoothedPhaseBytes = 0.0;
+            ch->waitFactor = 0.0;
+            futex_init(&ch->updateLock);
+            channels[src*nodes + dst] = ch;
+        }
+    }
+}
+
+void SocketLinks::initStats(AggregateStat* parentStat) {
+    const char* kindNames[LINK_KINDS];
+    for (uint32_t k = 0; k <= RFLUSH; k++) kindNames[k] = AccessTypeName((AccessType)k);
+    for (uint32_t k = 0; k <= UPD; k++) kindNames[RFLUSH + 1 + k] = InvTypeName((InvType)k);
+
+    auto nodeName = [this](uint32_t node) {return (node == dirNode())? std::string("dir") : "s" + std::to_string(node);};
+
+    AggregateStat* linksStat = new AggregateStat();
+    linksStat->init(name.c_str(), "Socket link stats");
+    for (uint32_t src = 0; src < nodes; src++) {
+        for (uint32_t dst = 0; dst < nodes; dst++) {
+            Channel* ch = channels[src*nodes + dst];
+            if (!ch) continue;
+            AggregateStat* chStat = new AggregateStat();
+            chStat->init(gm_strdup((nodeName(src) + "-" + nodeName(dst)).c_str()), "Link stats (one direction)");
+            ch->profMsgs.init("msgs", "Messages, by the kind of transaction they are part of", LINK_KINDS, kindNames);
+            ch->profBytes.init("bytes", "Bytes, by the kind of transaction they are part of", LINK_KINDS, kindNames);
+            ch->profRedMsgs.init("redMsgs", "Partial updates of U lines (reductions and PUTUs)");
+            ch->profRedBytes.init("redBytes", "Bytes of partial updates of U lines (reductions and PUTUs)");
+            ch->profLat.init("lat", "Total latency of messages, including serialization and queueing");
+            ch->profLoad.init("load", "Sum of load factors (0-100) per update");
+            ch->profUpdates.init("ups", "Number of load updates");
+            ch->profClampedLoads.init("clampedLoads", "Number of updates where the load was clamped to 95%");
+            chStat->append(&ch->profMsgs);
+            chStat->append(&ch->profBytes);
+            chStat->append(&ch->profRedMsgs);
+            chStat->append(&ch->profRedBytes);
+            chStat->append(&ch->profLat);
+            chStat->append(&ch->profLoad);
+            chStat->append(&ch->profUpdates);
+            chStat->append(&ch->profClampedLoads);
+            linksStat->append(chStat);
+        }
+    }
+    parentStat->append(linksStat);
+}
+
+void SocketLinks::updateLoad(Channel* ch) {
+    uint64_t phaseCycles = (zinfo->numPhases - ch->lastPhase)*(zinfo->phaseLength);
+    if (phaseCycles < 10000) return; //Skip with short phases
+
+    ch->smoothedPhaseBytes = (ch->curPhaseBytes*0.5) + (ch->smoothedPhaseBytes*0.5);
+    double load = ch->smoothedPhaseBytes/(phaseCycles*bytesPerCycle);
+
+    //Clamp load
+    if (load > 0.95) {
+        load = 0.95;
+        ch->profClampedLoads.inc();
+    }
+
+    ch->waitFactor = 0.5*load/(1.0 - load); //M/D/1 mean wait (Pollaczek-Khinchine), in service times
+    ch->profLoad.inc((uint64_t)(load*100.0));
+    ch->profUpdates.inc();
+
+    ch->curPhaseBytes = 0;
+    __sync_synchronize();
+    ch->lastPhase = zinfo->numPhases;
+}
+
+uint64_t SocketLinks::send(uint32_t src, uint32_t dst, uint8_t kind, uint32_t bytes, bool reduction, uint64_t cycle) {
+    if (src == dst) return cycle;
+    Channel* ch = channels[src*nodes + dst];
+    assert(ch);
+    if (zinfo->numPhases > ch->lastPhase) {
+        futex_lock(&ch->updateLock);
+        //Recheck, someone may have updated already
+        if (zinfo->numPhases > ch->lastPhase) updateLoad(ch);
+        futex_unlock(&ch->updateLock);
+    }
+
+    uint64_t serLat = (uint64_t)ceil(bytes/bytesPerCycle);
+    uint64_t lat = latency + serLat + (uint64_t)(ch->waitFactor*serLat);
+
+    uint32_t col = linkKindCol(kind);
+    ch->profMsgs.atomicInc(col);
+    ch->profBytes.atomicInc(col, bytes);
+    if (reduction) {
+        ch->profRedMsgs.atomicInc();
+        ch->profRedBytes.atomicInc(bytes);
+    }
+    ch->profLat.atomicInc(lat);
+    __sync_fetch_and_add(&ch->curPhaseBytes, bytes);
+    return cycle + lat;
+}
+
+/* SocketDirectory */
+
+SocketDirectory::SocketDirectory(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, const g_string& _name)
+    : Cache(_numLines, _cc, _array, _rp, _accLat, _invLat, _name), links(nullptr), home(0), childrenPerSocket(0), selfId(0)
+{
+    memRead = gm_calloc<bool>(MAX_THREADS);
+}
+
+void SocketDirectory::connectSockets(SocketLinks* _links, uint32_t _home) {
+    links = _links;
+    home = _home;
+}
+
+void SocketDirectory::setParents(uint32_t _childId, const g_vector<MemObject*>& parents, Network* network) {
+    selfId = _childId;
+    mems = parents;
+    g_vector<MemObject*> memPorts;
+    for (MemObject* mem : parents) memPorts.push_back(new DirMemPort(mem, memRead));
+    Cache::setParents(_childId, memPorts, network);
+}
+
+void SocketDirectory::setChildren(const g_vector<BaseCache*>& children, Network* network) {
+    if (!links) panic("[%s] Directory is not connected to its sockets", name.c_str());
+    uint32_t sockets = links->getSockets();
+    if (children.size() % sockets != 0) panic("[%s] %ld children can't be split among %d sockets", name.c_str(), children.size(), sockets);
+    childrenPerSocket = children.size()/sockets;
+
+    //Child ids are positions in children, and each socket's banks are contiguous
+    g_vector<BaseCache*> ports;
+    for (uint32_t c = 0; c < children.size(); c++) ports.push_back(new SocketPort(children[c], links, home, c/childrenPerSocket));
+    Cache::setChildren(ports, network);
+}
+
+uint32_t SocketDirectory::getMemId(Address lineAddr) {
+    //Same hash as the bottom CC, so parallel reads go to the controller that holds the line
+    uint32_t res = 0;
+    uint64_t tmp = lineAddr;
+    for (uint32_t i = 0; i < 4; i++) {
+        res ^= (uint32_t) ( ((uint64_t)0xffff) & tmp);
+        tmp = tmp >> 16;
+    }
+    return (res % mems.size());
+}
+
+uint64_t SocketDirectory::access(MemReq& req) {
+    AccessType type = req.type; //the cache may change req.type on races
+    uint32_t socket = req.childId/childrenPerSocket;
+    uint32_t reqBytes = (type == PUTX || type == PUTU)? links->data() : links->ctrl();
+    if (type == RATOM) reqBytes += sizeof(uint64_t)*MAX(req.updateWords, 1u); //operands
+
+    uint64_t sendCycle = req.cycle;
+    req.cycle = links->send(socket, home, type, reqBytes, type == PUTU, sendCycle);
+
+    assert(req.srcId < MAX_THREADS);
+    memRead[req.srcId] = false;
+    uint64_t respCycle = Cache::access(req);
+
+    //Gets from I need the line, except U grants: updates start from the identity value
+    bool isGet = (type == GETS) || (type == GETX) || (type == GETU);
+    bool respData = isGet && req.initialState == I && *req.state != U;
+    if (respData && !memRead[req.srcId]) {
+        //Directory hit: the home reads memory as it looks up the directory (an owner socket's writeback may take longer)
+        MESIState state = I;
+        MemReq memReq = {req.lineAddr, GETS, selfId, &state, req.cycle, nullptr, state, req.srcId, MemReq::NOEXCL};
+        respCycle = MAX(respCycle, mems[getMemId(req.lineAddr)]->access(memReq));
+    }
+
+    respCycle = links->send(home, socket, type, respData? links->data() : links->ctrl(), false, respCycle);
+    req.cycle = sendCycle;
+    return respCycle;
+}
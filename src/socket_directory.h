@@ -0,0 +1,120 @@
+#ifndef SOCKET_DIRECTORY_H_
+#define SOCKET_DIRECTORY_H_
+
+#include <string>
+#include "cache.h"
+#include "g_std/g_string.h"
+#include "g_std/g_vector.h"
+#include "locks.h"
+#include "memory_hierarchy.h"
+#include "pad.h"
+#include "stats.h"
+
+/* Multi-socket systems: a memory-side directory (sys.caches.<grp>.type =
+ * "Directory") keeps the LLCs of several sockets coherent.
+ *
+ * The directory is the last-level group, and each of its child caches is a
+ * socket (e.g., l3 with caches = 2 under a directory with children = "l3" is
+ * a dual-socket system). It is a MEUSI (or MESI) cache whose array holds
+ * directory entries, not data: data lives in memory, so
+ *  - requests that need data read memory in parallel with the directory
+ *    lookup (and with any snoop of the owner socket), unless the directory
+ *    missed and already read the line from memory,
+ *  - evicting an entry invalidates (or reduces) the sockets' copies.
+ * U lines can span sockets: the LLCs of several sockets may hold a line in U,
+ * and reading it reduces their partial updates across the socket links.
+ *
+ * Sockets and directory banks talk over point-to-point links, configured in
+ * sys.caches.<grp>.links:
+ *  - latency: one-way latency, in cycles (default 40)
+ *  - bandwidth: per direction, in MB/s (default 20800)
+ *  - ctrlBytes: size of control messages (default 8); data messages add a line
+ *  - numaHomes: if true (default), directory banks (and the memory behind
+ *    them) are spread evenly across sockets, and only messages between a
+ *    socket and the home bank of another one cross a link. If false, the
+ *    directory is off-socket, and every message crosses a link.
+ * Each direction of a link serializes messages at its bandwidth, and adds the
+ * M/D/1 queueing delay of its utilization over the last phases (as
+ * MD1Memory does).
+ *
+ * Link stats (<grp>Links.<src>-<dst>) break down messages and bytes by
+ * transaction kind, and count reduction traffic (partial updates of U lines,
+ * from reductions and PUTUs). Running the same system with protocol = MESI
+ * and sys.coupMode = Atomic gives the MESI traffic to compare against: its
+ * updates cross links as GETX requests, data responses, and INVs.
+ */
+
+class SocketLinks : public GlobAlloc {
+    private:
+        struct Channel : public GlobAlloc {
+            uint64_t lastPhase;
+            uint64_t curPhaseBytes;
+            double smoothedPhaseBytes;
+            double waitFactor; //M/D/1 queueing delay, in units of serialization latency
+
+            VectorCounter profMsgs, profBytes;
+            Counter profRedMsgs, profRedBytes;
+            Counter profLat, profLoad, profUpdates, profClampedLoads;
+
+            lock_t updateLock;
+        };
+
+        const uint32_t nodes; //sockets, plus the directory if it is off-socket
+        const uint32_t sockets;
+        const uint32_t latency;
+        const double bytesPerCycle;
+        const uint32_t ctrlBytes;
+        const uint32_t lineBytes;
+        g_vector<Channel*> channels; //nodes x nodes, by (src, dst)
+        g_string name;
+
+    public:
+        SocketLinks(uint32_t _sockets, bool offSocketHome, uint32_t _latency, uint32_t megabytesPerSecond, uint32_t megacyclesPerSecond,
+                uint32_t _ctrlBytes, uint32_t _lineBytes, const g_string& _name);
+
+        void initStats(AggregateStat* parentStat);
+
+        uint32_t getSockets() const {return sockets;}
+
+        // Node of the off-socket directory (only with numaHomes = false)
+        uint32_t dirNode() const {return sockets;}
+
+        // Message sizes
+        uint32_t ctrl() const {return ctrlBytes;}
+        uint32_t data() const {return ctrlBytes + lineBytes;}
+
+        /* Sends a message of a transaction of this kind (an AccessType, or COH_EV_INV + InvType) from src to dst,
+         * leaving at cycle. Returns its arrival cycle; messages within a node don't use links.
+         */
+        uint64_t send(uint32_t src, uint32_t dst, uint8_t kind, uint32_t bytes, bool reduction, uint64_t cycle);
+
+    private:
+        void updateLoad(Channel* ch);
+};
+
+class SocketDirectory : public Cache {
+    private:
+        SocketLinks* links;
+        uint32_t home; //node of this bank
+        uint32_t childrenPerSocket;
+        uint32_t selfId;
+
+        g_vector<MemObject*> mems;
+        bool* memRead; //per srcId, set if the current access read memory through the controller (a directory miss)
+
+    public:
+        SocketDirectory(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, const g_string& _name);
+
+        // Init-time: called before setChildren, which puts each socket behind its links
+        void connectSockets(SocketLinks* _links, uint32_t _home);
+
+        void setParents(uint32_t _childId, const g_vector<MemObject*>& parents, Network* network);
+        void setChildren(const g_vector<BaseCache*>& children, Network* network);
+
+        uint64_t access(MemReq& req);
+
+    private:
+        uint32_t getMemId(Address lineAddr);
+};
+
+#endif  // SOCKET_DIRECTORY_H_
@@ -0,0 +1,115 @@
+#ifndef SPARSE_DIRECTORY_H
+#define SPARSE_DIRECTORY_H
+
+#include "galloc.h"
+#include "hash.h"
+#include "log.h"
+#include "memory_hierarchy.h"
+#include "stats.h"
+
+/* Sparse directory: a set-associative tag store that holds the top CC's
+ * entries (sharer state) only for lines that have sharers, sized
+ * independently of the cache (sys.caches.<grp>.directory.*).
+ *
+ * Without it, the top CC keeps one entry per cache line. With it, the tcc
+ * allocates an entry when a line gains its first sharer and frees it when
+ * the line loses its last one. Allocating into a full set evicts another
+ * line's entry, which requires invalidating (and, for U lines, reducing) all
+ * of that line's sharers; the line itself stays in the cache.
+ *
+ * Replacement (directory.repl):
+ * - LRU
+ * - FewestSharers: evict the entry with the fewest sharers (LRU on ties),
+ *   which minimizes directory-induced invalidations
+ *
+ * Entries are identified by their slot, which is what the tcc indexes its
+ * entries and sharer sets with. Must be called with the cache's locks held.
+ */
+class SparseDirectory : public GlobAlloc {
+    private:
+        const uint32_t numEntries;
+        const uint32_t ways;
+        const uint32_t numSets;
+        const bool fewestSharers;
+        HashFamily* hf;
+
+        Address* tags; //per slot
+        int32_t* lineIds; //per slot, cache line id, -1 if free
+        uint64_t* timestamps; //per slot
+        uint64_t curTimestamp;
+        int32_t* slots; //per cache line, slot of its entry or -1
+
+        Counter profAllocs, profEvictions, profEvictionsU, profEvictionInvs;
+
+    public:
+        SparseDirectory(uint32_t _numEntries, uint32_t _ways, bool _fewestSharers, uint32_t numCacheLines, HashFamily* _hf)
+            : numEntries(_numEntries), ways(_ways), numSets(_numEntries/_ways), fewestSharers(_fewestSharers), hf(_hf), curTimestamp(0)
+        {
+            if (!ways || numEntries % ways != 0) panic("Directory entries (%d) must be a multiple of its ways (%d)", numEntries, ways);
+            if (numSets & (numSets - 1)) panic("Directory sets (%d) must be a power of two", numSets);
+            tags = gm_calloc<Address>(numEntries);
+            lineIds = gm_calloc<int32_t>(numEntries);
+            timestamps = gm_calloc<uint64_t>(numEntries);
+            slots = gm_calloc<int32_t>(numCacheLines);
+            for (uint32_t i = 0; i < numEntries; i++) lineIds[i] = -1;
+            for (uint32_t i = 0; i < numCacheLines; i++) slots[i] = -1;
+        }
+
+        void initStats(AggregateStat* parentStat) {
+            profAllocs.init("dirAllocs", "Directory entries allocated");
+            profEvictions.init("dirEvictions", "Directory entries evicted (their sharers invalidated)");
+            profEvictionsU.init("dirEvictionsU", "Directory entries evicted with U sharers (reduced)");
+            profEvictionInvs.init("dirEvictionInvs", "Sharers invalidated by directory evictions");
+            parentStat->append(&profAllocs);
+            parentStat->append(&profEvictions);
+            parentStat->append(&profEvictionsU);
+            parentStat->append(&profEvictionInvs);
+        }
+
+        uint32_t getNumEntries() const {return numEntries;}
+
+        // Slot of the entry of a cache line, or -1 if it has none (so it has no sharers)
+        inline int32_t lookup(uint32_t lineId) const {return slots[lineId];}
+
+        inline void touch(uint32_t slot) {timestamps[slot] = curTimestamp++;}
+
+        inline bool isValid(uint32_t slot) const {return lineIds[slot] != -1;}
+        inline Address getLineAddr(uint32_t slot) const {return tags[slot];}
+        inline uint32_t getLineId(uint32_t slot) const {return lineIds[slot];}
+
+        // Returns the slot for lineAddr's entry; if it is valid, the caller must evict it (and erase() it) before postinsert()
+        template <typename NumSharersFunc> uint32_t preinsert(Address lineAddr, NumSharersFunc numSharers) {
+            uint32_t first = (hf->hash(0, lineAddr) & (numSets - 1))*ways;
+            uint32_t best = first;
+            for (uint32_t s = first; s < first + ways; s++) {
+                if (!isValid(s)) return s;
+                bool better = fewestSharers? (numSharers(s) < numSharers(best) || (numSharers(s) == numSharers(best) && timestamps[s] < timestamps[best]))
+                                           : timestamps[s] < timestamps[best];
+                if (better) best = s;
+            }
+            return best;
+        }
+
+        void postinsert(Address lineAddr, uint32_t lineId, uint32_t slot) {
+            assert(!isValid(slot) && slots[lineId] == -1);
+            tags[slot] = lineAddr;
+            lineIds[slot] = lineId;
+            slots[lineId] = slot;
+            touch(slot);
+            profAllocs.inc();
+        }
+
+        void erase(uint32_t slot) {
+            assert(isValid(slot));
+            slots[lineIds[slot]] = -1;
+            lineIds[slot] = -1;
+        }
+
+        void recordEviction(uint32_t numSharers, bool coupState) {
+            profEvictions.inc();
+            if (coupState) profEvictionsU.inc();
+            profEvictionInvs.inc(numSharers);
+        }
+};
+
+#endif  // SPARSE_DIRECTORY_H
@@ -25,6 +25,7 @@
 
 #include "timing_cache.h"
 #include "event_recorder.h"
+#include "reduction_unit.h"
 #include "timing_event.h"
 #include "zsim.h"
 
@@ -78,9 +79,20 @@ class ReplAccessEvent : public TimingEvent {
         void simulate(uint64_t startCycle) {cache->simulateReplAccess(this, startCycle);}
 };
 
+// Merges of COUP partial updates done by an access; postDelay is their bound-phase latency
+class ReductionEvent : public TimingEvent {
+    private:
+        TimingCache* cache;
+    public:
+        uint32_t ops;
+        ReductionEvent(TimingCache* _cache, uint32_t _ops, uint32_t postDelay, int32_t domain) : TimingEvent(0, postDelay, domain), cache(_cache), ops(_ops) {}
+        void simulate(uint64_t startCycle) {cache->simulateReduction(this, startCycle);}
+};
+
 TimingCache::TimingCache(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp,
-        uint32_t _accLat, uint32_t _invLat, uint32_t mshrs, uint32_t _tagLat, uint32_t _ways, uint32_t _cands, uint32_t _domain, const g_string& _name)
-    : Cache(_numLines, _cc, _array, _rp, _accLat, _invLat, _name), numMSHRs(mshrs), tagLat(_tagLat), ways(_ways), cands(_cands)
+        uint32_t _accLat, uint32_t _invLat, uint32_t mshrs, uint32_t _tagLat, uint32_t _ways, uint32_t _cands, uint32_t _domain, ReductionUnit* _redUnit,
+        const g_string& _name)
+    : Cache(_numLines, _cc, _array, _rp, _accLat, _invLat, _name), numMSHRs(mshrs), tagLat(_tagLat), ways(_ways), cands(_cands), redUnit(_redUnit)
 {
     lastFreeCycle = 0;
     lastAccCycle = 0;
@@ -110,8 +122,13 @@ void TimingCache::initStats(AggregateStat* parentStat) {
     parentStat->append(cacheStat);
 }
 
-// TODO(dsm): This is copied verbatim from Cache. We should split Cache into different methods, then call those.
 uint64_t TimingCache::access(MemReq& req) {
+    DISPATCH_CC(accessImpl, req);
+}
+
+// TODO(dsm): This is copied verbatim from Cache. We should split Cache into different methods, then call those.
+template <typename C>
+uint64_t TimingCache::accessImpl(C* cc, MemReq& req) {
     EventRecorder* evRec = zinfo->eventRecorders[req.srcId];
     assert_msg(evRec, "TimingCache is not connected to TimingCore");
 
@@ -123,21 +140,25 @@ uint64_t TimingCache::access(MemReq& req) {
     uint64_t respCycle = req.cycle;
     bool skipAccess = cc->startAccess(req); //may need to skip access due to races (NOTE: may change req.type!)
     if (likely(!skipAccess)) {
-        bool updateReplacement = (req.type == GETS) || (req.type == GETX);
+        bool updateReplacement = (req.type == GETS) || (req.type == GETX) || (req.type == GETU) || (req.type == RATOM);
         int32_t lineId = array->lookup(req.lineAddr, &req, updateReplacement);
         respCycle += accLat;
 
-        if (lineId == -1 /*&& cc->shouldAllocate(req)*/) {
+        //Remote atomics bypass the levels below their home bank (which is the only one that allocates them), and flushes never allocate
+        if (lineId == -1 && !((req.type == RATOM || req.type == RFLUSH) && !cc->shouldAllocate(req))) {
             assert(cc->shouldAllocate(req)); //dsm: for now, we don't deal with non-inclusion in TimingCache
 
             //Make space for new line
             Address wbLineAddr;
             lineId = array->preinsert(req.lineAddr, &req, &wbLineAddr); //find the lineId to replace
             trace(Cache, "[%s] Evicting 0x%lx", name.c_str(), wbLineAddr);
+            MESIState evState = cc->getState(lineId);
+            if (evTrace && evState != I) recordEvent(req.srcId, COH_EV_EVICTION, wbLineAddr, evState, I, COUP_NONE, respCycle);
 
             //Evictions are not in the critical path in any sane implementation -- we do not include their delays
             //NOTE: We might be "evicting" an invalid line for all we know. Coherence controllers will know what to do
             evDoneCycle = cc->processEviction(req, wbLineAddr, lineId, respCycle); //if needed, send invalidates/downgrades to lower level, and wb to upper level
+            if (transStats && evState != I) transStats->inc(evState, COH_EV_EVICTION, evDoneCycle - respCycle);
 
             array->postinsert(req.lineAddr, &req, lineId); //do the actual insertion. NOTE: Now we must split insert into a 2-phase thing because cc unlocks us.
 
@@ -145,10 +166,28 @@ uint64_t TimingCache::access(MemReq& req) {
         }
 
         uint64_t getDoneCycle = respCycle;
+        if (redUnit) redUnit->takePendingOps(); //drop merges from evictions and from invalidations that raced with us
+        MESIState oldState = (lineId != -1)? cc->getState(lineId) : I;
         respCycle = cc->processAccess(req, lineId, respCycle, &getDoneCycle);
+        if (evTrace) recordEvent(req.srcId, req.type, req.lineAddr, oldState, (lineId != -1)? cc->getState(lineId) : I, req.coupOp, req.cycle);
+        if (transStats) transStats->inc(oldState, req.type, respCycle - req.cycle);
+        if (hotLines && ((req.type == GETX && (oldState == S || oldState == U)) || (req.type == GETU && oldState == S))) {
+            hotLines->record(HOT_UPG, req.lineAddr, req.srcId);
+        }
+        uint32_t redOps = redUnit? redUnit->takePendingOps() : 0;
 
         if (evRec->hasRecord()) accessRecord = evRec->popRecord();
 
+        /* If this access merged partial updates (a reduction or a PUTU), the merges happen after the
+         * get completes (getDoneCycle), and the response waits for them. We model this with a
+         * ReductionEvent in front of the response, so reductions contend for the unit in the weave phase.
+         */
+        ReductionEvent* redEv = nullptr;
+        if (redOps) {
+            redEv = new (evRec) ReductionEvent(this, redOps, respCycle - getDoneCycle, domain);
+            redEv->setMinStartCycle(getDoneCycle);
+        }
+
         // At this point we have all the info we need to hammer out the timing record
         TimingRecord tr = {req.lineAddr << lineBits, req.cycle, respCycle, req.type, nullptr, nullptr}; //note the end event is the response, not the wback
 
@@ -157,11 +196,22 @@ uint64_t TimingCache::access(MemReq& req) {
             assert(!writebackRecord.isValid());
             assert(!accessRecord.isValid());
             uint64_t hitLat = respCycle - req.cycle; // accLat + invLat
-            HitEvent* ev = new (evRec) HitEvent(this, hitLat, domain);
-            ev->setMinStartCycle(req.cycle);
-            tr.startEvent = tr.endEvent = ev;
+            if (redEv) {
+                HitEvent* ev = new (evRec) HitEvent(this, getDoneCycle - req.cycle, domain);
+                ev->setMinStartCycle(req.cycle);
+                ev->addChild(redEv, evRec);
+                tr.startEvent = ev;
+                tr.endEvent = redEv;
+            } else {
+                HitEvent* ev = new (evRec) HitEvent(this, hitLat, domain);
+                ev->setMinStartCycle(req.cycle);
+                tr.startEvent = tr.endEvent = ev;
+            }
         } else {
-            assert_msg(getDoneCycle == respCycle, "gdc %ld rc %ld", getDoneCycle, respCycle);
+            // Without merges, the tcc may still take time after the get, e.g., sending UPDs to S sharers on a GETU
+            if (!redEv && respCycle != getDoneCycle) {
+                assert_msg(req.type == GETU, "gdc %ld rc %ld", getDoneCycle, respCycle);
+            }
 
             // Miss events:
             // MissStart (does high-prio lookup) -> getEvent || evictionEvent || replEvent (if needed) -> MissWriteback
@@ -255,6 +305,15 @@ uint64_t TimingCache::access(MemReq& req) {
 
             tr.startEvent = mse;
             tr.endEvent = mre; // note the end event is the response, not the wback
+            if (redEv) {
+                mre->addChild(redEv, evRec);
+                tr.endEvent = redEv; // the response also waits for the reduction
+            } else if (respCycle != getDoneCycle) {
+                DelayEvent* updEv = new (evRec) DelayEvent(respCycle - getDoneCycle);
+                updEv->setMinStartCycle(getDoneCycle);
+                mre->addChild(updEv, evRec);
+                tr.endEvent = updEv;
+            }
         }
         evRec->pushRecord(tr);
     }
@@ -362,3 +421,8 @@ void TimingCache::simulateReplAccess(ReplAccessEvent* ev, uint64_t cycle) {
     }
 }
 
+void TimingCache::simulateReduction(ReductionEvent* ev, uint64_t cycle) {
+    // Bound-phase latency is the postDelay; we only add the time spent waiting for earlier reductions
+    uint64_t stall = redUnit->weaveIssue(cycle, ev->ops);
+    ev->done(cycle + stall);
+}
@@ -34,6 +34,8 @@ class MissStartEvent;
 class MissResponseEvent;
 class MissWritebackEvent;
 class ReplAccessEvent;
+class ReductionEvent;
+class ReductionUnit;
 class TimingEvent;
 
 class TimingCache : public Cache {
@@ -51,13 +53,16 @@ class TimingCache : public Cache {
         // For zcache replacement simulation (pessimistic, assumes we walk the whole tree)
         uint32_t tagLat, ways, cands;
 
+        // COUP reductions contend for this unit in the weave phase (may be nullptr)
+        ReductionUnit* redUnit;
+
         PAD();
         lock_t topLock;
         PAD();
 
     public:
         TimingCache(uint32_t _numLines, CC* _cc, CacheArray* _array, ReplPolicy* _rp, uint32_t _accLat, uint32_t _invLat, uint32_t mshrs,
-                uint32_t tagLat, uint32_t ways, uint32_t cands, uint32_t _domain, const g_string& _name);
+                uint32_t tagLat, uint32_t ways, uint32_t cands, uint32_t _domain, ReductionUnit* _redUnit, const g_string& _name);
         void initStats(AggregateStat* parentStat);
 
         uint64_t access(MemReq& req);
@@ -67,8 +72,11 @@ class TimingCache : public Cache {
         void simulateMissResponse(MissResponseEvent* ev, uint64_t cycle, MissStartEvent* mse);
         void simulateMissWriteback(MissWritebackEvent* ev, uint64_t cycle, MissStartEvent* mse);
         void simulateReplAccess(ReplAccessEvent* ev, uint64_t cycle);
+        void simulateReduction(ReductionEvent* ev, uint64_t cycle);
 
     private:
+        template <typename C> uint64_t accessImpl(C* cc, MemReq& req); //see Cache
+
         uint64_t highPrioAccess(uint64_t cycle);
         uint64_t tryLowPrioAccess(uint64_t cycle);
 };
@@ -89,6 +89,30 @@ void TimingCore::storeAndRecord(Address addr) {
     cRec.record(startCycle);
 }
 
+void TimingCore::coupUpdateAndRecord(Address addr, CoupOp op) {
+    uint64_t startCycle = curCycle;
+    curCycle = l1d->coupUpdate(addr, curCycle, op);
+    cRec.record(startCycle);
+}
+
+//CoreRecorder models a blocking core, so unlike SimpleCore, flushes are issued one after the other
+void TimingCore::coupFlush(Address addr, uint64_t bytes) {
+    if (!bytes) return;
+    for (Address lineAddr = addr >> lineBits; lineAddr <= (addr + bytes - 1) >> lineBits; lineAddr++) {
+        uint64_t startCycle = curCycle;
+        curCycle = l1d->coupFlush(lineAddr, curCycle);
+        cRec.record(startCycle);
+    }
+}
+
+void TimingCore::coupVectorUpdate(Address base, uint64_t laneMask, uint32_t width, CoupOp op) {
+    ForEachVectorUpdateLine(base, laneMask, width, lineBits, [&](Address vAddr, uint32_t lanes, uint64_t words) {
+        uint64_t startCycle = curCycle;
+        curCycle = l1d->coupVectorUpdate(vAddr, curCycle, op, lanes, words);
+        cRec.record(startCycle);
+    });
+}
+
 void TimingCore::bblAndRecord(Address bblAddr, BblInfo* bblInfo) {
     instrs += bblInfo->instrs;
     curCycle += bblInfo->instrs;
@@ -103,7 +127,7 @@ void TimingCore::bblAndRecord(Address bblAddr, BblInfo* bblInfo) {
 
 
 InstrFuncPtrs TimingCore::GetFuncPtrs() {
-    return {LoadAndRecordFunc, StoreAndRecordFunc, BblAndRecordFunc, BranchFunc, PredLoadAndRecordFunc, PredStoreAndRecordFunc, FPTR_ANALYSIS, {0}};
+    return {LoadAndRecordFunc, StoreAndRecordFunc, BblAndRecordFunc, BranchFunc, PredLoadAndRecordFunc, PredStoreAndRecordFunc, CoupUpdateAndRecordFunc, FPTR_ANALYSIS};
 }
 
 void TimingCore::LoadAndRecordFunc(THREADID tid, ADDRINT addr) {
@@ -134,3 +158,7 @@ void TimingCore::PredStoreAndRecordFunc(THREADID tid, ADDRINT addr, BOOL pred) {
     if (pred) static_cast<TimingCore*>(cores[tid])->storeAndRecord(addr);
 }
 
+void TimingCore::CoupUpdateAndRecordFunc(THREADID tid, ADDRINT addr, UINT32 op) {
+    static_cast<TimingCore*>(cores[tid])->coupUpdateAndRecord(addr, (CoupOp)op);
+}
+
@@ -57,6 +57,8 @@ class TimingCore : public Core {
         void contextSwitch(int32_t gid);
         virtual void join();
         virtual void leave();
+        virtual void coupFlush(Address addr, uint64_t bytes);
+        virtual void coupVectorUpdate(Address base, uint64_t laneMask, uint32_t width, CoupOp op);
 
         InstrFuncPtrs GetFuncPtrs();
 
@@ -68,6 +70,7 @@ class TimingCore : public Core {
     private:
         inline void loadAndRecord(Address addr);
         inline void storeAndRecord(Address addr);
+        inline void coupUpdateAndRecord(Address addr, CoupOp op);
         inline void bblAndRecord(Address bblAddr, BblInfo* bblInstrs);
         inline void record(uint64_t startCycle);
 
@@ -76,6 +79,7 @@ class TimingCore : public Core {
         static void BblAndRecordFunc(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo);
         static void PredLoadAndRecordFunc(THREADID tid, ADDRINT addr, BOOL pred);
         static void PredStoreAndRecordFunc(THREADID tid, ADDRINT addr, BOOL pred);
+        static void CoupUpdateAndRecordFunc(THREADID tid, ADDRINT addr, UINT32 op);
 
         static void BranchFunc(THREADID, ADDRINT, BOOL, ADDRINT, ADDRINT) {}
 } ATTR_LINE_ALIGNED;
@@ -74,10 +74,14 @@ void TraceDriver::setParent(MemObject* _parent) {
     parent = _parent;
 }
 
-uint64_t TraceDriver::invalidate(uint32_t childId, Address lineAddr, InvType type, bool* reqWriteback, uint64_t reqCycle, uint32_t srcId) {
+uint64_t TraceDriver::invalidate(uint32_t childId, Address lineAddr, InvType type, bool* reqWriteback, uint64_t reqCycle, uint32_t srcId, bool* held) {
     assert(childId < numChildren);
     std::unordered_map<Address, MESIState>& cStore = children[childId].cStore;
     std::unordered_map<Address, MESIState>::iterator it = cStore.find(lineAddr);
+    if (held) {
+        *held = (it != cStore.end());
+        if (!*held) return 0;
+    }
     assert((it != cStore.end()));
     *reqWriteback = (it->second == M);
     if (type == INVX) {
@@ -43,9 +43,11 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include "access_tracing.h"
+#include "coherence_events.h"
 #include "constants.h"
 #include "contention_sim.h"
 #include "core.h"
+#include "coup_shadow.h"
 #include "cpuenum.h"
 #include "cpuid.h"
 #include "debug_zsim.h"
@@ -62,9 +64,6 @@
 #include "trace_driver.h"
 #include "virt/virt.h"
 
-
-#define __safe_coup_state_change(s, t)      if(cores[t] != nullptr) cores[t]->coup_op(s)
-
 //#include <signal.h> //can't include this, conflicts with PIN's
 
 /* Command-line switches (used to pass info from harness that cannot be passed through the config file, most config is file-based) */
@@ -147,7 +146,7 @@ VOID SimThreadStart(THREADID tid);
 VOID SimThreadFini(THREADID tid);
 VOID SimEnd();
 
-VOID HandleMagicOp(THREADID tid, ADDRINT op);
+VOID HandleMagicOp(THREADID tid, ADDRINT op, ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, ADDRINT arg3, ADDRINT arg4, REG* raxPtr);
 
 VOID FakeCPUIDPre(THREADID tid, REG eax, REG ecx);
 VOID FakeCPUIDPost(THREADID tid, ADDRINT* eax, ADDRINT* ebx, ADDRINT* ecx, ADDRINT* edx); //REG* eax, REG* ebx, REG* ecx, REG* edx);
@@ -170,17 +169,105 @@ VOID FFThread(VOID* arg);
 
 InstrFuncPtrs fPtrs[MAX_THREADS] ATTR_LINE_ALIGNED; //minimize false sharing
 
-bool isCoup[MAX_THREADS];
-static inline void initCoup() {
-    for(unsigned i = 0; i < MAX_THREADS; i++)
-        isCoup[i] = false;
+// Commutative update (COUP) magic ops, must match benchmark/coup_hooks.h
+#define ZSIM_MAGIC_OP_COUP_ADD          (1029)
+#define ZSIM_MAGIC_OP_COUP_AND          (1030)
+#define ZSIM_MAGIC_OP_COUP_OR           (1031)
+#define ZSIM_MAGIC_OP_COUP_XOR          (1032)
+#define ZSIM_MAGIC_OP_COUP_FLUSH        (1033) // not an update: reduces the U lines of [RDI, RDI+RSI), see HandleMagicOp
+// Emulated operators: the tagged instruction is a no-op lock add $0, and the update value is in RSI (see EmulateCoupUpdate)
+#define ZSIM_MAGIC_OP_COUP_FADD32       (1034)
+#define ZSIM_MAGIC_OP_COUP_FADD64       (1035)
+#define ZSIM_MAGIC_OP_COUP_MIN          (1036)
+#define ZSIM_MAGIC_OP_COUP_MAX          (1037)
+#define ZSIM_MAGIC_OP_COUP_VUPDATE      (1038) // vector update: no tagged instruction, see HandleMagicOp
+
+static inline CoupOp MagicOpToCoupOp(ADDRINT op) {
+    if (op >= ZSIM_MAGIC_OP_COUP_ADD && op <= ZSIM_MAGIC_OP_COUP_XOR) return (CoupOp)(COUP_ADD + (op - ZSIM_MAGIC_OP_COUP_ADD));
+    if (op >= ZSIM_MAGIC_OP_COUP_FADD32 && op <= ZSIM_MAGIC_OP_COUP_MAX) return (CoupOp)(COUP_FADD32 + (op - ZSIM_MAGIC_OP_COUP_FADD32));
+    return COUP_NONE;
+}
+
+// Operator of a tagged update: memory gets the one the instruction performs (insOp), except for emulated operators
+static inline CoupOp TaggedCoupOp(ADDRINT magicOp, CoupOp insOp) {
+    CoupOp op = MagicOpToCoupOp(magicOp);
+    return (op == COUP_NONE || IsEmulatedCoupOp(op))? op : insOp;
 }
 
 VOID PIN_FAST_ANALYSIS_CALL IndirectLoadSingle(THREADID tid, ADDRINT addr) {
-    if(isCoup[tid]) info("accessing coup load");
     fPtrs[tid].loadPtr(tid, addr);
-    isCoup[tid] = false;
-    if(cores[tid] != nullptr) cores[tid]->coup_op(false);
+}
+
+// Tagged updates whose operator is known at instrumentation time
+VOID PIN_FAST_ANALYSIS_CALL IndirectCoupUpdate(THREADID tid, ADDRINT addr, UINT32 op) {
+    fPtrs[tid].coupUpdatePtr(tid, addr, op);
+}
+
+// Tagged updates whose operator is only in ECX at runtime (e.g., non-inlined coup_add); bad values become plain loads
+VOID PIN_FAST_ANALYSIS_CALL IndirectCoupUpdateMagic(THREADID tid, ADDRINT addr, ADDRINT magicOp, UINT32 insOp) {
+    fPtrs[tid].coupUpdatePtr(tid, addr, TaggedCoupOp(magicOp, (CoupOp)insOp));
+}
+
+// Only inserted with sim.coupShadow; runs right after the update call. Emulated operators take their value from RSI.
+VOID CoupShadowUpdate(THREADID tid, ADDRINT addr, UINT32 size, ADDRINT value, UINT32 op, ADDRINT emuValue) {
+    if (op == COUP_NONE || fPtrs[tid].type != FPTR_ANALYSIS) return; //not simulated (e.g., fast-forwarding)
+    if (IsEmulatedCoupOp((CoupOp)op)) value = emuValue;
+    zinfo->coupShadow->update(getCid(tid), procMask | (addr >> lineBits), addr & (zinfo->lineSize - 1), size, (CoupOp)op, value);
+}
+
+// Same, when the operator is only in ECX (the magic op is still there at the tagged instruction)
+VOID CoupShadowUpdateMagic(THREADID tid, ADDRINT addr, UINT32 size, ADDRINT value, ADDRINT magicOp, ADDRINT emuValue, UINT32 insOp) {
+    CoupShadowUpdate(tid, addr, size, value, TaggedCoupOp(magicOp, (CoupOp)insOp), emuValue);
+}
+
+// Performs an update on the application's memory, with an atomic compare-and-swap
+static void AtomicCoupUpdate(ADDRINT addr, UINT32 size, ADDRINT value, CoupOp op) {
+    if (size == 4) {
+        uint32_t* p = (uint32_t*) addr;
+        uint32_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(p, &old, (uint32_t)ApplyCoupOp(op, old, value, 4), true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {}
+    } else if (size == 8) {
+        uint64_t* p = (uint64_t*) addr;
+        uint64_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(p, &old, ApplyCoupOp(op, old, value, 8), true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {}
+    } else {
+        panic("%s update of %d bytes at 0x%lx, only 4- and 8-byte updates can be emulated", CoupOpName(op), size, addr);
+    }
+}
+
+/* x86 has no atomic FP add, min or max, so tagged updates with these operators are lock add $0 (which the
+ * simulator treats like any other update), and we perform the update here, right before it. This runs on
+ * every tagged update, simulated or not, so results are the same in fast-forward. Natively, the hooks perform
+ * the update with a CAS loop instead (see coup_hooks.h), which HandleMagicOp tells them to skip under zsim.
+ */
+VOID EmulateCoupUpdate(ADDRINT addr, UINT32 size, ADDRINT value, ADDRINT magicOp) {
+    CoupOp op = MagicOpToCoupOp(magicOp);
+    if (IsEmulatedCoupOp(op)) AtomicCoupUpdate(addr, size, value, op);
+}
+
+/* Vector update (coup_vupdate): lane i is the width-byte word at base + i*width, and is updated with the one at
+ * vals + i*width if bit i of laneMask is set. There is no tagged instruction: we simulate one update per line the
+ * lanes touch, and perform the lanes' updates on memory, whether we simulate them or not (like EmulateCoupUpdate;
+ * natively, coup_vupdate updates the lanes itself). Cores queue the whole update as one op, whatever its lanes.
+ */
+static void CoupVectorUpdate(THREADID tid, ADDRINT base, uint64_t laneMask, ADDRINT vals, uint32_t width, CoupOp op) {
+    if (op == COUP_NONE) panic("Thread %d: vector update with an unknown operator", tid);
+    if ((width != 4 && width != 8) || (base & (width - 1))) {
+        panic("Thread %d: vector update of %d-byte lanes at 0x%lx, lanes must be 4 or 8 bytes and aligned", tid, width, base);
+    }
+    if (!laneMask) return;
+
+    bool simulated = fPtrs[tid].type == FPTR_ANALYSIS;
+    if (simulated) cores[tid]->coupVectorUpdate(base, laneMask, width, op);
+    for (uint64_t m = laneMask; m; m &= m - 1) {
+        uint32_t lane = __builtin_ctzl(m);
+        Address addr = base + lane*width;
+        uint64_t value = (width == 4)? *(uint32_t*)(vals + lane*width) : *(uint64_t*)(vals + lane*width);
+        if (simulated && zinfo->coupShadow) {
+            zinfo->coupShadow->update(getCid(tid), procMask | (addr >> lineBits), addr & (zinfo->lineSize - 1), width, op, value);
+        }
+        AtomicCoupUpdate(addr, width, value, op);
+    }
 }
 
 VOID PIN_FAST_ANALYSIS_CALL IndirectStoreSingle(THREADID tid, ADDRINT addr) {
@@ -252,11 +339,17 @@ VOID JoinAndPredStoreSingle(THREADID tid, ADDRINT addr, BOOL pred) {
     fPtrs[tid].predStorePtr(tid, addr, pred);
 }
 
+VOID JoinAndCoupUpdate(THREADID tid, ADDRINT addr, UINT32 op) {
+    Join(tid);
+    fPtrs[tid].coupUpdatePtr(tid, addr, op);
+}
+
 // NOP variants: Do nothing
 VOID NOPLoadStoreSingle(THREADID tid, ADDRINT addr) {}
 VOID NOPBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {}
 VOID NOPRecordBranch(THREADID tid, ADDRINT addr, BOOL taken, ADDRINT takenNpc, ADDRINT notTakenNpc) {}
 VOID NOPPredLoadStoreSingle(THREADID tid, ADDRINT addr, BOOL pred) {}
+VOID NOPCoupUpdate(THREADID tid, ADDRINT addr, UINT32 op) {}
 
 // FF is basically NOP except for basic blocks
 VOID FFBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
@@ -378,13 +471,13 @@ VOID FFIEntryBasicBlock(THREADID tid, ADDRINT bblAddr, BblInfo* bblInfo) {
 }
 
 // Non-analysis pointer vars
-static const InstrFuncPtrs joinPtrs = {JoinAndLoadSingle, JoinAndStoreSingle, JoinAndBasicBlock, JoinAndRecordBranch, JoinAndPredLoadSingle, JoinAndPredStoreSingle, FPTR_JOIN};
-static const InstrFuncPtrs nopPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
-static const InstrFuncPtrs retryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_RETRY};
-static const InstrFuncPtrs ffPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
+static const InstrFuncPtrs joinPtrs = {JoinAndLoadSingle, JoinAndStoreSingle, JoinAndBasicBlock, JoinAndRecordBranch, JoinAndPredLoadSingle, JoinAndPredStoreSingle, JoinAndCoupUpdate, FPTR_JOIN};
+static const InstrFuncPtrs nopPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPCoupUpdate, FPTR_NOP};
+static const InstrFuncPtrs retryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, NOPBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPCoupUpdate, FPTR_RETRY};
+static const InstrFuncPtrs ffPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPCoupUpdate, FPTR_NOP};
 
-static const InstrFuncPtrs ffiPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
-static const InstrFuncPtrs ffiEntryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIEntryBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, FPTR_NOP};
+static const InstrFuncPtrs ffiPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPCoupUpdate, FPTR_NOP};
+static const InstrFuncPtrs ffiEntryPtrs = {NOPLoadStoreSingle, NOPLoadStoreSingle, FFIEntryBasicBlock, NOPRecordBranch, NOPPredLoadStoreSingle, NOPPredLoadStoreSingle, NOPCoupUpdate, FPTR_NOP};
 
 static const InstrFuncPtrs& GetFFPtrs() {
     return ffiEnabled? (ffiNFF? ffiEntryPtrs : ffiPtrs) : ffPtrs;
@@ -543,7 +636,32 @@ static void PrintIp(THREADID tid, ADDRINT ip) {
 }
 #endif
 
-bool detect_coup = false;
+// The operator a tagged update's magic op names, if it comes from a constant mov to ECX right before it; COUP_NONE otherwise
+static CoupOp StaticCoupTag(INS ins) {
+    INS magicIns = INS_Prev(ins);
+    INS movIns = INS_Valid(magicIns)? INS_Prev(magicIns) : INS_Invalid();
+    if (!INS_Valid(movIns) || !INS_IsMov(movIns) || !INS_OperandIsReg(movIns, 0) || !INS_OperandIsImmediate(movIns, 1)) return COUP_NONE;
+    REG reg = INS_OperandReg(movIns, 0);
+    if (reg != REG_ECX && reg != REG_RCX) return COUP_NONE;
+    return MagicOpToCoupOp(INS_OperandImmediate(movIns, 1));
+}
+
+/* The operator of a COUP update if it is known at instrumentation time, COUP_NONE otherwise. Automatic updates
+ * get it from their opcode, and tagged ones from their tag (see StaticCoupTag). Native tagged updates perform the
+ * instruction's operator whatever the tag says, so we simulate that one, and warn if they disagree.
+ */
+static CoupOp StaticCoupOp(INS ins) {
+    if (!Decoder::isCoupTagged(ins)) return Decoder::autoCoupOp(ins);
+    CoupOp tagOp = StaticCoupTag(ins);
+    if (tagOp == COUP_NONE || IsEmulatedCoupOp(tagOp)) return tagOp;
+    CoupOp insOp = Decoder::rmwCoupOp(ins);
+    if (tagOp != insOp) {
+        warn("COUP update at 0x%lx (%s) is tagged %s, but performs %s; simulating it as %s", INS_Address(ins), INS_Disassemble(ins).c_str(),
+                CoupOpName(tagOp), CoupOpName(insOp), CoupOpName(insOp));
+    }
+    return insOp;
+}
+
 VOID Instruction(INS ins) {
     //Uncomment to print an instruction trace
     //INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)PrintIp, IARG_THREAD_ID, IARG_REG_VALUE, REG_INST_PTR, IARG_END);
@@ -555,11 +673,44 @@ VOID Instruction(INS ins) {
         AFUNPTR PredLoadFuncPtr = (AFUNPTR) IndirectPredLoadSingle;
         AFUNPTR PredStoreFuncPtr = (AFUNPTR) IndirectPredStoreSingle;
 
+        if (Decoder::isCoupUpdate(ins, procTreeNode->getCoupAuto())) {
+            //Tagged lock-prefixed RMW: a single update call replaces its load and store (must match Decoder::decodeCoupUpdate)
+            CoupOp op = StaticCoupOp(ins);
+            if (op != COUP_NONE) {
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) IndirectCoupUpdate, IARG_FAST_ANALYSIS_CALL, IARG_THREAD_ID, IARG_MEMORYREAD_EA,
+                        IARG_UINT32, (UINT32) op, IARG_END);
+            } else {
+                INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) IndirectCoupUpdateMagic, IARG_FAST_ANALYSIS_CALL, IARG_THREAD_ID, IARG_MEMORYREAD_EA,
+                        IARG_REG_VALUE, REG_ECX, IARG_UINT32, (UINT32) Decoder::rmwCoupOp(ins), IARG_END);
+            }
+            if (zinfo->coupShadow) {
+                //The update value is the source operand, either an immediate or a register (or implicit, for INC/DEC)
+                IARG_TYPE valArg = IARG_ADDRINT;
+                ADDRINT val = 0;
+                bool haveVal = true;
+                OPCODE opcode = INS_Opcode(ins);
+                if (opcode == XED_ICLASS_INC || opcode == XED_ICLASS_DEC) {
+                    val = (opcode == XED_ICLASS_INC)? (ADDRINT) 1 : (ADDRINT) -1;
+                } else if (INS_OperandIsImmediate(ins, 1)) {
+                    val = (ADDRINT) INS_OperandImmediate(ins, 1);
+                } else if (INS_OperandIsReg(ins, 1)) {
+                    valArg = IARG_REG_VALUE;
+                    val = (ADDRINT) INS_OperandReg(ins, 1);
+                } else {
+                    haveVal = false;
+                }
 
-        if (detect_coup && INS_LockPrefix(ins) && INS_IsMemoryRead(ins) && INS_IsMemoryWrite(ins) && INS_Opcode(ins) == XED_ICLASS_ADD) {
-            // even though it is not a load, we are requesting 
-            info("coup lock add: %s\n", INS_Disassemble(ins).c_str());
-            INS_InsertCall(ins, IPOINT_BEFORE, LoadFuncPtr, IARG_FAST_ANALYSIS_CALL, IARG_THREAD_ID, IARG_MEMORYREAD_EA, IARG_END); 
+                //The operator is passed as a constant if known, or read from ECX otherwise; native updates perform the instruction's
+                if (!haveVal) {
+                    warn("coupShadow: can't get the update value of %s, it won't be tracked", INS_Disassemble(ins).c_str());
+                } else if (op != COUP_NONE) {
+                    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) CoupShadowUpdate, IARG_THREAD_ID, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE,
+                            valArg, val, IARG_UINT32, (UINT32) op, IARG_REG_VALUE, REG_RSI, IARG_END);
+                } else {
+                    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) CoupShadowUpdateMagic, IARG_THREAD_ID, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE,
+                            valArg, val, IARG_REG_VALUE, REG_ECX, IARG_REG_VALUE, REG_RSI, IARG_UINT32, (UINT32) Decoder::rmwCoupOp(ins), IARG_END);
+                }
+            }
         } else {
 
             if (INS_IsMemoryRead(ins)) {
@@ -597,8 +748,15 @@ VOID Instruction(INS ins) {
         }
     }
 
-    detect_coup = false;
-    
+    //Emulated COUP updates must happen whether we simulate them or not (after the update and shadow calls, if any)
+    if (Decoder::isCoupTagged(ins)) {
+        CoupOp op = StaticCoupTag(ins);
+        if (op == COUP_NONE || IsEmulatedCoupOp(op)) {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) EmulateCoupUpdate, IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE,
+                    IARG_REG_VALUE, REG_RSI, IARG_REG_VALUE, REG_ECX, IARG_END);
+        }
+    }
+
     //Intercept and process magic ops
     /* xchg %rcx, %rcx is our chosen magic op. It is effectively a NOP, but it
      * is never emitted by any x86 compiler, as they use other (recommended) nop
@@ -606,9 +764,10 @@ VOID Instruction(INS ins) {
      */
     if (INS_IsXchg(ins) && INS_OperandReg(ins, 0) == REG_RCX && INS_OperandReg(ins, 1) == REG_RCX) {
         //info("Instrumenting magic op");
-        info("Instruction: %s\n", INS_Disassemble(ins).c_str());
-        detect_coup = true;
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleMagicOp, IARG_THREAD_ID, IARG_REG_VALUE, REG_ECX, IARG_END);
+        //Ops with arguments (e.g., COUP_FLUSH) take them in RDI, RSI, RDX, R8 and R9, and ops that return a value use RAX
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleMagicOp, IARG_THREAD_ID, IARG_REG_VALUE, REG_ECX,
+                IARG_REG_VALUE, REG_RDI, IARG_REG_VALUE, REG_RSI, IARG_REG_VALUE, REG_RDX,
+                IARG_REG_VALUE, REG_R8, IARG_REG_VALUE, REG_R9, IARG_REG_REFERENCE, REG_RAX, IARG_END);
     }
 
     if (INS_Opcode(ins) == XED_ICLASS_CPUID) {
@@ -631,7 +790,7 @@ VOID Trace(TRACE trace, VOID *v) {
     if (!procTreeNode->isInFastForward() || !zinfo->ffReinstrument) {
         // Visit every basic block in the trace
         for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
-            BblInfo* bblInfo = Decoder::decodeBbl(bbl, zinfo->oooDecode);
+            BblInfo* bblInfo = Decoder::decodeBbl(bbl, zinfo->oooDecode, procTreeNode->getCoupAuto());
             BBL_InsertCall(bbl, IPOINT_BEFORE /*could do IPOINT_ANYWHERE if we redid load and store simulation in OOO*/, (AFUNPTR)IndirectBasicBlock, IARG_FAST_ANALYSIS_CALL,
                  IARG_THREAD_ID, IARG_ADDRINT, BBL_Address(bbl), IARG_PTR, bblInfo, IARG_END);
         }
@@ -1145,6 +1304,7 @@ VOID SimEnd() {
         zinfo->trigger = 20000;
         for (StatsBackend* backend : *(zinfo->statsBackends)) backend->dump(false /*unbuffered, write out*/);
         for (AccessTraceWriter* t : *(zinfo->traceWriters)) t->dump(false);  // flushes trace writer
+        if (zinfo->cohEvents) zinfo->cohEvents->flushAll();
 
         if (zinfo->sched) zinfo->sched->notifyTermination();
     }
@@ -1165,7 +1325,9 @@ VOID SimEnd() {
 #define ZSIM_MAGIC_OP_REGISTER_THREAD   (1027)
 #define ZSIM_MAGIC_OP_HEARTBEAT         (1028)
 
-VOID HandleMagicOp(THREADID tid, ADDRINT op) {
+// COUP magic ops (1029-1038) are defined above, with the update analysis functions
+
+VOID HandleMagicOp(THREADID tid, ADDRINT op, ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, ADDRINT arg3, ADDRINT arg4, REG* raxPtr) {
     switch (op) {
         case ZSIM_MAGIC_OP_ROI_BEGIN:
             if (!zinfo->ignoreHooks) {
@@ -1222,15 +1384,29 @@ VOID HandleMagicOp(THREADID tid, ADDRINT op) {
             procTreeNode->heartbeat(); //heartbeats are per process for now
             return;
 
-        // HACK: Ubik magic ops
-        case 1029:
-        case 1030:
-        case 1031:
-        case 1032:
-        case 1033:
-            info("Thread %d: issued %ld\n", tid, op);
-            isCoup[tid] = true;
-            if(cores[tid] != nullptr) cores[tid]->coup_op(true);
+        case ZSIM_MAGIC_OP_COUP_ADD:
+        case ZSIM_MAGIC_OP_COUP_AND:
+        case ZSIM_MAGIC_OP_COUP_OR:
+        case ZSIM_MAGIC_OP_COUP_XOR:
+            //Nothing to do, the tagged lock-prefixed RMW that follows is instrumented with coupUpdatePtr (see Instruction())
+            return;
+        case ZSIM_MAGIC_OP_COUP_FADD32:
+        case ZSIM_MAGIC_OP_COUP_FADD64:
+        case ZSIM_MAGIC_OP_COUP_MIN:
+        case ZSIM_MAGIC_OP_COUP_MAX:
+            //Same, but EmulateCoupUpdate performs them at the tagged instruction. Tell the hook (RAX = 1), so it skips its
+            //native CAS loop, which we would simulate as a plain load and locked RMW
+            *raxPtr = (REG) 1;
+            return;
+        case ZSIM_MAGIC_OP_COUP_FLUSH:
+            //Reduce the U lines of the range now (e.g., before a barrier), so the reads after it don't wait for
+            //reductions. It's only a performance hint, so threads that are not being simulated skip it.
+            if (fPtrs[tid].type == FPTR_ANALYSIS) cores[tid]->coupFlush(arg0, arg1);
+            return;
+        case ZSIM_MAGIC_OP_COUP_VUPDATE:
+            //RDI: base, RSI: lane mask, RDX: lane values, R8: lane width (bytes), R9: operator (its magic op)
+            CoupVectorUpdate(tid, arg0, arg1, arg2, arg3, MagicOpToCoupOp(arg4));
+            *raxPtr = (REG) 1; //performed, the hook skips its native lane loop
             return;
         default:
             panic("Thread %d issued unknown magic op %ld!", tid, op);
@@ -1475,8 +1651,6 @@ int main(int argc, char *argv[]) {
     logfile_ss << KnobOutputDir.Value() << "/zsim.log." << procIdx;
     InitLog(header, KnobLogToFile.Value()? logfile_ss.str().c_str() : nullptr);
 
-    initCoup();
-
     //If parent dies, kill us
     //This avoids leaving strays running in any circumstances, but may be too heavy-handed with arbitrary process hierarchies.
     //If you ever need this disabled, sim.pinOptions = "-injection child" does the trick
@@ -31,6 +31,7 @@
 #include "constants.h"
 #include "debug.h"
 #include "locks.h"
+#include "memory_hierarchy.h"
 #include "pad.h"
 
 class Core;
@@ -48,6 +49,8 @@ class PortVirtualizer;
 class VectorCounter;
 class AccessTraceWriter;
 class TraceDriver;
+class CoupShadow;
+class CoherenceEventTrace;
 template <typename T> class g_vector;
 
 struct ClockDomainInfo {
@@ -181,6 +184,18 @@ struct GlobSimInfo {
     // Trace-driven simulation (no cores)
     bool traceDriven;
     TraceDriver* traceDriver;
+
+    // COUP shadow-value model, validates reductions (nullptr unless sim.coupShadow is set)
+    CoupShadow* coupShadow;
+
+    // Binary coherence event trace (nullptr unless some cache sets traceEvents)
+    CoherenceEventTrace* cohEvents;
+
+    // Track the 8-byte words U lines are updated on, so reads of other words skip reductions (sys.coupWordMasks)
+    bool coupWordMasks;
+
+    // How commutative updates are performed: COUP, remote atomics or plain atomics (sys.coupMode)
+    CoupMode coupMode;
 };
 
 